@@ -0,0 +1,201 @@
+#include "accelerationcache.h"
+#include "bvh.h"
+#include <stdio.h>
+#include <string.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char AccelerationCacheMagic[8] = { 'T', 'R', 'A', 'Y', 'A', 'C', 'C', '\0' };
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+MappedFile::Open(char const* path)
+{
+    this->Close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (data == nullptr)
+    {
+        if (mapping)
+            CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    this->file = file;
+    this->mapping = mapping;
+    this->data = data;
+    this->size = (size_t)size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping keeps the file alive
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+    this->data = data;
+    this->size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+MappedFile::Close()
+{
+    if (this->data == nullptr)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(this->data);
+    CloseHandle(this->mapping);
+    CloseHandle(this->file);
+    this->file = nullptr;
+    this->mapping = nullptr;
+#else
+    munmap(this->data, this->size);
+#endif
+    this->data = nullptr;
+    this->size = 0;
+}
+
+//------------------------------------------------------------------------------
+/**
+    64 bit FNV-1a over 32 bit words, bounds are hashed by their bits
+*/
+unsigned long long
+HashPrimitiveBounds(std::vector<BBox> const& primBounds)
+{
+    unsigned long long hash = 14695981039346656037ull;
+    auto add = [&hash](unsigned word)
+    {
+        hash ^= word;
+        hash *= 1099511628211ull;
+    };
+
+    add((unsigned)primBounds.size());
+    for (BBox const& b : primBounds)
+    {
+        unsigned words[6];
+        memcpy(&words[0], b.min, sizeof(b.min));
+        memcpy(&words[3], b.max, sizeof(b.max));
+        for (unsigned w : words)
+            add(w);
+    }
+    return hash;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static unsigned long long
+AlignCacheOffset(unsigned long long offset)
+{
+    return (offset + 63) & ~63ull;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+WriteAccelerationCache(std::string const& path, AccelerationCacheHeader& header,
+                       void const* bvhNodes, void const* bvhPrims, void const* nodes, void const* prims)
+{
+    memcpy(header.magic, AccelerationCacheMagic, sizeof(header.magic));
+    header.version = AccelerationCacheVersion;
+    header.padding = 0;
+
+    AccelerationCacheArray* arrays[4] = { &header.bvhNodes, &header.bvhPrims, &header.nodes, &header.prims };
+    void const* data[4] = { bvhNodes, bvhPrims, nodes, prims };
+    size_t elementSizes[4] = { sizeof(BVHNode), sizeof(unsigned), header.nodeSize, sizeof(unsigned) };
+    unsigned long long offset = AlignCacheOffset(sizeof(AccelerationCacheHeader));
+    for (int i = 0; i < 4; i++)
+    {
+        arrays[i]->offset = offset;
+        offset = AlignCacheOffset(offset + arrays[i]->count * elementSizes[i]);
+    }
+
+    std::string tempPath = path + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+
+    static const char zeros[64] = {};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    unsigned long long written = sizeof(header);
+    for (int i = 0; i < 4 && ok; i++)
+    {
+        ok = fwrite(zeros, 1, (size_t)(arrays[i]->offset - written), file) == arrays[i]->offset - written;
+        size_t bytes = (size_t)(arrays[i]->count * elementSizes[i]);
+        if (ok && bytes > 0)
+            ok = fwrite(data[i], 1, bytes, file) == bytes;
+        written = arrays[i]->offset + bytes;
+    }
+    ok = fclose(file) == 0 && ok;
+
+    if (ok)
+    {
+        // rename does not replace existing files everywhere
+        remove(path.c_str());
+        ok = rename(tempPath.c_str(), path.c_str()) == 0;
+    }
+    if (!ok)
+        remove(tempPath.c_str());
+    return ok;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+AccelerationCacheHeader const*
+ReadAccelerationCache(MappedFile const& file, unsigned long long key, unsigned nodeSize)
+{
+    if (!file.IsOpen() || file.Size() < sizeof(AccelerationCacheHeader))
+        return nullptr;
+
+    AccelerationCacheHeader const* header = (AccelerationCacheHeader const*)file.Data();
+    if (memcmp(header->magic, AccelerationCacheMagic, sizeof(header->magic)) != 0 ||
+        header->version != AccelerationCacheVersion ||
+        header->key != key ||
+        header->nodeSize != nodeSize)
+        return nullptr;
+
+    AccelerationCacheArray const* arrays[4] = { &header->bvhNodes, &header->bvhPrims, &header->nodes, &header->prims };
+    size_t elementSizes[4] = { sizeof(BVHNode), sizeof(unsigned), nodeSize, sizeof(unsigned) };
+    for (int i = 0; i < 4; i++)
+    {
+        if (arrays[i]->offset % 64 != 0 ||
+            arrays[i]->offset > file.Size() ||
+            arrays[i]->count > (file.Size() - arrays[i]->offset) / elementSizes[i])
+            return nullptr;
+    }
+    return header;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <stddef.h>
+#include "bbox.h"
+
+//------------------------------------------------------------------------------
+/**
+    Read only view of a whole file, mapped into memory
+*/
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile() { this->Close(); }
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+
+    // map the file, returns false if it could not be opened
+    bool Open(char const* path);
+    void Close();
+
+    bool IsOpen() const { return this->data != nullptr; }
+    void const* Data() const { return this->data; }
+    size_t Size() const { return this->size; }
+
+private:
+    void* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+// bump whenever the file layout, a node layout or a builder changes
+static constexpr unsigned AccelerationCacheVersion = 2;
+
+//------------------------------------------------------------------------------
+/**
+    An array in a cache file, offset in bytes from the start of the file
+*/
+struct AccelerationCacheArray
+{
+    unsigned long long offset;
+    unsigned long long count;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Start of an acceleration structure cache file. The arrays follow it, each
+    starting on a 64 byte boundary so that nodes are traversed straight from
+    the mapping.
+*/
+struct AccelerationCacheHeader
+{
+    char magic[8];
+    unsigned version;
+    // AccelerationStructure and BVHBuilder of the cached trees
+    unsigned structure;
+    unsigned builder;
+    // size of a node in the nodes array, catches layout changes that forgot to bump the version
+    unsigned nodeSize;
+    // key the file was written for
+    unsigned long long key;
+    // BVH::buildCost of the binary tree
+    float buildCost;
+    unsigned padding;
+    // binary bvh, kept for refitting
+    AccelerationCacheArray bvhNodes;
+    AccelerationCacheArray bvhPrims;
+    // wide or quantized layout traversed by Raycast, empty if that is the binary bvh
+    AccelerationCacheArray nodes;
+    AccelerationCacheArray prims;
+};
+
+// hash of the primitive bounds, which is all a build depends on besides its settings
+unsigned long long HashPrimitiveBounds(std::vector<BBox> const& primBounds);
+
+// write header and arrays, counts and nodeSize must be filled in, offsets are filled in here.
+// Goes through a temporary file, so readers never see a partial one
+bool WriteAccelerationCache(std::string const& path, AccelerationCacheHeader& header,
+                            void const* bvhNodes, void const* bvhPrims, void const* nodes, void const* prims);
+
+// returns the header if the mapped file is a complete cache for the given key, version and node sizes
+AccelerationCacheHeader const* ReadAccelerationCache(MappedFile const& file, unsigned long long key, unsigned nodeSize);
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<class TYPE>
+inline TYPE const*
+AccelerationCacheData(MappedFile const& file, AccelerationCacheArray const& array)
+{
+    return array.count > 0 ? (TYPE const*)((char const*)file.Data() + array.offset) : nullptr;
+}
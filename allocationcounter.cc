@@ -0,0 +1,108 @@
+#include "allocationcounter.h"
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+namespace
+{
+std::atomic<unsigned long long> allocationCount(0);
+std::atomic<unsigned long long> allocatedBytes(0);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+unsigned long long
+AllocationCount()
+{
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+unsigned long long
+AllocatedBytes()
+{
+    return allocatedBytes.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+/**
+    The array and nothrow forms call these by default, so they are counted as well
+*/
+void*
+operator new(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    void* p = malloc(size > 0 ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+operator delete(void* p, size_t) noexcept
+{
+    free(p);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Over-aligned types, such as the nodes of the wide trees
+*/
+void*
+operator new(size_t size, std::align_val_t alignment)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    size_t align = (size_t)alignment;
+    // aligned_alloc wants a multiple of the alignment
+    size = (size + align - 1) & ~(align - 1);
+#ifdef _MSC_VER
+    void* p = _aligned_malloc(size > 0 ? size : align, align);
+#else
+    void* p = aligned_alloc(align, size > 0 ? size : align);
+#endif
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+operator delete(void* p, std::align_val_t) noexcept
+{
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+operator delete(void* p, size_t, std::align_val_t alignment) noexcept
+{
+    operator delete(p, alignment);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+//------------------------------------------------------------------------------
+/**
+    Number of heap allocations made through operator new since the program
+    started, counted by the replacements of the global operators in
+    allocationcounter.cc. Take the difference around a piece of code to see
+    whether it allocates.
+*/
+unsigned long long AllocationCount();
+
+// bytes requested by those allocations, frees are not subtracted
+unsigned long long AllocatedBytes();
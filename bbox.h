@@ -0,0 +1,86 @@
+#pragma once
+#include "vec3.h"
+#include <float.h>
+#include <math.h>
+
+//------------------------------------------------------------------------------
+/**
+    Axis aligned bounding box, stored in single precision
+*/
+struct BBox
+{
+    float min[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float max[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+    void Grow(BBox const& rhs)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            this->min[i] = fminf(this->min[i], rhs.min[i]);
+            this->max[i] = fmaxf(this->max[i], rhs.max[i]);
+        }
+    }
+
+    void Grow(float const p[3])
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            this->min[i] = fminf(this->min[i], p[i]);
+            this->max[i] = fmaxf(this->max[i], p[i]);
+        }
+    }
+
+    // true if nothing has been grown into the box yet
+    bool IsEmpty() const
+    {
+        return this->min[0] > this->max[0];
+    }
+
+    float Extent(int axis) const
+    {
+        return this->max[axis] - this->min[axis];
+    }
+
+    float Center(int axis) const
+    {
+        return (this->min[axis] + this->max[axis]) * 0.5f;
+    }
+
+    // index of the longest axis
+    int LongestAxis() const
+    {
+        int axis = 0;
+        if (this->Extent(1) > this->Extent(axis)) axis = 1;
+        if (this->Extent(2) > this->Extent(axis)) axis = 2;
+        return axis;
+    }
+
+    // half of the surface area, which is all the SAH needs
+    float HalfArea() const
+    {
+        if (this->IsEmpty())
+            return 0.0f;
+        float x = this->Extent(0);
+        float y = this->Extent(1);
+        float z = this->Extent(2);
+        return x * y + y * z + z * x;
+    }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Bounding box of a sphere, rounded outwards so that it contains the sphere
+    despite the rounding of the sums
+*/
+inline BBox
+SphereBounds(vec3 center, float radius)
+{
+    BBox box;
+    float const* c = &center.x;
+    for (int i = 0; i < 3; i++)
+    {
+        box.min[i] = nextafterf(c[i] - radius, -FLT_MAX);
+        box.max[i] = nextafterf(c[i] + radius, FLT_MAX);
+    }
+    return box;
+}
@@ -0,0 +1,823 @@
+#include "benchmark.h"
+#include "sphere.h"
+#include "plane.h"
+#include "trianglemesh.h"
+#include "objloader.h"
+#include "objectmetadata.h"
+#include "allocationcounter.h"
+#include "cpufeatures.h"
+#include "parallel.h"
+#include "threadpool.h"
+#include "numa.h"
+#include <chrono>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+
+namespace
+{
+
+//------------------------------------------------------------------------------
+/**
+    Set associative cache with LRU replacement, of cache lines or pages
+*/
+class CacheSimulator
+{
+public:
+    CacheSimulator(size_t entries, unsigned ways) :
+        ways(ways),
+        numSets(entries / ways),
+        tags(numSets * ways, ~0ull),
+        lastUse(numSets * ways, 0)
+    {
+    }
+
+    // returns false on a miss, which loads the entry
+    bool Access(uint64_t tag)
+    {
+        uint64_t* tags = &this->tags[(tag % this->numSets) * this->ways];
+        uint64_t* used = &this->lastUse[(tag % this->numSets) * this->ways];
+        this->clock++;
+        unsigned victim = 0;
+        for (unsigned w = 0; w < this->ways; w++)
+        {
+            if (tags[w] == tag)
+            {
+                used[w] = this->clock;
+                return true;
+            }
+            if (used[w] < used[victim])
+                victim = w;
+        }
+        tags[victim] = tag;
+        used[victim] = this->clock;
+        this->misses++;
+        return false;
+    }
+
+    uint64_t misses = 0;
+
+private:
+    unsigned ways;
+    size_t numSets;
+    std::vector<uint64_t> tags;
+    std::vector<uint64_t> lastUse;
+    uint64_t clock = 0;
+};
+
+//------------------------------------------------------------------------------
+/**
+    L1, L2 and data TLB of a typical desktop core. The L2 fetches both lines
+    of an aligned 128 byte pair on a miss, like the adjacent line prefetcher
+    does, and the TLB maps 4 KB pages.
+*/
+struct CacheHierarchy
+{
+    CacheSimulator l1 = CacheSimulator(32 * 1024 / 64, 8);
+    CacheSimulator l2 = CacheSimulator(1024 * 1024 / 64, 16);
+    CacheSimulator tlb = CacheSimulator(64, 4);
+    uint64_t fetches = 0;
+
+    void operator()(void const* address, size_t bytes)
+    {
+        if (bytes == 0)
+            return;
+        this->fetches++;
+        uint64_t first = (uint64_t)(uintptr_t)address / 64;
+        uint64_t last = ((uint64_t)(uintptr_t)address + bytes - 1) / 64;
+        for (uint64_t line = first; line <= last; line++)
+        {
+            this->tlb.Access(line / 64);
+            if (!this->l1.Access(line) && !this->l2.Access(line))
+            {
+                // the prefetched buddy does not count as a miss of its own
+                uint64_t misses = this->l2.misses;
+                this->l2.Access(line ^ 1);
+                this->l2.misses = misses;
+            }
+        }
+    }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Trace all rays through a tree, once for timing and once through the cache simulator
+*/
+template<class TREE>
+void
+MeasureLayout(char const* name, TREE const& tree, std::vector<Ray> const& rays, std::vector<Object*> const& prims)
+{
+    auto traceAll = [&](auto&& visit)
+    {
+        for (Ray const& ray : rays)
+        {
+            float tMax = FLT_MAX;
+            tree.Intersect(ray, tMax, [&](unsigned prim)
+            {
+                HitResult hit;
+                if (prims[prim]->Intersect(ray, tMax, hit))
+                    tMax = hit.t;
+            }, visit);
+        }
+    };
+
+    // best of three
+    float best = FLT_MAX;
+    for (int run = 0; run < 3; run++)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        traceAll(NoVisit());
+        auto stop = std::chrono::high_resolution_clock::now();
+        float seconds = std::chrono::duration<float>(stop - start).count();
+        best = seconds < best ? seconds : best;
+    }
+
+    CacheHierarchy cache;
+    traceAll(cache);
+
+    float numRays = (float)rays.size();
+    printf("  %-24s %8.3f %12.2f %12.2f %12.2f %12.2f\n", name, numRays / best * 1e-6f,
+        cache.fetches / numRays, cache.l1.misses / numRays, cache.l2.misses / numRays, cache.tlb.misses / numRays);
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkBVHLayout(Raytracer& rt)
+{
+    // scatter rays off the first and second hit of rpp rays through every pixel center,
+    // in the order TracePath would trace them
+    std::vector<Ray> rays;
+    vec3 origin = get_position(rt.view);
+    for (unsigned y = 0; y < rt.height; y++)
+    {
+        for (unsigned x = 0; x < rt.width; x++)
+        {
+            float u = ((x + 0.5f) / rt.width) * 2.0f - 1.0f;
+            float v = ((y + 0.5f) / rt.height) * 2.0f - 1.0f;
+            for (unsigned sample = 0; sample < rt.rpp; sample++)
+            {
+                Ray ray(origin, transform(vec3(u, v, -1.0f), rt.frustum));
+                RandomStream random(y * rt.width + x, sample, RandomStream::CameraBounce);
+                for (int bounce = 0; bounce < 2; bounce++)
+                {
+                    vec3 point;
+                    vec3 normal;
+                    Object* object;
+                    float distance;
+                    if (!rt.Raycast(ray, point, normal, object, distance))
+                        break;
+                    random = random.NextBounce();
+                    ray = object->ScatterRay(ray, point, normal, random);
+                    rays.push_back(ray);
+                }
+            }
+        }
+    }
+
+    std::vector<Object*> prims;
+    std::vector<BBox> primBounds;
+    for (Object* object : rt.GetObjects())
+    {
+        BBox bounds;
+        if (object->GetBounds(bounds))
+        {
+            prims.push_back(object);
+            primBounds.push_back(bounds);
+        }
+    }
+
+    BVH depthFirst;
+    depthFirst.Build(primBounds, rt.bvhBuilder);
+    BVH treelet = depthFirst;
+    treelet.Reorder(BVHLayout::Treelet);
+    WideBVH<8> depthFirst8;
+    depthFirst8.Build(depthFirst);
+    WideBVH<8> treelet8 = depthFirst8;
+    treelet8.Reorder(BVHLayout::Treelet);
+
+    printf("BVH layout benchmark: %u bounce rays, %u objects, simulated 32 KB L1, 1 MB L2 and 64 entry TLB\n",
+        (unsigned)rays.size(), (unsigned)prims.size());
+    printf("  %-24s %8s %12s %12s %12s %12s\n", "layout", "MRays/s", "fetches/ray", "L1 miss/ray", "L2 miss/ray", "TLB miss/ray");
+    MeasureLayout("binary, depth first", depthFirst, rays, prims);
+    MeasureLayout("binary, treelets", treelet, rays, prims);
+    MeasureLayout("8 wide, depth first", depthFirst8, rays, prims);
+    MeasureLayout("8 wide, treelets", treelet8, rays, prims);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkRaySorting(Raytracer& rt)
+{
+    Integrator integrator = rt.integrator;
+    bool sortSecondaryRays = rt.sortSecondaryRays;
+    rt.integrator = Integrator::Wavefront;
+
+    // the settings take turns, and each bounce keeps its best round, to even out the noise of other processes
+    constexpr int numFrames = 2;
+    constexpr int numRounds = 3;
+    std::vector<WavefrontBounceStats> results[2];
+    // the first frame builds the structure and warms up the caches
+    rt.Raytrace();
+    for (int round = 0; round < numRounds; round++)
+    {
+        for (int sorted = 0; sorted < 2; sorted++)
+        {
+            rt.sortSecondaryRays = sorted != 0;
+            rt.GetWavefront().ResetStats();
+            for (int frame = 0; frame < numFrames; frame++)
+                rt.Raytrace();
+
+            std::vector<WavefrontBounceStats> const& stats = rt.GetWavefront().bounceStats;
+            std::vector<WavefrontBounceStats>& best = results[sorted];
+            best.resize(std::max(best.size(), stats.size()));
+            for (size_t bounce = 0; bounce < stats.size(); bounce++)
+            {
+                if (best[bounce].rays == 0 || stats[bounce].extendTime + stats[bounce].sortTime < best[bounce].extendTime + best[bounce].sortTime)
+                    best[bounce] = stats[bounce];
+            }
+        }
+    }
+
+    rt.Clear();
+    rt.integrator = integrator;
+    rt.sortSecondaryRays = sortSecondaryRays;
+
+    printf("Ray sorting benchmark: %u x %u pixels, %u rays per pixel, best of %d rounds of %d frames, extend stage of the wavefront integrator\n",
+        rt.width, rt.height, rt.rpp, numRounds, numFrames);
+    printf("  %-8s %10s %16s %16s %12s %20s\n", "bounce", "rays", "unsorted MRays/s", "sorted MRays/s", "sort ms", "incl. sort MRays/s");
+    size_t numBounces = std::min(results[0].size(), results[1].size());
+    for (size_t bounce = 0; bounce < numBounces; bounce++)
+    {
+        WavefrontBounceStats const& unsorted = results[0][bounce];
+        WavefrontBounceStats const& sorted = results[1][bounce];
+        printf("  %-8u %10llu %16.3f %16.3f %12.2f %20.3f\n", (unsigned)bounce, sorted.rays,
+            unsorted.rays / unsorted.extendTime * 1e-6,
+            sorted.rays / sorted.extendTime * 1e-6,
+            sorted.sortTime * 1e3 / numFrames,
+            sorted.rays / (sorted.extendTime + sorted.sortTime) * 1e-6);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BenchmarkOcclusion(Raytracer& rt)
+{
+    // rays of the AO preview, short and from surfaces, and shadow rays to the sun, which run
+    // out of the scene unless blocked
+    struct Query
+    {
+        Ray ray;
+        float maxDist;
+    };
+    std::vector<Query> queries[2];
+    vec3 origin = get_position(rt.view);
+    vec3 sun = normalize(vec3(0.3f, 1.0f, 0.2f));
+    for (unsigned y = 0; y < rt.height; y++)
+    {
+        for (unsigned x = 0; x < rt.width; x++)
+        {
+            float u = ((x + 0.5f) / rt.width) * 2.0f - 1.0f;
+            float v = ((y + 0.5f) / rt.height) * 2.0f - 1.0f;
+            vec3 point;
+            vec3 normal;
+            Object* object;
+            float distance;
+            if (!rt.Raycast(Ray(origin, transform(vec3(u, v, -1.0f), rt.frustum)), point, normal, object, distance))
+                continue;
+            RandomStream random(y * rt.width + x, 0, RandomStream::CameraBounce + 1);
+            for (unsigned i = 0; i < rt.aoSamples; i++)
+                queries[0].push_back({ Ray(point, normalize(normalize(normal) + random_point_on_unit_sphere(random))), rt.aoDistance });
+            queries[1].push_back({ Ray(point, sun), FLT_MAX });
+        }
+    }
+
+    printf("Occlusion benchmark: closest hit against any hit on the same rays, best of 3\n");
+    printf("  %-16s %10s %10s %18s %18s %10s\n", "rays", "count", "occluded", "Raycast MRays/s", "Occluded MRays/s", "mismatches");
+    char const* names[2] = { "ambient occlusion", "shadow" };
+    for (int set = 0; set < 2; set++)
+    {
+        std::vector<Query> const& rays = queries[set];
+        std::vector<char> closest(rays.size());
+        std::vector<char> any(rays.size());
+        float best[2] = { FLT_MAX, FLT_MAX };
+        for (int run = 0; run < 3; run++)
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < rays.size(); i++)
+            {
+                vec3 point;
+                vec3 normal;
+                Object* object;
+                float distance;
+                closest[i] = rt.Raycast(rays[i].ray, point, normal, object, distance) && distance < rays[i].maxDist;
+            }
+            auto middle = std::chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < rays.size(); i++)
+                any[i] = rt.Occluded(rays[i].ray, rays[i].maxDist);
+            auto stop = std::chrono::high_resolution_clock::now();
+            best[0] = std::min(best[0], std::chrono::duration<float>(middle - start).count());
+            best[1] = std::min(best[1], std::chrono::duration<float>(stop - middle).count());
+        }
+
+        unsigned occluded = 0;
+        unsigned mismatches = 0;
+        for (size_t i = 0; i < rays.size(); i++)
+        {
+            occluded += any[i] ? 1 : 0;
+            mismatches += closest[i] != any[i] ? 1 : 0;
+        }
+        float numRays = (float)rays.size();
+        printf("  %-16s %10u %10u %18.3f %18.3f %10u\n", names[set], (unsigned)rays.size(), occluded,
+            numRays / best[0] * 1e-6f, numRays / best[1] * 1e-6f, mismatches);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Heap bytes are measured by the allocation counter around creating the
+    objects, so they include the objects themselves and anything their
+    constructors allocate
+*/
+void
+BenchmarkObjectMemory(Raytracer& rt)
+{
+    const unsigned count = 100000;
+    unsigned sceneMaterials = MaterialCount();
+    std::vector<Object*> objects(count);
+    ObjectMetadata metadata;
+    Material material;
+
+    auto measure = [count](auto&& create)
+    {
+        unsigned long long start = AllocatedBytes();
+        create();
+        return (double)(AllocatedBytes() - start) / count;
+    };
+
+    double sphereBytes = measure([&]()
+    {
+        for (unsigned i = 0; i < count; i++)
+            objects[i] = new Sphere(1.0f, vec3(i, 0, 0), 0);
+    });
+    // one material per sphere, as main.cc creates them
+    double materialBytes = measure([&]()
+    {
+        for (unsigned i = 0; i < count; i++)
+            AddMaterial(material);
+    });
+    double metadataBytes = measure([&]()
+    {
+        for (unsigned i = 0; i < count; i++)
+        {
+            metadata.SetName(objects[i], "Sphere " + std::to_string(i));
+            metadata.SetPurpose(objects[i], "one of the spheres of the memory report");
+        }
+    });
+    for (Object* object : objects)
+        delete object;
+    double planeBytes = measure([&]()
+    {
+        for (unsigned i = 0; i < count; i++)
+            objects[i] = new Plane(vec3(0, 1, 0), (float)i, 0);
+    });
+    for (Object* object : objects)
+        delete object;
+
+    printf("Object memory, bytes per object over %u objects\n", count);
+    printf("  %-28s %8u sizeof, %8.1f allocated\n", "Sphere", (unsigned)sizeof(Sphere), sphereBytes);
+    printf("  %-28s %8u sizeof, %8.1f allocated\n", "Plane", (unsigned)sizeof(Plane), planeBytes);
+    printf("  %-28s %8u sizeof, %8.1f allocated\n", "Material, one per object", (unsigned)sizeof(Material), materialBytes);
+    printf("  %-28s %8s        %8.1f allocated, only for objects that are given them\n", "name and purpose", "", metadataBytes);
+
+    size_t numObjects = rt.GetObjects().size();
+    printf("Scene: %u objects, %.2f MB of objects and %.2f MB of materials at the sizes above\n",
+        (unsigned)numObjects, numObjects * sphereBytes / (1024.0 * 1024.0), sceneMaterials * materialBytes / (1024.0 * 1024.0));
+}
+
+//------------------------------------------------------------------------------
+/**
+    Times whole frames, so everything between the camera and the frame buffer
+    counts: ray setup, traversal, shading and the vector math of all of them
+*/
+void
+BenchmarkRaytrace(Raytracer& rt)
+{
+    struct Setting
+    {
+        char const* name;
+        Integrator integrator;
+        unsigned packetSize;
+    };
+    Setting const settings[] =
+    {
+        { "recursive", Integrator::Recursive, 1 },
+        { "recursive, packets of 16", Integrator::Recursive, 16 },
+        { "wavefront", Integrator::Wavefront, 1 },
+        { "ambient occlusion", Integrator::AmbientOcclusion, 1 },
+    };
+    constexpr int numSettings = sizeof(settings) / sizeof(settings[0]);
+    Integrator integrator = rt.integrator;
+    unsigned packetSize = rt.packetSize;
+    InstructionSet instructionSet = GetInstructionSet();
+
+    // every instruction set the kernels can run with on this cpu
+    InstructionSet const allLevels[] = { InstructionSet::Baseline, InstructionSet::AVX2, InstructionSet::AVX512 };
+    constexpr int maxLevels = sizeof(allLevels) / sizeof(allLevels[0]);
+    InstructionSet levels[maxLevels];
+    int numLevels = 0;
+    for (InstructionSet level : allLevels)
+    {
+        if (InstructionSetAvailable(level))
+            levels[numLevels++] = level;
+    }
+
+    // the settings take turns, and each keeps its best frame, to even out the noise of other processes
+    constexpr int numRounds = 5;
+    float best[maxLevels][numSettings];
+    for (int l = 0; l < maxLevels; l++)
+    {
+        for (int i = 0; i < numSettings; i++)
+            best[l][i] = FLT_MAX;
+    }
+    // the first frame builds the structure and warms up the caches
+    rt.Raytrace();
+    for (int round = 0; round < numRounds; round++)
+    {
+        for (int l = 0; l < numLevels; l++)
+        {
+            SetInstructionSet(levels[l]);
+            for (int i = 0; i < numSettings; i++)
+            {
+                rt.integrator = settings[i].integrator;
+                rt.packetSize = settings[i].packetSize;
+                auto start = std::chrono::high_resolution_clock::now();
+                rt.Raytrace();
+                auto stop = std::chrono::high_resolution_clock::now();
+                best[l][i] = std::min(best[l][i], std::chrono::duration<float>(stop - start).count());
+            }
+        }
+    }
+
+    rt.Clear();
+    rt.integrator = integrator;
+    rt.packetSize = packetSize;
+    SetInstructionSet(instructionSet);
+
+    float numSamples = (float)rt.width * rt.height * rt.rpp;
+    printf("Raytrace benchmark: %u x %u pixels, %u rays per pixel, %u bounces, best frame of %d\n",
+        rt.width, rt.height, rt.rpp, rt.bounces, numRounds);
+    printf("  ms/frame and MSamples/s of the kernels of each instruction set the cpu supports\n");
+    printf("  %-28s", "integrator");
+    for (int l = 0; l < numLevels; l++)
+        printf(" %10s %10s", InstructionSetName(levels[l]), "MSamples/s");
+    printf("\n");
+    for (int i = 0; i < numSettings; i++)
+    {
+        printf("  %-28s", settings[i].name);
+        for (int l = 0; l < numLevels; l++)
+            printf(" %10.2f %10.3f", best[l][i] * 1e3f, numSamples / best[l][i] * 1e-6f);
+        printf("\n");
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    The file goes to the working directory and is removed afterwards. Every
+    sphere becomes a band of quads between rings of latitude, split into
+    triangles, with the ones at the poles degenerate.
+    Spheres are not hit from inside and triangles are, so the hit counts
+    differ when the camera is inside a sphere
+*/
+void
+BenchmarkMesh(Raytracer& rt)
+{
+    constexpr unsigned rings = 16;
+    constexpr unsigned segments = 32;
+    char const* path = "trayracer_benchmark_mesh.obj";
+
+    std::vector<Object*> others;
+    FILE* file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        printf("Could not write %s\n", path);
+        return;
+    }
+    unsigned numSpheres = 0;
+    for (Object* object : rt.GetObjects())
+    {
+        Sphere* sphere = dynamic_cast<Sphere*>(object);
+        if (sphere == nullptr)
+        {
+            others.push_back(object);
+            continue;
+        }
+        for (unsigned ring = 0; ring <= rings; ring++)
+        {
+            float theta = (float)MPI * ring / rings;
+            for (unsigned segment = 0; segment < segments; segment++)
+            {
+                float phi = 2.0f * (float)MPI * segment / segments;
+                vec3 p = sphere->center + vec3(sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)) * sphere->radius;
+                fprintf(file, "v %.6f %.6f %.6f\n", p.x, p.y, p.z);
+            }
+        }
+        // counter clockwise seen from outside, indices are relative to the vertices of this sphere
+        int base = -(int)((rings + 1) * segments);
+        for (unsigned ring = 0; ring < rings; ring++)
+        {
+            for (unsigned segment = 0; segment < segments; segment++)
+            {
+                int a = base + (int)(ring * segments + segment);
+                int b = base + (int)(ring * segments + (segment + 1) % segments);
+                fprintf(file, "f %d %d %d %d\n", a, b, b + (int)segments, a + (int)segments);
+            }
+        }
+        numSpheres++;
+    }
+    long fileSize = ftell(file);
+    fclose(file);
+
+    std::vector<float> positions;
+    std::vector<unsigned> indices;
+    auto start = std::chrono::high_resolution_clock::now();
+    bool loaded = LoadObj(path, positions, indices);
+    auto stop = std::chrono::high_resolution_clock::now();
+    remove(path);
+    if (!loaded)
+    {
+        printf("Could not load %s\n", path);
+        return;
+    }
+    float loadTime = std::chrono::duration<float>(stop - start).count();
+
+    Material material;
+    TriangleMesh mesh(std::move(positions), std::move(indices), AddMaterial(material), rt.bvhBuilder);
+    std::vector<Color> frameBuffer(rt.width * rt.height);
+    Raytracer meshScene(rt.width, rt.height, frameBuffer, rt.rpp, rt.bounces);
+    meshScene.accelerationStructure = rt.accelerationStructure;
+    meshScene.bvhBuilder = rt.bvhBuilder;
+    meshScene.bvhLayout = rt.bvhLayout;
+    meshScene.staticDispatch = rt.staticDispatch;
+    meshScene.SetViewMatrix(rt.view);
+    for (Object* object : others)
+        meshScene.AddObject(object);
+    meshScene.AddObject(&mesh);
+
+    printf("Mesh benchmark: %u spheres as %u triangles, %u vertices\n", numSpheres, mesh.TriangleCount(), mesh.VertexCount());
+    printf("  OBJ of %.1f MB loaded in %.1f ms, %.1f MB/s with %u threads\n", fileSize / (1024.0f * 1024.0f),
+        loadTime * 1e3f, fileSize / (1024.0f * 1024.0f) / loadTime, NumParallelThreads());
+    printf("  bvh and triangle arrays built in %.1f ms, %.2f MB\n", mesh.buildTime, mesh.MemoryUsage() / (1024.0f * 1024.0f));
+
+    // camera rays through the pixel centers, and shadow rays to the sun from where they hit the spheres
+    std::vector<Ray> cameraRays;
+    std::vector<Ray> shadowRays;
+    vec3 origin = get_position(rt.view);
+    vec3 sun = normalize(vec3(0.3f, 1.0f, 0.2f));
+    for (unsigned y = 0; y < rt.height; y++)
+    {
+        for (unsigned x = 0; x < rt.width; x++)
+        {
+            float u = ((x + 0.5f) / rt.width) * 2.0f - 1.0f;
+            float v = ((y + 0.5f) / rt.height) * 2.0f - 1.0f;
+            Ray ray(origin, transform(vec3(u, v, -1.0f), rt.frustum));
+            cameraRays.push_back(ray);
+            vec3 point;
+            vec3 normal;
+            Object* object;
+            float distance;
+            if (rt.Raycast(ray, point, normal, object, distance))
+                shadowRays.push_back(Ray(point + normal * 0.01f, sun));
+        }
+    }
+
+    printf("  %-10s %10s %18s %18s\n", "scene", "hits", "Raycast MRays/s", "Occluded MRays/s");
+    Raytracer* scenes[2] = { &rt, &meshScene };
+    char const* names[2] = { "spheres", "triangles" };
+    for (int i = 0; i < 2; i++)
+    {
+        Raytracer& scene = *scenes[i];
+        unsigned hits = 0;
+        float best[2] = { FLT_MAX, FLT_MAX };
+        for (int run = 0; run < 3; run++)
+        {
+            hits = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            for (Ray const& ray : cameraRays)
+            {
+                vec3 point;
+                vec3 normal;
+                Object* object;
+                float distance;
+                hits += scene.Raycast(ray, point, normal, object, distance) ? 1 : 0;
+            }
+            auto middle = std::chrono::high_resolution_clock::now();
+            for (Ray const& ray : shadowRays)
+                scene.Occluded(ray, FLT_MAX);
+            auto stop = std::chrono::high_resolution_clock::now();
+            best[0] = std::min(best[0], std::chrono::duration<float>(middle - start).count());
+            best[1] = std::min(best[1], std::chrono::duration<float>(stop - middle).count());
+        }
+        printf("  %-10s %10u %18.3f %18.3f\n", names[i], hits, cameraRays.size() / best[0] * 1e-6f, shadowRays.size() / best[1] * 1e-6f);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Thread counts take turns like the settings of BenchmarkRaytrace
+*/
+void
+BenchmarkScaling(Raytracer& rt)
+{
+    unsigned maxThreads = rt.numThreads > 0 ? rt.numThreads : NumParallelThreads();
+    std::vector<unsigned> threadCounts;
+    for (unsigned n = 1; n < maxThreads; n *= 2)
+        threadCounts.push_back(n);
+    threadCounts.push_back(maxThreads);
+
+    constexpr int numRounds = 5;
+    unsigned numThreads = rt.numThreads;
+    std::vector<float> best(threadCounts.size(), FLT_MAX);
+    std::vector<unsigned> steals(threadCounts.size(), 0);
+    // the first frame builds the structure and warms up the caches
+    rt.Raytrace();
+    for (int round = 0; round < numRounds; round++)
+    {
+        for (size_t i = 0; i < threadCounts.size(); i++)
+        {
+            rt.numThreads = threadCounts[i];
+            auto start = std::chrono::high_resolution_clock::now();
+            rt.Raytrace();
+            auto stop = std::chrono::high_resolution_clock::now();
+            float time = std::chrono::duration<float>(stop - start).count();
+            if (time < best[i])
+            {
+                best[i] = time;
+                steals[i] = rt.tileSteals;
+            }
+        }
+    }
+    rt.Clear();
+    rt.numThreads = numThreads;
+
+    unsigned tilesX = (rt.width + Raytracer::TileSize - 1) / Raytracer::TileSize;
+    unsigned tilesY = (rt.height + Raytracer::TileSize - 1) / Raytracer::TileSize;
+    float numSamples = (float)rt.width * rt.height * rt.rpp;
+    printf("Scaling benchmark: %u x %u pixels in %u tiles of %u x %u, %u rays per pixel, %u cores, best frame of %d\n",
+        rt.width, rt.height, tilesX * tilesY, Raytracer::TileSize, Raytracer::TileSize, rt.rpp, NumParallelThreads(), numRounds);
+    printf("  %8s %10s %10s %8s %10s %8s\n", "threads", "ms/frame", "MSamples/s", "speedup", "efficiency", "steals");
+    for (size_t i = 0; i < threadCounts.size(); i++)
+    {
+        float speedup = best[0] / best[i];
+        printf("  %8u %10.2f %10.3f %8.2f %9.0f%% %8u\n", threadCounts[i], best[i] * 1e3f, numSamples / best[i] * 1e-6f,
+            speedup, speedup / threadCounts[i] * 100.0f, steals[i]);
+    }
+    // threads past the core count only take turns, their speedup says nothing about scaling
+    if (maxThreads > NumParallelThreads())
+        printf("  rows past %u threads share the cores and do not measure scaling\n", NumParallelThreads());
+}
+
+//------------------------------------------------------------------------------
+/**
+    The dispatched function does nothing, so the times are the cost of
+    handing out work and waiting for it, which every parallel stage of a
+    frame pays once
+*/
+void
+BenchmarkDispatch(Raytracer& rt)
+{
+    ThreadPool& pool = rt.GetThreadPool();
+    pool.Resize(rt.numThreads);
+    unsigned numThreads = pool.NumThreads();
+    std::atomic<unsigned> calls(0);
+    auto empty = [&calls](unsigned) { calls.fetch_add(1, std::memory_order_relaxed); };
+
+    // microseconds per call of dispatch, mean and best of count calls. gap runs before each call
+    auto measure = [](unsigned count, auto&& gap, auto&& dispatch, float& mean, float& best)
+    {
+        double total = 0.0;
+        best = FLT_MAX;
+        for (unsigned i = 0; i < count; i++)
+        {
+            gap();
+            auto start = std::chrono::high_resolution_clock::now();
+            dispatch();
+            auto stop = std::chrono::high_resolution_clock::now();
+            float time = std::chrono::duration<float, std::micro>(stop - start).count();
+            total += time;
+            best = std::min(best, time);
+        }
+        mean = (float)(total / count);
+    };
+    auto none = []() {};
+    // longer than ThreadPool::SpinMicroseconds, so the workers are asleep like between frames
+    auto idle = []() { std::this_thread::sleep_for(std::chrono::milliseconds(2)); };
+
+    struct Row
+    {
+        char const* name;
+        float mean;
+        float best;
+    };
+    Row rows[4] = {
+        { "pool, back to back" },
+        { "pool, after 2 ms idle" },
+        { "pool, tasks" },
+        { "threads started per call" },
+    };
+    pool.Run(empty);
+    measure(10000, none, [&]() { pool.Run(empty); }, rows[0].mean, rows[0].best);
+    measure(200, idle, [&]() { pool.Run(empty); }, rows[1].mean, rows[1].best);
+    unsigned numTiles = ((rt.width + Raytracer::TileSize - 1) / Raytracer::TileSize) * ((rt.height + Raytracer::TileSize - 1) / Raytracer::TileSize);
+    measure(10000, none, [&]() { pool.RunTasks(numTiles, [&calls](unsigned, unsigned) { calls.fetch_add(1, std::memory_order_relaxed); }); },
+        rows[2].mean, rows[2].best);
+    measure(200, none, [&]() { ParallelRange(numThreads, numThreads, [&calls](unsigned, unsigned, unsigned) { calls.fetch_add(1, std::memory_order_relaxed); }); },
+        rows[3].mean, rows[3].best);
+
+    printf("Dispatch benchmark: an empty function on %u threads, %u cores, %u tiles for the tasks\n", numThreads, NumParallelThreads(), numTiles);
+    printf("  %-26s %12s %12s\n", "dispatch", "mean us", "best us");
+    for (Row const& row : rows)
+        printf("  %-26s %12.2f %12.2f\n", row.name, row.mean, row.best);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Placement is not undone when the option is turned off again, pages stay
+    where they were moved, so the frames without it are rendered first
+*/
+void
+BenchmarkNuma(Raytracer& rt)
+{
+    NumaTopology const& topology = GetNumaTopology();
+    unsigned numNodes = topology.NumNodes();
+    bool numaPlacement = rt.numaPlacement;
+    constexpr int numRounds = 5;
+
+    struct Row
+    {
+        char const* name;
+        float best = FLT_MAX;
+        // frame buffer pages on each node, and on no known node last
+        std::vector<unsigned> pages;
+        size_t hugePageBytes = 0;
+    };
+    Row rows[2];
+    rows[0].name = "off";
+    rows[1].name = "on";
+    float placementTime = 0.0f;
+    for (int i = 0; i < 2; i++)
+    {
+        rt.numaPlacement = i == 1;
+        // the first frame builds the structure, starts the threads and places memory
+        auto start = std::chrono::high_resolution_clock::now();
+        rt.Raytrace();
+        auto stop = std::chrono::high_resolution_clock::now();
+        if (i == 1)
+            placementTime = std::chrono::duration<float, std::milli>(stop - start).count();
+        for (int round = 0; round < numRounds; round++)
+        {
+            start = std::chrono::high_resolution_clock::now();
+            rt.Raytrace();
+            stop = std::chrono::high_resolution_clock::now();
+            rows[i].best = std::min(rows[i].best, std::chrono::duration<float>(stop - start).count());
+        }
+
+        rows[i].pages.assign(numNodes + 1, 0);
+        char const* pixels = (char const*)rt.frameBuffer.data();
+        size_t bytes = rt.frameBuffer.size() * sizeof(Color);
+        for (size_t offset = 0; offset < bytes; offset += 4096)
+        {
+            int node = MemoryNode(pixels + offset);
+            rows[i].pages[node >= 0 ? node : numNodes]++;
+        }
+        rows[i].hugePageBytes = HugePageBytes();
+    }
+    rt.numaPlacement = numaPlacement;
+    rt.Clear();
+
+    std::string cpus;
+    for (std::vector<unsigned> const& node : topology.nodeCpus)
+        cpus += (cpus.empty() ? "" : ", ") + std::to_string(node.size());
+    float numSamples = (float)rt.width * rt.height * rt.rpp;
+    printf("NUMA benchmark: %u x %u pixels, %u rays per pixel, %u threads, %u nodes with %s cpus, best frame of %d\n",
+        rt.width, rt.height, rt.rpp, rt.GetThreadPool().NumThreads(), numNodes, cpus.c_str(), numRounds);
+    printf("  %-10s %10s %10s %14s  %s\n", "placement", "ms/frame", "MSamples/s", "huge pages MB", "frame buffer pages per node, unknown");
+    for (Row const& row : rows)
+    {
+        std::string pages;
+        for (unsigned count : row.pages)
+            pages += (pages.empty() ? "" : " ") + std::to_string(count);
+        printf("  %-10s %10.2f %10.3f %14.1f  %s\n", row.name, row.best * 1e3f, numSamples / row.best * 1e-6f,
+            row.hugePageBytes / (1024.0f * 1024.0f), pages.c_str());
+    }
+    printf("  first frame with placement, placing included: %.2f ms\n", placementTime);
+}
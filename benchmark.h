@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include "raytracer.h"
+
+//------------------------------------------------------------------------------
+/**
+    Benchmarks, run from the no_gl build of main.cc.
+    They take the scene main.cc has set up, and print their results.
+*/
+
+// trace one and two bounce rays of the scene through the binary and 8 wide bvh,
+// laid out depth first and in treelets, in the vectors Raycast traverses. Prints traversal throughput, and
+// L1 and L2 misses of node and index fetches in a simulated cache.
+void BenchmarkBVHLayout(Raytracer& rt);
+
+// render a few frames with the wavefront integrator, with and without sorting
+// scattered rays. Prints the throughput of the extend stage per bounce.
+void BenchmarkRaySorting(Raytracer& rt);
+
+// trace ambient occlusion rays from the first hits of the camera rays, and rays towards
+// a directional light, once with Raycast and once with Occluded. Prints both throughputs.
+void BenchmarkOcclusion(Raytracer& rt);
+
+// bytes per sphere and plane, per material and per entry of an ObjectMetadata table,
+// as allocated on the heap. Prints them, and what the objects of the scene take.
+void BenchmarkObjectMemory(Raytracer& rt);
+
+// render frames with each integrator, the recursive one with and without packets, with the
+// kernels of every instruction set the cpu supports. Prints the best frame time and samples
+// per second of each.
+void BenchmarkRaytrace(Raytracer& rt);
+
+// write the spheres of the scene as tessellated spheres to an OBJ file, load it back as one
+// triangle mesh and trace the same camera and shadow rays through both scenes. Prints the
+// load and build times, and the throughput of spheres against triangles.
+void BenchmarkMesh(Raytracer& rt);
+
+// render frames with the integrator of rt on 1, 2, 4 and so on up to numThreads threads,
+// or one per core. Prints the best frame time of each, speedup and parallel efficiency
+// against one thread, and how many tiles were stolen.
+void BenchmarkScaling(Raytracer& rt);
+
+// dispatch a function that does nothing to the threads of the thread pool of rt, back to back
+// and after the workers have gone to sleep, and to threads started for each call. Prints the
+// mean and best round trip of each, in microseconds.
+void BenchmarkDispatch(Raytracer& rt);
+
+// render frames with Raytracer::numaPlacement off and then on. Prints the best frame time and
+// samples per second of each, how the pages of the frame buffer are spread over the memory
+// nodes, and how much memory is on transparent huge pages.
+void BenchmarkNuma(Raytracer& rt);
@@ -0,0 +1,638 @@
+#include "bvh.h"
+#include "parallel.h"
+#include "radixsort.h"
+#include <algorithm>
+#include <chrono>
+#include <assert.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static constexpr unsigned NumBins = 16;
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::Build(std::vector<BBox> const& primBounds, BVHBuilder builder)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    unsigned count = (unsigned)primBounds.size();
+    this->builder = builder;
+    this->attachedNodes = nullptr;
+    this->attachedPrims = nullptr;
+    this->nodes.clear();
+    this->primIndices.resize(count);
+    if (count > 0)
+    {
+        this->PrepareBounds(primBounds);
+        for (unsigned i = 0; i < count; i++)
+            this->primIndices[i] = i;
+
+        if (builder == BVHBuilder::LBVH)
+            this->BuildLBVH();
+        else
+            this->BuildSAH();
+
+        this->bounds.clear();
+        this->bounds.shrink_to_fit();
+        this->centroids.clear();
+        this->centroids.shrink_to_fit();
+    }
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    this->buildTime = std::chrono::duration<float, std::milli>(stop - start).count();
+    this->buildCost = this->SAHCost();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::Refit(std::vector<BBox> const& primBounds)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    if (this->IsAttached())
+    {
+        this->nodes.assign(this->attachedNodes, this->attachedNodes + this->attachedNodeCount);
+        this->primIndices.assign(this->attachedPrims, this->attachedPrims + this->attachedPrimCount);
+        this->attachedNodes = nullptr;
+        this->attachedPrims = nullptr;
+    }
+    assert(primBounds.size() == this->primIndices.size());
+
+    if (!this->nodes.empty())
+    {
+        this->PrepareBounds(primBounds);
+        this->RefitNodes(this->nodes.data(), 0, (unsigned)this->nodes.size());
+        this->bounds.clear();
+        this->centroids.clear();
+    }
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    this->refitTime = std::chrono::duration<float, std::milli>(stop - start).count();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+BBox
+BVH::PaddedBounds(BBox const& primBounds)
+{
+    BBox box = primBounds;
+    for (int a = 0; a < 3; a++)
+    {
+        float pad = 1e-4f * (1.0f + fmaxf(fabsf(box.min[a]), fabsf(box.max[a])));
+        box.min[a] -= pad;
+        box.max[a] += pad;
+    }
+    return box;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::PrepareBounds(std::vector<BBox> const& primBounds)
+{
+    unsigned count = (unsigned)primBounds.size();
+    this->bounds.resize(count);
+    this->centroids.resize(count * 3);
+    unsigned numChunks = count < 65536 ? 1 : NumParallelThreads();
+    ParallelRange(count, numChunks, [&](unsigned begin, unsigned end, unsigned)
+    {
+        for (unsigned i = begin; i < end; i++)
+        {
+            BBox box = PaddedBounds(primBounds[i]);
+            for (int a = 0; a < 3; a++)
+                this->centroids[i * 3 + a] = box.Center(a);
+            this->bounds[i] = box;
+        }
+    });
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::BuildSAH()
+{
+    unsigned count = (unsigned)this->primIndices.size();
+    this->nodes.resize(count * 2);
+    BVHNode& root = this->nodes[0];
+    root.leftFirst = 0;
+    root.count = count;
+    this->UpdateBounds(0);
+    // skip node 1, so that sibling pairs are cache line aligned
+    this->nodesUsed = 2;
+    this->Subdivide(0, 1);
+    this->nodes.resize(this->nodesUsed);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::UpdateBounds(unsigned nodeIndex)
+{
+    BVHNode& node = this->nodes[nodeIndex];
+    node.bounds = BBox();
+    for (unsigned i = 0; i < node.count; i++)
+        node.bounds.Grow(this->bounds[this->primIndices[node.leftFirst + i]]);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::Subdivide(unsigned nodeIndex, unsigned depth)
+{
+    BVHNode& node = this->nodes[nodeIndex];
+    if (node.count <= 1)
+        return;
+
+    BBox centroidBounds;
+    for (unsigned i = 0; i < node.count; i++)
+        centroidBounds.Grow(&this->centroids[this->primIndices[node.leftFirst + i] * 3]);
+
+    // deep down only balanced splits are made, so the tree never gets deeper than MaxDepth
+    // and leaves never hold more than MaxLeafSize primitives
+    if (depth >= MaxDepth - 32)
+    {
+        if (node.count > MaxLeafSize)
+            this->SplitMedian(nodeIndex, centroidBounds.LongestAxis(), depth);
+        return;
+    }
+
+    // bin primitives by centroid
+
+    struct Bin
+    {
+        BBox bounds;
+        unsigned count = 0;
+    };
+
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    unsigned bestSplit = 0;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float lo = centroidBounds.min[axis];
+        float extent = centroidBounds.Extent(axis);
+        if (extent <= 0.0f)
+            continue;
+
+        Bin bins[NumBins];
+        float scale = NumBins / extent;
+        for (unsigned i = 0; i < node.count; i++)
+        {
+            unsigned prim = this->primIndices[node.leftFirst + i];
+            unsigned b = std::min(NumBins - 1, (unsigned)((this->centroids[prim * 3 + axis] - lo) * scale));
+            bins[b].count++;
+            bins[b].bounds.Grow(this->bounds[prim]);
+        }
+
+        // sweep from both sides to get the cost of every split plane
+        float leftArea[NumBins - 1];
+        unsigned leftCount[NumBins - 1];
+        BBox leftBox;
+        unsigned leftSum = 0;
+        for (unsigned i = 0; i < NumBins - 1; i++)
+        {
+            leftSum += bins[i].count;
+            leftBox.Grow(bins[i].bounds);
+            leftCount[i] = leftSum;
+            leftArea[i] = leftBox.HalfArea();
+        }
+
+        BBox rightBox;
+        unsigned rightSum = 0;
+        for (unsigned i = NumBins - 1; i > 0; i--)
+        {
+            rightSum += bins[i].count;
+            rightBox.Grow(bins[i].bounds);
+            if (leftCount[i - 1] == 0 || rightSum == 0)
+                continue;
+            float cost = leftCount[i - 1] * leftArea[i - 1] + rightSum * rightBox.HalfArea();
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    // all centroids coincide, only a median split can make the leaf smaller
+    if (bestAxis < 0)
+    {
+        if (node.count > MaxLeafSize)
+            this->SplitMedian(nodeIndex, 0, depth);
+        return;
+    }
+
+    float area = node.bounds.HalfArea();
+    float splitCost = TraversalCost + IntersectionCost * bestCost / area;
+    float leafCost = IntersectionCost * node.count;
+    if (splitCost >= leafCost && node.count <= MaxLeafSize)
+        return;
+
+    // partition primitive indices around the chosen plane
+    float lo = centroidBounds.min[bestAxis];
+    float scale = NumBins / centroidBounds.Extent(bestAxis);
+    unsigned i = node.leftFirst;
+    unsigned j = node.leftFirst + node.count;
+    while (i < j)
+    {
+        unsigned prim = this->primIndices[i];
+        unsigned b = std::min(NumBins - 1, (unsigned)((this->centroids[prim * 3 + bestAxis] - lo) * scale));
+        if (b < bestSplit)
+            i++;
+        else
+            std::swap(this->primIndices[i], this->primIndices[--j]);
+    }
+
+    unsigned leftCount = i - node.leftFirst;
+    if (leftCount == 0 || leftCount == node.count)
+        return;
+
+    this->SplitAt(nodeIndex, leftCount, depth);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Split at the centroid median along axis
+*/
+void
+BVH::SplitMedian(unsigned nodeIndex, int axis, unsigned depth)
+{
+    BVHNode& node = this->nodes[nodeIndex];
+    unsigned* first = &this->primIndices[node.leftFirst];
+    unsigned half = node.count / 2;
+    std::nth_element(first, first + half, first + node.count, [this, axis](unsigned a, unsigned b)
+    {
+        return this->centroids[a * 3 + axis] < this->centroids[b * 3 + axis];
+    });
+    this->SplitAt(nodeIndex, half, depth);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Turn a leaf into an interior node, with the first leftCount primitives going left
+*/
+void
+BVH::SplitAt(unsigned nodeIndex, unsigned leftCount, unsigned depth)
+{
+    BVHNode& node = this->nodes[nodeIndex];
+    unsigned i = node.leftFirst + leftCount;
+    unsigned leftIndex = this->nodesUsed;
+    this->nodesUsed += 2;
+    BVHNode& left = this->nodes[leftIndex];
+    BVHNode& right = this->nodes[leftIndex + 1];
+    left.leftFirst = node.leftFirst;
+    left.count = leftCount;
+    right.leftFirst = i;
+    right.count = node.count - leftCount;
+    node.leftFirst = leftIndex;
+    node.count = 0;
+
+    this->UpdateBounds(leftIndex);
+    this->UpdateBounds(leftIndex + 1);
+    this->Subdivide(leftIndex, depth + 1);
+    this->Subdivide(leftIndex + 1, depth + 1);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Sibling pairs fill a cache line and are always fetched together, so they
+    are the unit that is moved. Unit 0 is the root and the padding node.
+*/
+void
+BVH::Reorder(BVHLayout layout)
+{
+    if (layout == BVHLayout::DepthFirst || this->nodes.size() <= 2)
+        return;
+    assert(!this->IsAttached());
+    assert(this->nodes.size() % 2 == 0);
+
+    unsigned numUnits = (unsigned)this->nodes.size() / 2;
+    auto children = [this](unsigned unit, unsigned* out)
+    {
+        unsigned count = 0;
+        unsigned last = unit == 0 ? 0 : unit * 2 + 1;
+        for (unsigned i = unit * 2; i <= last; i++)
+        {
+            if (!this->nodes[i].IsLeaf())
+                out[count++] = this->nodes[i].leftFirst / 2;
+        }
+        return count;
+    };
+    auto area = [this](unsigned unit)
+    {
+        if (unit == 0)
+            return this->nodes[0].bounds.HalfArea();
+        return this->nodes[unit * 2].bounds.HalfArea() + this->nodes[unit * 2 + 1].bounds.HalfArea();
+    };
+    std::vector<unsigned> order = TreeletOrder(numUnits, 2 * sizeof(BVHNode), children, area);
+    assert(order.size() == numUnits && order[0] == 0);
+
+    std::vector<unsigned> newUnit(numUnits);
+    for (unsigned i = 0; i < numUnits; i++)
+        newUnit[order[i]] = i;
+
+    BVHNodeArray reordered(this->nodes.size());
+    for (unsigned i = 0; i < numUnits; i++)
+    {
+        reordered[i * 2] = this->nodes[order[i] * 2];
+        reordered[i * 2 + 1] = this->nodes[order[i] * 2 + 1];
+    }
+    for (unsigned i = 0; i < (unsigned)reordered.size(); i++)
+    {
+        if (i != 1 && !reordered[i].IsLeaf())
+            reordered[i].leftFirst = newUnit[reordered[i].leftFirst / 2] * 2;
+    }
+    this->nodes.swap(reordered);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::Attach(BVHNode const* nodes, unsigned nodeCount, unsigned const* primIndices, unsigned primCount)
+{
+    this->nodes.clear();
+    this->nodes.shrink_to_fit();
+    this->primIndices.clear();
+    this->primIndices.shrink_to_fit();
+    this->attachedNodes = nodes;
+    this->attachedNodeCount = nodeCount;
+    this->attachedPrims = primIndices;
+    this->attachedPrimCount = primCount;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Node 1 is padding and never visited
+*/
+bool
+BVH::Validate(unsigned numObjects) const
+{
+    BVHNode const* nodes = this->NodeData();
+    unsigned const* prims = this->PrimData();
+    unsigned nodeCount = this->NodeCount();
+    unsigned primCount = this->PrimCount();
+    for (unsigned i = 0; i < primCount; i++)
+    {
+        if (prims[i] >= numObjects)
+            return false;
+    }
+    if (nodeCount == 0)
+        return primCount == 0;
+
+    std::vector<unsigned char> depth(nodeCount, 0);
+    for (unsigned i = 0; i < nodeCount; i++)
+    {
+        if (i == 1)
+            continue;
+        BVHNode const& node = nodes[i];
+        if (node.IsLeaf())
+        {
+            if ((unsigned long long)node.leftFirst + node.count > primCount)
+                return false;
+            continue;
+        }
+        unsigned left = node.leftFirst;
+        if (left <= i || left % 2 != 0 || left + 1 >= nodeCount || depth[i] >= MaxDepth)
+            return false;
+        depth[left] = depth[left + 1] = depth[i] + 1;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+float
+BVH::SAHCost() const
+{
+    unsigned nodeCount = this->NodeCount();
+    if (nodeCount == 0)
+        return 0.0f;
+
+    BVHNode const* nodes = this->NodeData();
+    float rootArea = nodes[0].bounds.HalfArea();
+    if (rootArea <= 0.0f)
+        return IntersectionCost * nodes[0].count;
+
+    float cost = 0.0f;
+    for (unsigned i = 0; i < nodeCount; i++)
+    {
+        // node 1 is padding
+        if (i == 1)
+            continue;
+        BVHNode const& node = nodes[i];
+        float area = node.bounds.HalfArea() / rootArea;
+        if (node.IsLeaf())
+            cost += IntersectionCost * node.count * area;
+        else
+            cost += TraversalCost * area;
+    }
+    return cost;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+static inline int
+CountLeadingZeros(unsigned v)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    return _BitScanReverse(&index, v) ? 31 - (int)index : 32;
+#else
+    return v == 0 ? 32 : __builtin_clz(v);
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+    Find the last index of the left half of [first, last], which is where
+    the highest differing bit of the sorted morton codes flips
+*/
+static unsigned
+FindSplit(std::vector<unsigned> const& codes, unsigned first, unsigned last)
+{
+    unsigned firstCode = codes[first];
+    unsigned lastCode = codes[last];
+    if (firstCode == lastCode)
+        return (first + last) >> 1;
+
+    int commonPrefix = CountLeadingZeros(firstCode ^ lastCode);
+    unsigned split = first;
+    unsigned step = last - first;
+    do
+    {
+        step = (step + 1) >> 1;
+        unsigned newSplit = split + step;
+        if (newSplit < last && CountLeadingZeros(firstCode ^ codes[newSplit]) > commonPrefix)
+            split = newSplit;
+    } while (step > 1);
+
+    return split;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::BuildLBVH()
+{
+    unsigned count = (unsigned)this->primIndices.size();
+    unsigned numChunks = count < 65536 ? 1 : NumParallelThreads();
+
+    // quantize centroids to 10 bits per axis and interleave them
+    std::vector<BBox> chunkBounds(numChunks);
+    ParallelRange(count, numChunks, [&](unsigned begin, unsigned end, unsigned chunk)
+    {
+        for (unsigned i = begin; i < end; i++)
+            chunkBounds[chunk].Grow(&this->centroids[i * 3]);
+    });
+    BBox centroidBounds;
+    for (BBox const& box : chunkBounds)
+        centroidBounds.Grow(box);
+
+    float scale[3];
+    for (int a = 0; a < 3; a++)
+    {
+        float extent = centroidBounds.Extent(a);
+        scale[a] = extent > 0.0f ? 1023.0f / extent : 0.0f;
+    }
+
+    std::vector<unsigned> codes(count);
+    ParallelRange(count, numChunks, [&](unsigned begin, unsigned end, unsigned)
+    {
+        for (unsigned i = begin; i < end; i++)
+        {
+            unsigned code = 0;
+            for (int a = 0; a < 3; a++)
+            {
+                unsigned q = (unsigned)((this->centroids[i * 3 + a] - centroidBounds.min[a]) * scale[a]);
+                code |= ExpandBits(std::min(q, 1023u)) << (2 - a);
+            }
+            codes[i] = code;
+        }
+    });
+    RadixSort(codes, this->primIndices, 30);
+
+    // emit the top of the tree here, and hand subtrees below taskSize primitives to other threads
+    this->nodes.reserve(count * 2);
+    this->nodes.resize(2);
+    std::vector<LBVHTask> tasks;
+    unsigned taskSize = std::max(count / (numChunks * 16), 1024u);
+    this->EmitLBVH(this->nodes, 0, 0, count, 1, codes, numChunks > 1 ? &tasks : nullptr, taskSize);
+    unsigned topCount = (unsigned)this->nodes.size();
+
+    if (!tasks.empty())
+    {
+        std::vector<BVHNodeArray> subtrees(tasks.size());
+        ParallelTasks((unsigned)tasks.size(), [&](unsigned t)
+        {
+            LBVHTask const& task = tasks[t];
+            BVHNodeArray& local = subtrees[t];
+            local.reserve(task.count * 2);
+            local.resize(2);
+            this->EmitLBVH(local, 0, task.first, task.count, task.depth, codes, nullptr, 0);
+            this->RefitNodes(local.data(), 0, (unsigned)local.size());
+        });
+
+        // splice subtrees in after the top nodes, local node 1 is padding like in the main tree
+        std::vector<unsigned> bases(tasks.size());
+        unsigned total = topCount;
+        for (unsigned t = 0; t < tasks.size(); t++)
+        {
+            bases[t] = total - 2;
+            total += (unsigned)subtrees[t].size() - 2;
+        }
+        this->nodes.resize(total);
+
+        ParallelTasks((unsigned)tasks.size(), [&](unsigned t)
+        {
+            BVHNodeArray const& local = subtrees[t];
+            unsigned base = bases[t];
+            BVHNode root = local[0];
+            if (!root.IsLeaf())
+                root.leftFirst += base;
+            this->nodes[tasks[t].node] = root;
+            for (unsigned i = 2; i < local.size(); i++)
+            {
+                BVHNode node = local[i];
+                if (!node.IsLeaf())
+                    node.leftFirst += base;
+                this->nodes[base + i] = node;
+            }
+        });
+    }
+
+    this->RefitNodes(this->nodes.data(), 0, topCount);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Recursively split [first, first + count) of the sorted primitives below nodeIndex
+*/
+void
+BVH::EmitLBVH(BVHNodeArray& out, unsigned nodeIndex, unsigned first, unsigned count, unsigned depth,
+              std::vector<unsigned> const& codes, std::vector<LBVHTask>* tasks, unsigned taskSize)
+{
+    if (tasks != nullptr && count <= taskSize)
+    {
+        tasks->push_back({ nodeIndex, first, count, depth });
+        return;
+    }
+
+    if (count <= LBVHLeafSize || depth >= MaxDepth)
+    {
+        out[nodeIndex].leftFirst = first;
+        out[nodeIndex].count = count;
+        return;
+    }
+
+    unsigned split = FindSplit(codes, first, first + count - 1);
+    unsigned leftCount = split - first + 1;
+    unsigned leftIndex = (unsigned)out.size();
+    out.resize(leftIndex + 2);
+    out[nodeIndex].leftFirst = leftIndex;
+    out[nodeIndex].count = 0;
+
+    this->EmitLBVH(out, leftIndex, first, leftCount, depth + 1, codes, tasks, taskSize);
+    this->EmitLBVH(out, leftIndex + 1, split + 1, count - leftCount, depth + 1, codes, tasks, taskSize);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+BVH::RefitNodes(BVHNode* nodes, unsigned begin, unsigned end) const
+{
+    for (unsigned i = end; i-- > begin;)
+    {
+        // node 1 is padding
+        if (i == 1)
+            continue;
+
+        BVHNode& node = nodes[i];
+        node.bounds = BBox();
+        if (node.IsLeaf())
+        {
+            for (unsigned p = 0; p < node.count; p++)
+                node.bounds.Grow(this->bounds[this->primIndices[node.leftFirst + p]]);
+        }
+        else
+        {
+            node.bounds.Grow(nodes[node.leftFirst].bounds);
+            node.bounds.Grow(nodes[node.leftFirst + 1].bounds);
+        }
+    }
+}
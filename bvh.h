@@ -0,0 +1,510 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <new>
+#include <float.h>
+#include "bbox.h"
+#include "ray.h"
+#include "simd.h"
+#include "treeletlayout.h"
+
+//------------------------------------------------------------------------------
+/**
+    Node of a binary BVH, 32 bytes so that two siblings share a cache line
+*/
+struct BVHNode
+{
+    BBox bounds;
+    // interior nodes: index of left child, the right child is leftFirst + 1
+    // leaves: index of the first primitive in BVH::primIndices
+    unsigned leftFirst = 0;
+    // number of primitives in a leaf, 0 for interior nodes
+    unsigned count = 0;
+
+    SIMD_INLINE bool IsLeaf() const { return this->count > 0; }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Allocator for vectors whose storage starts on a cache line. The nodes
+    themselves only need 4 byte alignment, which is all the default
+    allocator gives them, and sibling pairs then straddle two lines.
+*/
+template<class TYPE>
+struct CacheLineAllocator
+{
+    typedef TYPE value_type;
+
+    CacheLineAllocator() = default;
+    template<class OTHER> CacheLineAllocator(CacheLineAllocator<OTHER> const&) {}
+
+    TYPE* allocate(size_t count) { return (TYPE*)::operator new(count * sizeof(TYPE), std::align_val_t(64)); }
+    void deallocate(TYPE* p, size_t) { ::operator delete(p, std::align_val_t(64)); }
+
+    template<class OTHER> bool operator==(CacheLineAllocator<OTHER> const&) const { return true; }
+    template<class OTHER> bool operator!=(CacheLineAllocator<OTHER> const&) const { return false; }
+};
+
+// node storage of the binary trees, node 0 and the sibling pairs from node 2 on
+// each fill one cache line
+typedef std::vector<BVHNode, CacheLineAllocator<BVHNode>> BVHNodeArray;
+
+// the prepared rays are compiled per instruction set, see simd.h. Trees are
+// shared, their traversal is instantiated for every instruction set through
+// the prepared rays and the leaf functions of the callers
+namespace TRAYRACER_ISA
+{
+
+//------------------------------------------------------------------------------
+/**
+    Ray prepared for slab tests against single precision boxes
+*/
+struct BVHRay
+{
+    float origin[3];
+    float invDir[3];
+
+    BVHRay() {}
+    BVHRay(Ray const& ray)
+    {
+        float const* o = &ray.b.x;
+        float const* d = &ray.m.x;
+        for (int i = 0; i < 3; i++)
+        {
+            this->origin[i] = o[i];
+            // clamp so that a zero distance to a slab can never produce 0 * inf
+            float inv = 1.0f / d[i];
+            this->invDir[i] = fabsf(inv) == INFINITY ? copysignf(FLT_MAX, inv) : inv;
+        }
+    }
+
+    // returns entry distance, or FLT_MAX if the box is missed or further away than tMax
+    float IntersectBox(BBox const& box, float tMax) const
+    {
+        // plain compares instead of fminf/fmaxf, they compile to single min/max instructions
+        auto mn = [](float a, float b) { return a < b ? a : b; };
+        auto mx = [](float a, float b) { return a > b ? a : b; };
+        float tx1 = (box.min[0] - this->origin[0]) * this->invDir[0];
+        float tx2 = (box.max[0] - this->origin[0]) * this->invDir[0];
+        float tNear = mn(tx1, tx2);
+        float tFar = mx(tx1, tx2);
+        float ty1 = (box.min[1] - this->origin[1]) * this->invDir[1];
+        float ty2 = (box.max[1] - this->origin[1]) * this->invDir[1];
+        tNear = mx(tNear, mn(ty1, ty2));
+        tFar = mn(tFar, mx(ty1, ty2));
+        float tz1 = (box.min[2] - this->origin[2]) * this->invDir[2];
+        float tz2 = (box.max[2] - this->origin[2]) * this->invDir[2];
+        tNear = mx(tNear, mn(tz1, tz2));
+        tFar = mn(tFar, mx(tz1, tz2));
+        // widen the far distance by a few ulps so rounding never culls a grazing hit
+        tFar *= 1.0000004f;
+        if (tFar >= tNear && tNear < tMax && tFar > 0.0f)
+            return tNear;
+        return FLT_MAX;
+    }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Up to N rays traced through a tree together, each lane of the arrays is a ray
+*/
+template<unsigned N>
+struct BVHPacket
+{
+    BVHRay rays[N];
+    alignas(64) float origin[3][N];
+    alignas(64) float invDir[3][N];
+
+    // lanes past count repeat the first ray, callers leave them out of the lane mask
+    BVHPacket(Ray const* rays, unsigned count)
+    {
+        for (unsigned i = 0; i < N; i++)
+        {
+            this->rays[i] = BVHRay(rays[i < count ? i : 0]);
+            for (int axis = 0; axis < 3; axis++)
+            {
+                this->origin[axis][i] = this->rays[i].origin[axis];
+                this->invDir[axis][i] = this->rays[i].invDir[axis];
+            }
+        }
+    }
+
+    // lanes of mask that hit the box before their tMax, with their entry distances in dist
+    SIMD_INLINE unsigned IntersectBox(BBox const& box, unsigned mask, float const* tMax, float* dist) const
+    {
+        using vf = vfloat<N>;
+        vf tx1 = (vf::Broadcast(box.min[0]) - vf::Load(this->origin[0])) * vf::Load(this->invDir[0]);
+        vf tx2 = (vf::Broadcast(box.max[0]) - vf::Load(this->origin[0])) * vf::Load(this->invDir[0]);
+        vf ty1 = (vf::Broadcast(box.min[1]) - vf::Load(this->origin[1])) * vf::Load(this->invDir[1]);
+        vf ty2 = (vf::Broadcast(box.max[1]) - vf::Load(this->origin[1])) * vf::Load(this->invDir[1]);
+        vf tz1 = (vf::Broadcast(box.min[2]) - vf::Load(this->origin[2])) * vf::Load(this->invDir[2]);
+        vf tz2 = (vf::Broadcast(box.max[2]) - vf::Load(this->origin[2])) * vf::Load(this->invDir[2]);
+        vf tNear = Max(Max(Min(tx1, tx2), Min(ty1, ty2)), Min(tz1, tz2));
+        // same widening as BVHRay::IntersectBox
+        vf tFar = Min(Min(Max(tx1, tx2), Max(ty1, ty2)), Max(tz1, tz2)) * vf::Broadcast(1.0000004f);
+        tNear.Store(dist);
+        return mask & Mask((tFar >= tNear) & (tNear < vf::Load(tMax)) & (tFar > vf::Broadcast(0.0f)));
+    }
+};
+
+} // namespace TRAYRACER_ISA
+using namespace TRAYRACER_ISA;
+
+//------------------------------------------------------------------------------
+/**
+    Default for the visit argument of the Intersect functions, does nothing
+*/
+struct NoVisit
+{
+    SIMD_INLINE void operator()(void const* address, size_t bytes) const {}
+};
+
+//------------------------------------------------------------------------------
+/**
+    BVH construction algorithms
+*/
+enum class BVHBuilder
+{
+    // top down binned surface area heuristic. Best trees, single threaded
+    SAH,
+    // linear BVH from radix sorted morton codes, built on all threads.
+    // Much faster to build, but traces slower
+    LBVH,
+};
+
+//------------------------------------------------------------------------------
+/**
+    Bounding volume hierarchy over a set of primitive bounds.
+    Node 1 is left unused so that sibling pairs start on even indices.
+*/
+class BVH
+{
+public:
+    // build the tree over the given primitive bounds
+    void Build(std::vector<BBox> const& primBounds, BVHBuilder builder = BVHBuilder::SAH);
+
+    // update node bounds bottom up after primitives have moved.
+    // primBounds must hold the same primitives, in the same order, as when the tree was built
+    void Refit(std::vector<BBox> const& primBounds);
+
+    // move nodes into the given layout, sibling pairs stay together
+    void Reorder(BVHLayout layout);
+
+    // primitive bounds grown slightly, which leaves are built from. The single
+    // precision slab test must never reject a ray the primitive test would accept
+    static BBox PaddedBounds(BBox const& primBounds);
+
+    // expected cost of a ray query, according to the surface area heuristic
+    float SAHCost() const;
+
+    // walk the tree front to back and call intersect(primIndex) for every
+    // primitive in a leaf that the ray reaches before tMax.
+    // intersect is expected to shrink tMax when it finds a closer hit.
+    // Setting it to -FLT_MAX ends the walk after the current leaf, for any hit queries.
+    // visit(address, bytes) is called for all node and index memory read, for instrumentation
+    template<class INTERSECT, class VISIT = NoVisit>
+    void Intersect(Ray const& ray, float& tMax, INTERSECT&& intersect, VISIT&& visit = VISIT()) const;
+
+    // same walk, but calls leaf(first, count) once per leaf with the range of
+    // its primitives in PrimData(), for primitives stored in tree order
+    template<class LEAF, class VISIT = NoVisit>
+    void IntersectLeaves(Ray const& ray, float& tMax, LEAF&& leaf, VISIT&& visit = VISIT()) const;
+
+    // walk the tree with the lanes of mask in a packet together, for coherent rays such as
+    // primary rays. tMax holds one distance per lane. Calls leaf(first, count, lanes) with the
+    // range of a leaf in PrimData() and the lanes that reach it. Once fewer than
+    // PacketMinActive(N) lanes enter a subtree, the packet has diverged, and they walk
+    // the subtree one at a time, each calling leaf with its own lane
+    template<unsigned N, class LEAF>
+    void IntersectPacket(BVHPacket<N> const& packet, unsigned mask, float* tMax, LEAF&& leaf) const;
+    static constexpr unsigned PacketMinActive(unsigned n) { return n / 4 > 2 ? n / 4 : 2; }
+
+    // traverse nodes and primitive indices stored elsewhere, such as in a mapped cache file,
+    // instead of the vectors. The memory must stay valid until the next Build or Refit,
+    // Refit copies it into the vectors first
+    void Attach(BVHNode const* nodes, unsigned nodeCount, unsigned const* primIndices, unsigned primCount);
+    // true while traversing attached memory
+    SIMD_INLINE bool IsAttached() const { return this->attachedNodes != nullptr; }
+    // nodes in the tree, built or attached
+    SIMD_INLINE unsigned NodeCount() const { return this->IsAttached() ? this->attachedNodeCount : (unsigned)this->nodes.size(); }
+    SIMD_INLINE BVHNode const* NodeData() const { return this->IsAttached() ? this->attachedNodes : this->nodes.data(); }
+    SIMD_INLINE unsigned const* PrimData() const { return this->IsAttached() ? this->attachedPrims : this->primIndices.data(); }
+    SIMD_INLINE unsigned PrimCount() const { return this->IsAttached() ? this->attachedPrimCount : (unsigned)this->primIndices.size(); }
+    // true if every index in the tree stays inside it: children come after their parents and
+    // no deeper than MaxDepth, leaves inside the primitive indices, which are below numObjects.
+    // Linear in the tree, for attached memory that came from elsewhere
+    bool Validate(unsigned numObjects) const;
+
+    BVHNodeArray nodes;
+    std::vector<unsigned> primIndices;
+
+    // builder used for the current tree
+    BVHBuilder builder = BVHBuilder::SAH;
+    // duration of the last build, in milliseconds
+    float buildTime = 0.0f;
+    // SAH cost right after the last build, refitting makes the cost drift away from this
+    float buildCost = 0.0f;
+    // duration of the last refit, in milliseconds
+    float refitTime = 0.0f;
+
+    // traversal stack size, the builder never goes deeper than this
+    static constexpr unsigned MaxDepth = 64;
+    // largest leaf the builders create
+    static constexpr unsigned MaxLeafSize = 16;
+    // relative cost of a traversal step versus a primitive test
+    static constexpr float TraversalCost = 1.0f;
+    static constexpr float IntersectionCost = 1.0f;
+
+    // leaf size of the LBVH builder
+    static constexpr unsigned LBVHLeafSize = 4;
+
+private:
+    // single ray walk below root, whose bounds the ray is known to hit
+    template<class LEAF, class VISIT>
+    void IntersectSubtree(BVHRay const& r, unsigned root, float& tMax, LEAF&& leaf, VISIT&& visit) const;
+
+    // pad primitive bounds and compute centroids into the scratch arrays
+    void PrepareBounds(std::vector<BBox> const& primBounds);
+
+    struct LBVHTask
+    {
+        unsigned node;
+        unsigned first;
+        unsigned count;
+        unsigned depth;
+    };
+
+    void BuildSAH();
+    void Subdivide(unsigned nodeIndex, unsigned depth);
+    void SplitMedian(unsigned nodeIndex, int axis, unsigned depth);
+    void SplitAt(unsigned nodeIndex, unsigned leftCount, unsigned depth);
+    void UpdateBounds(unsigned nodeIndex);
+
+    void BuildLBVH();
+    void EmitLBVH(BVHNodeArray& out, unsigned nodeIndex, unsigned first, unsigned count, unsigned depth,
+                  std::vector<unsigned> const& codes, std::vector<LBVHTask>* tasks, unsigned taskSize);
+
+    // recompute bounds of nodes [begin, end) bottom up, children must come after their parents
+    void RefitNodes(BVHNode* nodes, unsigned begin, unsigned end) const;
+
+    unsigned nodesUsed = 0;
+    BVHNode const* attachedNodes = nullptr;
+    unsigned const* attachedPrims = nullptr;
+    unsigned attachedNodeCount = 0;
+    unsigned attachedPrimCount = 0;
+    // scratch data, only valid during Build
+    std::vector<BBox> bounds;
+    std::vector<float> centroids;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<class INTERSECT, class VISIT>
+inline void
+BVH::Intersect(Ray const& ray, float& tMax, INTERSECT&& intersect, VISIT&& visit) const
+{
+    unsigned const* primIndices = this->PrimData();
+    this->IntersectLeaves(ray, tMax, [&](unsigned first, unsigned count)
+    {
+        visit(&primIndices[first], count * sizeof(unsigned));
+        for (unsigned i = 0; i < count; i++)
+            intersect(primIndices[first + i]);
+    }, visit);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<class LEAF, class VISIT>
+inline void
+BVH::IntersectLeaves(Ray const& ray, float& tMax, LEAF&& leaf, VISIT&& visit) const
+{
+    if (this->NodeCount() == 0)
+        return;
+
+    BVHRay r(ray);
+    if (r.IntersectBox(this->NodeData()[0].bounds, tMax) == FLT_MAX)
+        return;
+    this->IntersectSubtree(r, 0, tMax, leaf, visit);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<class LEAF, class VISIT>
+inline void
+BVH::IntersectSubtree(BVHRay const& r, unsigned root, float& tMax, LEAF&& leaf, VISIT&& visit) const
+{
+    BVHNode const* nodes = this->NodeData();
+    struct Entry
+    {
+        unsigned node;
+        float dist;
+    };
+    Entry stack[MaxDepth];
+    unsigned stackPtr = 0;
+    unsigned nodeIndex = root;
+
+    while (true)
+    {
+        BVHNode const& node = nodes[nodeIndex];
+        visit(&node, sizeof(BVHNode));
+        if (node.IsLeaf())
+        {
+            leaf(node.leftFirst, node.count);
+        }
+        else
+        {
+            unsigned nearChild = node.leftFirst;
+            unsigned farChild = node.leftFirst + 1;
+            visit(&nodes[nearChild], 2 * sizeof(BVHNode));
+            float distNear = r.IntersectBox(nodes[nearChild].bounds, tMax);
+            float distFar = r.IntersectBox(nodes[farChild].bounds, tMax);
+            if (distFar < distNear)
+            {
+                unsigned child = nearChild;
+                nearChild = farChild;
+                farChild = child;
+                float dist = distNear;
+                distNear = distFar;
+                distFar = dist;
+            }
+
+            if (distNear != FLT_MAX)
+            {
+                if (distFar != FLT_MAX)
+                    stack[stackPtr++] = { farChild, distFar };
+                nodeIndex = nearChild;
+                continue;
+            }
+        }
+
+        // pop the next node that is still closer than the closest hit
+        bool found = false;
+        while (stackPtr > 0)
+        {
+            Entry const& entry = stack[--stackPtr];
+            if (entry.dist < tMax)
+            {
+                nodeIndex = entry.node;
+                found = true;
+                break;
+            }
+        }
+        if (!found)
+            return;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Nodes are visited once for all lanes that reach them, nearest child first
+    by the closest entry distance among those lanes. Lanes are tested against
+    a node's box again when it is popped, so hits found in the meantime cull it.
+*/
+template<unsigned N, class LEAF>
+inline void
+BVH::IntersectPacket(BVHPacket<N> const& packet, unsigned mask, float* tMax, LEAF&& leaf) const
+{
+    if (this->NodeCount() == 0)
+        return;
+
+    BVHNode const* nodes = this->NodeData();
+    alignas(64) float dist[N];
+    mask = packet.IntersectBox(nodes[0].bounds, mask, tMax, dist);
+
+    // closest entry distance among the lanes of mask
+    auto nearest = [](float const* dist, unsigned lanes)
+    {
+        float d = FLT_MAX;
+        for (; lanes != 0; lanes &= lanes - 1)
+            d = dist[FirstLane(lanes)] < d ? dist[FirstLane(lanes)] : d;
+        return d;
+    };
+    // lanes that leave the packet walk the subtree below node on their own
+    auto diverge = [&](unsigned node, unsigned lanes)
+    {
+        for (; lanes != 0; lanes &= lanes - 1)
+        {
+            unsigned lane = FirstLane(lanes);
+            this->IntersectSubtree(packet.rays[lane], node, tMax[lane], [&](unsigned first, unsigned count)
+            {
+                leaf(first, count, 1u << lane);
+            }, NoVisit());
+        }
+    };
+
+    struct Entry
+    {
+        unsigned node;
+        unsigned mask;
+    };
+    Entry stack[MaxDepth];
+    unsigned stackPtr = 0;
+    unsigned nodeIndex = 0;
+    unsigned const minActive = PacketMinActive(N);
+
+    if (mask != 0 && PopCount(mask) < minActive)
+    {
+        diverge(0, mask);
+        return;
+    }
+
+    while (mask != 0)
+    {
+        BVHNode const& node = nodes[nodeIndex];
+        if (node.IsLeaf())
+        {
+            leaf(node.leftFirst, node.count, mask);
+        }
+        else
+        {
+            alignas(64) float distLeft[N];
+            alignas(64) float distRight[N];
+            unsigned left = node.leftFirst;
+            unsigned right = node.leftFirst + 1;
+            unsigned maskLeft = packet.IntersectBox(nodes[left].bounds, mask, tMax, distLeft);
+            unsigned maskRight = packet.IntersectBox(nodes[right].bounds, mask, tMax, distRight);
+            if (maskLeft != 0 && PopCount(maskLeft) < minActive)
+            {
+                diverge(left, maskLeft);
+                maskLeft = 0;
+            }
+            if (maskRight != 0 && PopCount(maskRight) < minActive)
+            {
+                diverge(right, maskRight);
+                maskRight = 0;
+            }
+
+            if (maskLeft != 0 && maskRight != 0)
+            {
+                bool leftFirst = nearest(distLeft, maskLeft) <= nearest(distRight, maskRight);
+                stack[stackPtr++] = leftFirst ? Entry{ right, maskRight } : Entry{ left, maskLeft };
+                nodeIndex = leftFirst ? left : right;
+                mask = leftFirst ? maskLeft : maskRight;
+                continue;
+            }
+            if (maskLeft != 0 || maskRight != 0)
+            {
+                nodeIndex = maskLeft != 0 ? left : right;
+                mask = maskLeft | maskRight;
+                continue;
+            }
+        }
+
+        // pop the next node that some lane still reaches before its closest hit
+        mask = 0;
+        while (stackPtr > 0 && mask == 0)
+        {
+            Entry const& entry = stack[--stackPtr];
+            nodeIndex = entry.node;
+            mask = packet.IntersectBox(nodes[nodeIndex].bounds, entry.mask, tMax, dist);
+            if (mask != 0 && PopCount(mask) < minActive)
+            {
+                diverge(nodeIndex, mask);
+                mask = 0;
+            }
+        }
+    }
+}
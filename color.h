@@ -1,29 +1,45 @@
 #pragma once
+#include <type_traits>
+#include "simd.h"
 
+//------------------------------------------------------------------------------
+/**
+    Linear RGB in single precision. Unlike vec3 it is not padded: the frame
+    buffer is an array of these and is uploaded to the texture as GL_RGB floats
+*/
 struct Color
 {
     float r = 0;
     float g = 0;
     float b = 0;
 
-    void operator+=(Color const& rhs)
+    SIMD_INLINE void operator+=(Color const& rhs)
     {
         this->r += rhs.r;
         this->g += rhs.g;
         this->b += rhs.b;
     }
 
-    Color operator+(Color const& rhs)
+    SIMD_INLINE Color operator+(Color const& rhs) const
     {
         return {this->r + rhs.r,
                 this->g + rhs.g,
                 this->b + rhs.b};
     }
 
-    Color operator*(Color const& rhs)
+    SIMD_INLINE Color operator*(Color const& rhs) const
     {
         return {this->r * rhs.r,
                 this->g * rhs.g,
                 this->b * rhs.b};
     }
+
+    SIMD_INLINE Color operator*(float const c) const
+    {
+        return {this->r * c,
+                this->g * c,
+                this->b * c};
+    }
 };
+
+static_assert(sizeof(Color) == 12 && std::is_trivially_copyable<Color>::value, "the frame buffer is uploaded as packed RGB floats");
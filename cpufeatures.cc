@@ -0,0 +1,182 @@
+#include "cpufeatures.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define TRAYRACER_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+namespace
+{
+// set on first use
+bool detected = false;
+InstructionSet detectedLevel = InstructionSet::Baseline;
+bool overridden = false;
+InstructionSet overrideLevel = InstructionSet::Baseline;
+
+#if TRAYRACER_X86
+//------------------------------------------------------------------------------
+/**
+    eax, ebx, ecx, edx of cpuid leaf and subleaf, zeros for unsupported leaves
+*/
+void
+Cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4])
+{
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, (int)leaf, (int)subleaf);
+    for (int i = 0; i < 4; i++)
+        regs[i] = (unsigned)r[i];
+#else
+    if (!__get_cpuid_count(leaf, subleaf, &regs[0], &regs[1], &regs[2], &regs[3]))
+        regs[0] = regs[1] = regs[2] = regs[3] = 0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+    Register state the operating system saves on context switches, XCR0
+*/
+unsigned long long
+EnabledRegisterState()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    unsigned lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+    A cpu may support AVX without the operating system saving the upper
+    halves of the registers, so XCR0 is checked as well: SSE and AVX state
+    for AVX2, and the opmask and upper 16 registers for AVX-512.
+*/
+InstructionSet
+DetectInstructionSet()
+{
+#if TRAYRACER_X86
+    unsigned leaf0[4];
+    Cpuid(0, 0, leaf0);
+    unsigned maxLeaf = leaf0[0];
+    if (maxLeaf < 7)
+        return InstructionSet::Baseline;
+
+    unsigned leaf1[4];
+    Cpuid(1, 0, leaf1);
+    bool osxsave = (leaf1[2] & (1u << 27)) != 0;
+    bool avx = (leaf1[2] & (1u << 28)) != 0;
+    bool fma = (leaf1[2] & (1u << 12)) != 0;
+    if (!osxsave || !avx || !fma)
+        return InstructionSet::Baseline;
+
+    unsigned long long xcr0 = EnabledRegisterState();
+    if ((xcr0 & 0x6) != 0x6)
+        return InstructionSet::Baseline;
+
+    unsigned leaf7[4];
+    Cpuid(7, 0, leaf7);
+    bool avx2 = (leaf7[1] & (1u << 5)) != 0;
+    bool avx512f = (leaf7[1] & (1u << 16)) != 0;
+    if (!avx2)
+        return InstructionSet::Baseline;
+    if (avx512f && (xcr0 & 0xE6) == 0xE6)
+        return InstructionSet::AVX512;
+    return InstructionSet::AVX2;
+#else
+    return InstructionSet::Baseline;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+    The AVX2 and AVX-512 kernels are only compiled with TRAYRACER_DISPATCH
+*/
+bool
+InstructionSetAvailable(InstructionSet level)
+{
+    if (level == InstructionSet::Baseline)
+        return true;
+#if TRAYRACER_DISPATCH
+    if (!detected)
+    {
+        detectedLevel = DetectInstructionSet();
+        detected = true;
+    }
+    return (int)level <= (int)detectedLevel;
+#else
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+InstructionSet
+GetInstructionSet()
+{
+    if (overridden)
+        return overrideLevel;
+    if (InstructionSetAvailable(InstructionSet::AVX512))
+        return InstructionSet::AVX512;
+    if (InstructionSetAvailable(InstructionSet::AVX2))
+        return InstructionSet::AVX2;
+    return InstructionSet::Baseline;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+SetInstructionSet(InstructionSet level)
+{
+    if (!InstructionSetAvailable(level))
+        return false;
+    overridden = true;
+    overrideLevel = level;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+char const*
+InstructionSetName(InstructionSet level)
+{
+    switch (level)
+    {
+    case InstructionSet::AVX2:
+        return "avx2";
+    case InstructionSet::AVX512:
+        return "avx512";
+    default:
+        return "baseline";
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+ParseInstructionSet(char const* name, InstructionSet& level)
+{
+    InstructionSet const levels[] = { InstructionSet::Baseline, InstructionSet::AVX2, InstructionSet::AVX512 };
+    for (InstructionSet l : levels)
+    {
+        if (strcmp(name, InstructionSetName(l)) == 0)
+        {
+            level = l;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+//------------------------------------------------------------------------------
+/**
+    Instruction set levels the render kernels are compiled for, see
+    renderkernels.h. Each level includes the ones before it.
+*/
+enum class InstructionSet
+{
+    // whatever the compiler flags of the build are, SSE2 on x86-64
+    Baseline,
+    // AVX2 and FMA
+    AVX2,
+    // AVX-512F, on top of AVX2
+    AVX512,
+};
+
+// the highest level the cpu and the operating system support, read with cpuid once
+InstructionSet DetectInstructionSet();
+
+// true if the kernels of level are compiled into this build and the cpu can run them
+bool InstructionSetAvailable(InstructionSet level);
+
+// level the raytracer runs, the highest available one unless SetInstructionSet overrides it
+InstructionSet GetInstructionSet();
+
+// force a level, for benchmarking. Returns false and keeps the current
+// level if it is not available
+bool SetInstructionSet(InstructionSet level);
+
+// "baseline", "avx2" or "avx512"
+char const* InstructionSetName(InstructionSet level);
+
+// inverse of InstructionSetName, returns false for unknown names
+bool ParseInstructionSet(char const* name, InstructionSet& level);
@@ -0,0 +1,130 @@
+#include "grid.h"
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+UniformGrid::Build(std::vector<BBox> const& primBounds)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    unsigned count = (unsigned)primBounds.size();
+    this->bounds = BBox();
+    this->cellStart.clear();
+    this->cellPrims.clear();
+    this->largePrims.clear();
+    this->occupancy = 0.0f;
+    this->res[0] = this->res[1] = this->res[2] = 0;
+
+    if (count > 0)
+    {
+        // leave out primitives that are far larger than the typical one
+        std::vector<float> sizes(count);
+        for (unsigned i = 0; i < count; i++)
+        {
+            BBox const& b = primBounds[i];
+            sizes[i] = std::max(b.Extent(0), std::max(b.Extent(1), b.Extent(2)));
+        }
+        std::vector<float> sorted = sizes;
+        std::nth_element(sorted.begin(), sorted.begin() + count / 2, sorted.end());
+        float largeSize = sorted[count / 2] * LargeFactor;
+
+        std::vector<unsigned> gridPrims;
+        gridPrims.reserve(count);
+        for (unsigned i = 0; i < count; i++)
+        {
+            if (sizes[i] > largeSize)
+            {
+                this->largePrims.push_back(i);
+            }
+            else
+            {
+                gridPrims.push_back(i);
+                this->bounds.Grow(primBounds[i]);
+            }
+        }
+
+        if (!gridPrims.empty())
+        {
+            // pick the resolution so that cells are about cubic, with Density cells per primitive
+            float extent[3];
+            float maxExtent = 0.0f;
+            for (int i = 0; i < 3; i++)
+                maxExtent = std::max(maxExtent, this->bounds.Extent(i));
+            maxExtent = std::max(maxExtent, FLT_MIN);
+            for (int i = 0; i < 3; i++)
+                extent[i] = std::max(this->bounds.Extent(i), maxExtent * 1e-3f);
+            float cellsPerUnit = cbrtf(Density * gridPrims.size() / (extent[0] * extent[1] * extent[2]));
+            for (int i = 0; i < 3; i++)
+            {
+                float r = ceilf(extent[i] * cellsPerUnit);
+                this->res[i] = r < 1.0f ? 1 : (r > MaxResolution ? MaxResolution : (unsigned)r);
+                // grow the grid a little, so that bounds on the far side do not land outside of it
+                this->cellSize[i] = extent[i] / this->res[i] * 1.0001f;
+                this->invCellSize[i] = 1.0f / this->cellSize[i];
+                this->bounds.max[i] = this->bounds.min[i] + this->cellSize[i] * this->res[i];
+            }
+
+            // cells touched by a primitive, padded so that rounding in the traversal can not skip them
+            auto cellRange = [this](BBox const& b, int lo[3], int hi[3])
+            {
+                for (int i = 0; i < 3; i++)
+                {
+                    float pad = this->cellSize[i] * 1e-3f;
+                    int l = (int)floorf((b.min[i] - pad - this->bounds.min[i]) * this->invCellSize[i]);
+                    int h = (int)floorf((b.max[i] + pad - this->bounds.min[i]) * this->invCellSize[i]);
+                    lo[i] = std::max(l, 0);
+                    hi[i] = std::min(h, (int)this->res[i] - 1);
+                }
+            };
+
+            // count, prefix sum, then scatter, all linear in the number of references
+            unsigned numCells = this->res[0] * this->res[1] * this->res[2];
+            this->cellStart.assign(numCells + 1, 0);
+            for (unsigned prim : gridPrims)
+            {
+                int lo[3], hi[3];
+                cellRange(primBounds[prim], lo, hi);
+                for (int z = lo[2]; z <= hi[2]; z++)
+                    for (int y = lo[1]; y <= hi[1]; y++)
+                        for (int x = lo[0]; x <= hi[0]; x++)
+                            this->cellStart[(z * this->res[1] + y) * this->res[0] + x + 1]++;
+            }
+
+            unsigned nonEmpty = 0;
+            for (unsigned c = 0; c < numCells; c++)
+            {
+                nonEmpty += this->cellStart[c + 1] > 0 ? 1 : 0;
+                this->cellStart[c + 1] += this->cellStart[c];
+            }
+            this->occupancy = (float)nonEmpty / numCells;
+
+            this->cellPrims.resize(this->cellStart[numCells]);
+            std::vector<unsigned> fill(this->cellStart.begin(), this->cellStart.end() - 1);
+            for (unsigned prim : gridPrims)
+            {
+                int lo[3], hi[3];
+                cellRange(primBounds[prim], lo, hi);
+                for (int z = lo[2]; z <= hi[2]; z++)
+                    for (int y = lo[1]; y <= hi[1]; y++)
+                        for (int x = lo[0]; x <= hi[0]; x++)
+                            this->cellPrims[fill[(z * this->res[1] + y) * this->res[0] + x]++] = prim;
+            }
+        }
+    }
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    this->buildTime = std::chrono::duration<float, std::milli>(stop - start).count();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+size_t
+UniformGrid::MemoryUsage() const
+{
+    return (this->cellStart.size() + this->cellPrims.size() + this->largePrims.size()) * sizeof(unsigned);
+}
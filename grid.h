@@ -0,0 +1,141 @@
+#pragma once
+#include <vector>
+#include <float.h>
+#include "bbox.h"
+#include "bvh.h"
+
+//------------------------------------------------------------------------------
+/**
+    Uniform grid over primitive bounds, traversed with a 3D-DDA.
+    Builds in linear time and works best for evenly spread primitives of
+    similar size. Primitives much larger than the typical one are kept out of
+    the grid and tested against every ray, so that they do not stretch it.
+*/
+class UniformGrid
+{
+public:
+    // build the grid, primitives are referenced by their index in primBounds
+    void Build(std::vector<BBox> const& primBounds);
+
+    // same contract as BVH::Intersect
+    template<class INTERSECT>
+    void Intersect(Ray const& ray, float& tMax, INTERSECT&& intersect) const;
+
+    // bytes used by the cells and primitive references
+    size_t MemoryUsage() const;
+
+    // bounds of the primitives in the grid
+    BBox bounds;
+    // number of cells along each axis
+    unsigned res[3] = { 0, 0, 0 };
+    float cellSize[3];
+    float invCellSize[3];
+    // primitives of cell i are cellPrims[cellStart[i]] to cellPrims[cellStart[i + 1]]
+    std::vector<unsigned> cellStart;
+    std::vector<unsigned> cellPrims;
+    // primitives left out of the grid
+    std::vector<unsigned> largePrims;
+
+    // fraction of cells holding at least one primitive
+    float occupancy = 0.0f;
+    // milliseconds spent in the last build
+    float buildTime = 0.0f;
+
+    // cells per primitive
+    static constexpr float Density = 2.0f;
+    static constexpr unsigned MaxResolution = 256;
+    // primitives with a longest extent this many times the median go to largePrims
+    static constexpr float LargeFactor = 16.0f;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<class INTERSECT>
+inline void
+UniformGrid::Intersect(Ray const& ray, float& tMax, INTERSECT&& intersect) const
+{
+    for (unsigned prim : this->largePrims)
+        intersect(prim);
+
+    if (this->cellPrims.empty())
+        return;
+
+    BVHRay r(ray);
+    float dir[3] = { (float)ray.m.x, (float)ray.m.y, (float)ray.m.z };
+
+    // clip the ray against the grid
+    float tEnter = 0.0f;
+    float tExit = tMax;
+    for (int i = 0; i < 3; i++)
+    {
+        float t1 = (this->bounds.min[i] - r.origin[i]) * r.invDir[i];
+        float t2 = (this->bounds.max[i] - r.origin[i]) * r.invDir[i];
+        tEnter = t1 < t2 ? (t1 > tEnter ? t1 : tEnter) : (t2 > tEnter ? t2 : tEnter);
+        tExit = t1 < t2 ? (t2 < tExit ? t2 : tExit) : (t1 < tExit ? t1 : tExit);
+    }
+    if (tEnter > tExit * 1.0000004f)
+        return;
+
+    int cell[3];
+    int step[3];
+    int end[3];
+    // offset from a cell index to the index of the wall the ray leaves through
+    int wall[3];
+    float tNext[3];
+    for (int i = 0; i < 3; i++)
+    {
+        float p = r.origin[i] + dir[i] * tEnter;
+        int c = (int)((p - this->bounds.min[i]) * this->invCellSize[i]);
+        c = c < 0 ? 0 : (c >= (int)this->res[i] ? (int)this->res[i] - 1 : c);
+        cell[i] = c;
+        if (dir[i] > 0.0f)
+        {
+            step[i] = 1;
+            end[i] = (int)this->res[i];
+            wall[i] = 1;
+        }
+        else if (dir[i] < 0.0f)
+        {
+            step[i] = -1;
+            end[i] = -1;
+            wall[i] = 0;
+        }
+        else
+        {
+            step[i] = 0;
+            end[i] = -1;
+            wall[i] = 0;
+            tNext[i] = FLT_MAX;
+            continue;
+        }
+        tNext[i] = (this->bounds.min[i] + (c + wall[i]) * this->cellSize[i] - r.origin[i]) * r.invDir[i];
+    }
+
+    // primitives spanning several cells are only tested once, unless they collide in here
+    unsigned mailbox[8] = { ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u, ~0u };
+
+    for (;;)
+    {
+        unsigned index = ((unsigned)cell[2] * this->res[1] + (unsigned)cell[1]) * this->res[0] + (unsigned)cell[0];
+        for (unsigned i = this->cellStart[index]; i < this->cellStart[index + 1]; i++)
+        {
+            unsigned prim = this->cellPrims[i];
+            if (mailbox[prim & 7] == prim)
+                continue;
+            mailbox[prim & 7] = prim;
+            intersect(prim);
+        }
+
+        // step to the neighbour through the nearest cell wall
+        int axis = tNext[0] < tNext[1] ? (tNext[0] < tNext[2] ? 0 : 2) : (tNext[1] < tNext[2] ? 1 : 2);
+        // a hit closer than the exit of this cell can not be beaten by later cells
+        if (tMax < tNext[axis] * 0.9999996f)
+            break;
+        cell[axis] += step[axis];
+        if (cell[axis] == end[axis])
+            break;
+        // computed from the wall position rather than accumulated, so errors do not build up over long walks
+        tNext[axis] = (this->bounds.min[axis] + (cell[axis] + wall[axis]) * this->cellSize[axis] - r.origin[axis]) * r.invDir[axis];
+    }
+}
@@ -0,0 +1,155 @@
+#include "instance.h"
+#include <assert.h>
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+InstanceGroup::AddObject(Object* obj)
+{
+    assert(this->dirty);
+    this->objects.push_back(obj);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+InstanceGroup::Build()
+{
+    if (!this->dirty)
+        return;
+
+    std::vector<BBox> primBounds(this->objects.size());
+    this->bounds = BBox();
+    for (size_t i = 0; i < this->objects.size(); i++)
+    {
+        bool bounded = this->objects[i]->GetBounds(primBounds[i]);
+        assert(bounded);
+        this->bounds.Grow(primBounds[i]);
+    }
+
+    this->bvh.Build(primBounds);
+    this->bvh8.Build(this->bvh);
+    // the wide bvh has its own copy of the primitive indices
+    this->bvh = BVH();
+    this->primitives.Build(this->objects, this->bvh8.PrimData(), (unsigned)this->objects.size());
+    this->dirty = false;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+InstanceGroup::Intersect(Ray const& ray, float maxDist, HitResult& hit) const
+{
+    bool isHit = false;
+    HitResult closestHit;
+    closestHit.t = maxDist;
+    ScenePrimitives::PreparedRay prepared(ray);
+    this->bvh8.IntersectLeaves(ray, closestHit.t, [&](unsigned first, unsigned count)
+    {
+        if (this->primitives.Intersect(ray, prepared, first, count, closestHit))
+            isHit = true;
+    });
+    if (isHit)
+        hit = closestHit;
+    return isHit;
+}
+
+//------------------------------------------------------------------------------
+/**
+    A negative tMax ends the traversal once something is hit
+*/
+bool
+InstanceGroup::Occluded(Ray const& ray, float maxDist) const
+{
+    bool occluded = false;
+    float tMax = maxDist;
+    ScenePrimitives::PreparedRay prepared(ray);
+    this->bvh8.IntersectLeaves(ray, tMax, [&](unsigned first, unsigned count)
+    {
+        if (this->primitives.Occluded(ray, prepared, first, count, maxDist))
+        {
+            occluded = true;
+            tMax = -FLT_MAX;
+        }
+    });
+    return occluded;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+size_t
+InstanceGroup::MemoryUsage() const
+{
+    return this->bvh8.nodes.size() * sizeof(WideBVHNode<8>) + this->bvh8.primIndices.size() * sizeof(unsigned) +
+        this->primitives.MemoryUsage();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+Instance::Instance(InstanceGroup* group, mat4 transform) :
+    group(group),
+    transform(transform),
+    invTransform(inverse(transform))
+{
+    group->Build();
+}
+
+//------------------------------------------------------------------------------
+/**
+    The ray direction is transformed but not normalized, so distances along
+    the ray are the same in both spaces
+*/
+bool
+Instance::Intersect(Ray const& ray, float maxDist, HitResult& hit)
+{
+    Ray local(transform_point(ray.b, this->invTransform), ::transform(ray.m, this->invTransform));
+    if (!this->group->Intersect(local, maxDist, hit))
+        return false;
+
+    // normals go through the inverse transpose
+    vec3 n = hit.normal;
+    hit.normal = normalize(vec3(
+        dot(get_row0(this->invTransform), n),
+        dot(get_row1(this->invTransform), n),
+        dot(get_row2(this->invTransform), n)));
+    hit.p = ray.PointAt(hit.t);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+Instance::Occluded(Ray const& ray, float maxDist)
+{
+    Ray local(transform_point(ray.b, this->invTransform), ::transform(ray.m, this->invTransform));
+    return this->group->Occluded(local, maxDist);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+Instance::GetBounds(BBox& bounds)
+{
+    BBox const& local = this->group->GetBounds();
+    if (local.IsEmpty())
+        return false;
+
+    bounds = BBox();
+    for (int corner = 0; corner < 8; corner++)
+    {
+        vec3 c(
+            (corner & 1) ? local.max[0] : local.min[0],
+            (corner & 2) ? local.max[1] : local.min[1],
+            (corner & 4) ? local.max[2] : local.min[2]);
+        vec3 w = transform_point(c, this->transform);
+        bounds.Grow(&w.x);
+    }
+    return true;
+}
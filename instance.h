@@ -0,0 +1,72 @@
+#pragma once
+#include <vector>
+#include "object.h"
+#include "mat4.h"
+#include "bvh.h"
+#include "widebvh.h"
+#include "primitivestore.h"
+
+//------------------------------------------------------------------------------
+/**
+    A set of objects that is placed in the scene any number of times through
+    Instances. The group has its own bottom level bvh, built once, and the
+    scene bvh only sees the instances.
+
+    Objects are given in the space of the group, the group does not own them,
+    and must not be changed after the first instance of it has been created.
+*/
+class InstanceGroup
+{
+public:
+    // add object to group, it must have finite bounds
+    void AddObject(Object* obj);
+
+    // build the bottom level bvh, does nothing if it is built already.
+    // Called automatically by the first instance
+    void Build();
+
+    // closest hit in group space, hit.object is the object within the group.
+    // hit is left alone if nothing is hit before maxDist
+    bool Intersect(Ray const& ray, float maxDist, HitResult& hit) const;
+    // true if any object of the group is hit before maxDist
+    bool Occluded(Ray const& ray, float maxDist) const;
+
+    // bounds of all objects in the group
+    BBox const& GetBounds() const { return this->bounds; }
+
+    // bytes used by the bottom level structure
+    size_t MemoryUsage() const;
+
+    std::vector<Object*> objects;
+
+private:
+    bool dirty = true;
+    BBox bounds;
+    BVH bvh;
+    WideBVH<8> bvh8;
+    // objects in the primitive order of bvh8
+    ScenePrimitives primitives;
+};
+
+//------------------------------------------------------------------------------
+/**
+    An InstanceGroup placed with an affine transform.
+    Hits report the object within the group, with world space point and normal,
+    so an instance is never returned as the hit object itself.
+*/
+class Instance : public Object
+{
+public:
+    Instance(InstanceGroup* group, mat4 transform);
+
+    bool Intersect(Ray const& ray, float maxDist, HitResult& hit) override;
+    bool Occluded(Ray const& ray, float maxDist) override;
+    bool GetBounds(BBox& bounds) override;
+    Color GetColor() override { return { 1.0f, 1.0f, 1.0f }; }
+
+    InstanceGroup const* const group;
+    // group to world
+    mat4 transform;
+    // world to group
+    mat4 invTransform;
+};
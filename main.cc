@@ -3,6 +3,13 @@
 #include "vec3.h"
 #include "raytracer.h"
 #include "sphere.h"
+#include "plane.h"
+#include "instance.h"
+#include "trianglemesh.h"
+#include "objloader.h"
+#include "benchmark.h"
+#include "allocationcounter.h"
+#include "cpufeatures.h"
 #include <iostream>
 #include <chrono>
 
@@ -32,8 +39,8 @@ public:
 #if no_gl
 int main(int argc, char* argv[])
 {
-    if (argc != 5) {
-        std::cout << "Usage: " << argv[0] << " <width> <height> <raysPerPixel> <numOfSpheres>" << std::endl;
+    if (argc < 5) {
+        std::cout << "Usage: " << argv[0] << " <width> <height> <raysPerPixel> <numOfSpheres> [--builder=sah|lbvh] [--layout=dfs|treelet] [--accel=auto|brute|bvh|bvh4|bvh8|qbvh4|qbvh8|grid] [--animate] [--instances=<n>] [--cache=<directory>] [--benchmark=layout|sorting|occlusion|memory|raytrace|mesh|scaling|dispatch|numa] [--span=<size>] [--dispatch=static|virtual] [--packets=1|4|8|16] [--integrator=recursive|wavefront|ao] [--sorting=on|off] [--isa=auto|baseline|avx2|avx512] [--mesh=<file.obj>] [--threads=<n>] [--numa=on|off]" << std::endl;
         return 1;
     }
     int w = atoi(argv[1]);
@@ -50,25 +57,149 @@ int main(int argc, char* argv[])
 
     Raytracer rt = Raytracer(w, h, framebuffer, raysPerPixel, maxBounces);
 
+    // move the spheres every frame, to measure refitting
+    bool animate = false;
+    // if > 0, the spheres form one group that is placed this many times
+    int numOfInstances = 0;
+    // run a benchmark on the scene instead of rendering
+    std::string benchmark;
+    // size of the box the spheres are spread in
+    float span = 10.0f;
+    // OBJ file added to the scene as one triangle mesh
+    std::string meshPath;
+
+    for (int i = 5; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "--animate")
+            animate = true;
+        else if (arg == "--builder=lbvh")
+            rt.bvhBuilder = BVHBuilder::LBVH;
+        else if (arg == "--builder=sah")
+            rt.bvhBuilder = BVHBuilder::SAH;
+        else if (arg == "--layout=dfs")
+            rt.bvhLayout = BVHLayout::DepthFirst;
+        else if (arg == "--layout=treelet")
+            rt.bvhLayout = BVHLayout::Treelet;
+        else if (arg == "--accel=auto")
+            rt.accelerationStructure = AccelerationStructure::Auto;
+        else if (arg == "--accel=grid")
+            rt.accelerationStructure = AccelerationStructure::Grid;
+        else if (arg == "--accel=brute")
+            rt.accelerationStructure = AccelerationStructure::BruteForce;
+        else if (arg == "--accel=bvh")
+            rt.accelerationStructure = AccelerationStructure::BVH;
+        else if (arg == "--accel=bvh4")
+            rt.accelerationStructure = AccelerationStructure::BVH4;
+        else if (arg == "--accel=bvh8")
+            rt.accelerationStructure = AccelerationStructure::BVH8;
+        else if (arg == "--accel=qbvh4")
+            rt.accelerationStructure = AccelerationStructure::QuantizedBVH4;
+        else if (arg == "--accel=qbvh8")
+            rt.accelerationStructure = AccelerationStructure::QuantizedBVH8;
+        else if (arg.compare(0, 12, "--instances=") == 0)
+            numOfInstances = atoi(arg.c_str() + 12);
+        else if (arg.compare(0, 8, "--cache=") == 0)
+            rt.accelerationCacheDirectory = arg.substr(8);
+        else if (arg == "--benchmark=layout" || arg == "--benchmark=sorting" || arg == "--benchmark=occlusion" || arg == "--benchmark=memory" || arg == "--benchmark=raytrace" || arg == "--benchmark=mesh" ||
+            arg == "--benchmark=scaling" || arg == "--benchmark=dispatch" || arg == "--benchmark=numa")
+            benchmark = arg.substr(12);
+        else if (arg.compare(0, 7, "--span=") == 0)
+            span = (float)atof(arg.c_str() + 7);
+        else if (arg == "--dispatch=static")
+            rt.staticDispatch = true;
+        else if (arg == "--dispatch=virtual")
+            rt.staticDispatch = false;
+        else if (arg.compare(0, 10, "--packets=") == 0)
+            rt.packetSize = (unsigned)atoi(arg.c_str() + 10);
+        else if (arg == "--integrator=recursive")
+            rt.integrator = Integrator::Recursive;
+        else if (arg == "--integrator=wavefront")
+            rt.integrator = Integrator::Wavefront;
+        else if (arg == "--integrator=ao")
+            rt.integrator = Integrator::AmbientOcclusion;
+        else if (arg == "--sorting=on")
+            rt.sortSecondaryRays = true;
+        else if (arg == "--sorting=off")
+            rt.sortSecondaryRays = false;
+        else if (arg.compare(0, 10, "--threads=") == 0)
+            rt.numThreads = atoi(arg.c_str() + 10);
+        else if (arg == "--numa=on")
+            rt.numaPlacement = true;
+        else if (arg == "--numa=off")
+            rt.numaPlacement = false;
+        else if (arg.compare(0, 7, "--mesh=") == 0)
+            meshPath = arg.substr(7);
+        else if (arg == "--isa=auto")
+            ;
+        else if (arg.compare(0, 6, "--isa=") == 0)
+        {
+            InstructionSet level;
+            if (!ParseInstructionSet(arg.c_str() + 6, level))
+            {
+                std::cout << "Unknown option " << arg << std::endl;
+                return 1;
+            }
+            if (!SetInstructionSet(level))
+            {
+                std::cout << "The " << InstructionSetName(level) << " kernels are not available on this cpu or in this build" << std::endl;
+                return 1;
+            }
+        }
+        else
+        {
+            std::cout << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "Render kernels: " << InstructionSetName(GetInstructionSet()) << std::endl;
+
     // Create some objects
-    Material* mat = new Material();
-    mat->type = "Lambertian";
-    mat->color = { 0.5,0.5,0.5 };
-    mat->roughness = 0.3;
-    Sphere* ground = new Sphere(1000, { 0,-1000, -1 }, mat);
+    Material mat;
+    mat.type = "Lambertian";
+    mat.color = { 0.5,0.5,0.5 };
+    mat.roughness = 0.3;
+    Plane* ground = new Plane({ 0,1,0 }, 0.0f, AddMaterial(mat));
     rt.AddObject(ground);
 
+    if (!meshPath.empty())
+    {
+        std::vector<float> positions;
+        std::vector<unsigned> indices;
+        auto start = std::chrono::high_resolution_clock::now();
+        if (!LoadObj(meshPath.c_str(), positions, indices))
+        {
+            std::cout << "Could not load " << meshPath << std::endl;
+            return 1;
+        }
+        auto stop = std::chrono::high_resolution_clock::now();
+        TriangleMesh* mesh = new TriangleMesh(std::move(positions), std::move(indices), AddMaterial(mat), rt.bvhBuilder);
+        rt.AddObject(mesh);
+        std::cout << meshPath << ": " << mesh->TriangleCount() << " triangles, loaded in "
+            << std::chrono::duration<float, std::milli>(stop - start).count() << " ms, bvh built in "
+            << mesh->buildTime << " ms" << std::endl;
+    }
+
+    if (animate && numOfInstances > 0)
+    {
+        std::cout << "--animate can not be combined with --instances" << std::endl;
+        return 1;
+    }
+    InstanceGroup cluster;
+
     //Creating spheres
+    std::vector<Sphere*> spheres;
+    std::vector<vec3> restPositions;
     for (int i = 0; i < numOfSpheres; i++)
     {
-        Material* mat = new Material();
-        mat->type = "Lambertian";
+        Material mat;
+        mat.type = "Lambertian";
         float r = random.GetFloat();
         float g = random.GetFloat();
         float b = random.GetFloat();
-        mat->color = { r,g,b };
-        mat->roughness = random.GetFloat();
-        const float span = 10.0f;
+        mat.color = { r,g,b };
+        mat.roughness = random.GetFloat();
         Sphere* ground = new Sphere(
             random.GetFloat() * 0.7f + 0.2f,
             {
@@ -76,8 +207,29 @@ int main(int argc, char* argv[])
                 random.GetFloat()* span + 0.2f,
                 random.GetFloat()* span
             },
-            mat);
-        rt.AddObject(ground);
+            AddMaterial(mat));
+        if (numOfInstances > 0)
+            cluster.AddObject(ground);
+        else
+            rt.AddObject(ground);
+        spheres.push_back(ground);
+        restPositions.push_back(ground->center);
+    }
+
+    // place copies of the cluster on a grid going away from the camera, each with a random rotation
+    if (numOfInstances > 0)
+    {
+        int side = (int)ceilf(sqrtf((float)numOfInstances));
+        for (int i = 0; i < numOfInstances; i++)
+        {
+            mat4 placement = rotationy(random.GetFloat() * 360.0f);
+            placement.m30 = ((i % side) - side / 2) * 12.0f;
+            placement.m31 = 0.0f;
+            placement.m32 = (i / side) * -12.0f;
+            rt.AddObject(new Instance(&cluster, placement));
+        }
+        std::cout << numOfInstances << " instances of " << numOfSpheres << " spheres, bottom level bvh uses "
+            << cluster.MemoryUsage() << " bytes" << std::endl;
     }
 
     // camera
@@ -94,6 +246,34 @@ int main(int argc, char* argv[])
     // number of accumulated frames
     int frameIndex = 0;
 
+    if (!benchmark.empty())
+    {
+        mat4 cameraTransform = multiply(rotationy(roty), rotationx(rotx));
+        cameraTransform.m30 = camPos.x;
+        cameraTransform.m31 = camPos.y;
+        cameraTransform.m32 = camPos.z;
+        rt.SetViewMatrix(cameraTransform);
+        if (benchmark == "sorting")
+            BenchmarkRaySorting(rt);
+        else if (benchmark == "occlusion")
+            BenchmarkOcclusion(rt);
+        else if (benchmark == "memory")
+            BenchmarkObjectMemory(rt);
+        else if (benchmark == "raytrace")
+            BenchmarkRaytrace(rt);
+        else if (benchmark == "mesh")
+            BenchmarkMesh(rt);
+        else if (benchmark == "scaling")
+            BenchmarkScaling(rt);
+        else if (benchmark == "dispatch")
+            BenchmarkDispatch(rt);
+        else if (benchmark == "numa")
+            BenchmarkNuma(rt);
+        else
+            BenchmarkBVHLayout(rt);
+        return 0;
+    }
+
     std::vector<Color> framebufferCopy;
     framebufferCopy.resize(w * h);
 
@@ -122,13 +302,26 @@ int main(int argc, char* argv[])
 
         rt.SetViewMatrix(cameraTransform);
 
+        if (animate)
+        {
+            for (size_t s = 0; s < spheres.size(); s++)
+            {
+                vec3 offset = { 0.0f, 0.5f * sinf(i * 0.1f + s), 0.0f };
+                spheres[s]->center = restPositions[s] + offset;
+            }
+            rt.RefitAccelerationStructure();
+            resetFramebuffer = true;
+        }
+
         if (resetFramebuffer)
         {
             rt.Clear();
             frameIndex = 0;
         }
 
+        unsigned long long allocations = AllocationCount();
         rt.Raytrace();
+        allocations = AllocationCount() - allocations;
         frameIndex++;
 
         // Get the average distribution of all samples
@@ -152,6 +345,8 @@ int main(int argc, char* argv[])
         int total_rays = w * h * raysPerPixel;
         float mray_per_sec = total_rays / float(duration.count());
         std::cout << mray_per_sec << " MRays / s" << std::endl;
+        // the first frame builds the acceleration structure, later ones should not allocate at all
+        std::cout << allocations << " heap allocations while tracing" << std::endl;
     }
 
     return 0;
@@ -182,23 +377,23 @@ int main()
     Raytracer rt = Raytracer(w, h, framebuffer, raysPerPixel, maxBounces);
 
     // Create some objects
-    Material* mat = new Material();
-    mat->type = "Lambertian";
-    mat->color = { 0.5,0.5,0.5 };
-    mat->roughness = 0.3;
-    Sphere* ground = new Sphere(1000, { 0,-1000, -1 }, mat);
+    Material mat;
+    mat.type = "Lambertian";
+    mat.color = { 0.5,0.5,0.5 };
+    mat.roughness = 0.3;
+    Plane* ground = new Plane({ 0,1,0 }, 0.0f, AddMaterial(mat));
     rt.AddObject(ground);
 
     for (int it = 0; it < 12; it++)
     {
         {
-            Material* mat = new Material();
-            mat->type = "Lambertian";
+            Material mat;
+            mat.type = "Lambertian";
             float r = random.GetFloat();
             float g = random.GetFloat();
             float b = random.GetFloat();
-            mat->color = { r,g,b };
-            mat->roughness = random.GetFloat();
+            mat.color = { r,g,b };
+            mat.roughness = random.GetFloat();
             const float span = 10.0f;
             Sphere* ground = new Sphere(
                 random.GetFloat() * 0.7f + 0.2f,
@@ -207,16 +402,16 @@ int main()
                     random.GetFloat()* span + 0.2f,
                     random.GetFloat()* span
                 },
-                mat);
+                AddMaterial(mat));
             rt.AddObject(ground);
         } {
-            Material* mat = new Material();
-            mat->type = "Conductor";
+            Material mat;
+            mat.type = "Conductor";
             float r = random.GetFloat();
             float g = random.GetFloat();
             float b = random.GetFloat();
-            mat->color = { r,g,b };
-            mat->roughness = random.GetFloat();
+            mat.color = { r,g,b };
+            mat.roughness = random.GetFloat();
             const float span = 30.0f;
             Sphere* ground = new Sphere(
                 random.GetFloat() * 0.7f + 0.2f,
@@ -225,17 +420,17 @@ int main()
                     random.GetFloat()* span + 0.2f,
                     random.GetFloat()* span
                 },
-                mat);
+                AddMaterial(mat));
             rt.AddObject(ground);
         } {
-            Material* mat = new Material();
-            mat->type = "Dielectric";
+            Material mat;
+            mat.type = "Dielectric";
             float r = random.GetFloat();
             float g = random.GetFloat();
             float b = random.GetFloat();
-            mat->color = { r,g,b };
-            mat->roughness = random.GetFloat();
-            mat->refractionIndex = 1.65;
+            mat.color = { r,g,b };
+            mat.roughness = random.GetFloat();
+            mat.refractionIndex = 1.65;
             const float span = 25.0f;
             Sphere* ground = new Sphere(
                 random.GetFloat() * 0.7f + 0.2f,
@@ -244,7 +439,7 @@ int main()
                     random.GetFloat()* span + 0.2f,
                     random.GetFloat()* span
                 },
-                mat);
+                AddMaterial(mat));
             rt.AddObject(ground);
         }
     }
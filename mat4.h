@@ -5,9 +5,9 @@
 /**
     @struct mat4
 
-    4x4 matrix
+    4x4 matrix, row major. Rows are aligned so they load as vec4
 */
-struct mat4
+struct alignas(16) mat4
 {
     float m00, m01, m02, m03;
     float m10, m11, m12, m13;
@@ -15,6 +15,21 @@ struct mat4
     float m30, m31, m32, m33;
 };
 
+static_assert(sizeof(mat4) == 64 && std::is_trivially_copyable<mat4>::value, "mat4 must stay four packed rows");
+
+// compiled per instruction set, see simd.h
+namespace TRAYRACER_ISA
+{
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline vec4
+get_row(mat4 const& m, int row)
+{
+    return vec4(vfloat4::Load(&m.m00 + 4 * row));
+}
+
 //------------------------------------------------------------------------------
 /**
 */
@@ -58,22 +73,38 @@ get_position(mat4 m)
 inline vec3
 transform(vec3 v, mat4 m)
 {
-    //swizzle!
-    //this should be easy to vectorize! ;)
-    vec3 x = {v.x, v.x, v.x};
-    vec3 y = {v.y, v.y, v.y};
-    vec3 z = {v.z, v.z, v.z};
-    vec3 r0 = { m.m00, m.m01, m.m02 };
-    vec3 r1 = { m.m10, m.m11, m.m12 };
-    vec3 r2 = { m.m20, m.m21, m.m22 };
-    // multiply
-    vec3 a = mul(x, r0);
-    vec3 b = mul(y, r1);
-    vec3 c = mul(z, r2);
-    // add
-    vec3 res = add(a,b);
-    res = add(res,c);
-    return res;
+    // the fourth column is masked off, the padding of vec3 has to stay 0
+    vfloat4 xyz = get_row(m, 0).v * vfloat4::Broadcast(v.x)
+                + get_row(m, 1).v * vfloat4::Broadcast(v.y)
+                + get_row(m, 2).v * vfloat4::Broadcast(v.z);
+    return mul(vec3(xyz), vec3(1.0f, 1.0f, 1.0f));
+}
+
+//------------------------------------------------------------------------------
+/**
+    transform point with matrix basis and translation
+*/
+inline vec3
+transform_point(vec3 v, mat4 m)
+{
+    vfloat4 xyz = get_row(m, 0).v * vfloat4::Broadcast(v.x)
+                + get_row(m, 1).v * vfloat4::Broadcast(v.y)
+                + get_row(m, 2).v * vfloat4::Broadcast(v.z)
+                + get_row(m, 3).v;
+    return mul(vec3(xyz), vec3(1.0f, 1.0f, 1.0f));
+}
+
+//------------------------------------------------------------------------------
+/**
+    transform homogeneous vector
+*/
+inline vec4
+transform(vec4 v, mat4 m)
+{
+    return vec4(get_row(m, 0).v * vfloat4::Broadcast(v.x)
+              + get_row(m, 1).v * vfloat4::Broadcast(v.y)
+              + get_row(m, 2).v * vfloat4::Broadcast(v.z)
+              + get_row(m, 3).v * vfloat4::Broadcast(v.w));
 }
 
 //------------------------------------------------------------------------------
@@ -193,25 +224,13 @@ transpose(mat4 m)
 inline mat4
 multiply(mat4 b, mat4 a)
 {
-    return { b.m00*a.m00 + b.m10*a.m01 + b.m20*a.m02 + b.m30*a.m03,
-             b.m01*a.m00 + b.m11*a.m01 + b.m21*a.m02 + b.m31*a.m03,
-             b.m02*a.m00 + b.m12*a.m01 + b.m22*a.m02 + b.m32*a.m03,
-             b.m03*a.m00 + b.m13*a.m01 + b.m23*a.m02 + b.m33*a.m03,
-
-			 b.m00*a.m10 + b.m10*a.m11 + b.m20*a.m12 + b.m30*a.m13,
-             b.m01*a.m10 + b.m11*a.m11 + b.m21*a.m12 + b.m31*a.m13,
-             b.m02*a.m10 + b.m12*a.m11 + b.m22*a.m12 + b.m32*a.m13,
-             b.m03*a.m10 + b.m13*a.m11 + b.m23*a.m12 + b.m33*a.m13,
-
-			 b.m00*a.m20 + b.m10*a.m21 + b.m20*a.m22 + b.m30*a.m23,
-             b.m01*a.m20 + b.m11*a.m21 + b.m21*a.m22 + b.m31*a.m23,
-             b.m02*a.m20 + b.m12*a.m21 + b.m22*a.m22 + b.m32*a.m23,
-             b.m03*a.m20 + b.m13*a.m21 + b.m23*a.m22 + b.m33*a.m23,
-
-			 b.m00*a.m30 + b.m10*a.m31 + b.m20*a.m32 + b.m30*a.m33,
-             b.m01*a.m30 + b.m11*a.m31 + b.m21*a.m32 + b.m31*a.m33,
-             b.m02*a.m30 + b.m12*a.m31 + b.m22*a.m32 + b.m32*a.m33,
-             b.m03*a.m30 + b.m13*a.m31 + b.m23*a.m32 + b.m33*a.m33 };
+    // row i of the product is row i of a transformed by b
+    mat4 r;
+    transform(get_row(a, 0), b).Load().Store(&r.m00);
+    transform(get_row(a, 1), b).Load().Store(&r.m10);
+    transform(get_row(a, 2), b).Load().Store(&r.m20);
+    transform(get_row(a, 3), b).Load().Store(&r.m30);
+    return r;
 }
 
 //------------------------------------------------------------------------------
@@ -266,4 +285,7 @@ rotationy(float angle)
 			  0, 1, 0, 0,
 			 -s, 0, c, 0,
               0, 0, 0, 1 };
-}
\ No newline at end of file
+}
+
+} // namespace TRAYRACER_ISA
+using namespace TRAYRACER_ISA;
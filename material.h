@@ -25,6 +25,23 @@ struct Material
 
 //------------------------------------------------------------------------------
 /**
-    Scatter ray against material
+    Material::type as a value, to group hits by material without comparing strings again
 */
-Ray BSDF(Material const* const material, Ray ray, vec3 point, vec3 normal);
\ No newline at end of file
+enum class MaterialType
+{
+    Lambertian,
+    Conductor,
+    Dielectric,
+};
+
+MaterialType GetMaterialType(Material const* const material);
+
+// copy material into the table of materials and return its index. Objects store the
+// index, 4 bytes instead of a pointer, and often share materials
+unsigned AddMaterial(Material const& material);
+// material at index, the address stays valid as more materials are added
+Material const* LookupMaterial(unsigned index);
+// number of materials in the table
+unsigned MaterialCount();
+
+// BSDF, ScatterMicrofacet and ScatterDielectric are in pbr.h, they are compiled per instruction set
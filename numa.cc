@@ -0,0 +1,315 @@
+#include "numa.h"
+#include <thread>
+#include <algorithm>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+// synchronous collapse into huge pages, Linux 6.1, not in older headers
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25
+#endif
+#endif
+
+namespace
+{
+#ifdef __linux__
+// size of a transparent huge page on x86-64 and most arm64 kernels
+constexpr size_t HugePageSize = 2 << 20;
+// bits of the node masks passed to the kernel
+constexpr unsigned MaxNodes = 1024;
+
+//------------------------------------------------------------------------------
+/**
+    Cpus of a cpulist file of /sys, ranges like 0-3,8-11
+*/
+std::vector<unsigned>
+ReadCpuList(char const* path)
+{
+    std::vector<unsigned> cpus;
+    FILE* file = fopen(path, "r");
+    if (file == nullptr)
+        return cpus;
+    char line[4096];
+    if (fgets(line, sizeof(line), file) != nullptr)
+    {
+        char* p = line;
+        while (*p >= '0' && *p <= '9')
+        {
+            unsigned first = (unsigned)strtoul(p, &p, 10);
+            unsigned last = first;
+            if (*p == '-')
+                last = (unsigned)strtoul(p + 1, &p, 10);
+            for (unsigned cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+            if (*p == ',')
+                p++;
+        }
+    }
+    fclose(file);
+    return cpus;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The whole pages of [data, data + bytes), false if there are none
+*/
+bool
+PageRange(void const* data, size_t bytes, void*& begin, size_t& length)
+{
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)data + page - 1) & ~(page - 1);
+    uintptr_t last = ((uintptr_t)data + bytes) & ~(page - 1);
+    if (last <= first)
+        return false;
+    begin = (void*)first;
+    length = last - first;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Apply a memory policy to the pages of a range, moving those already
+    touched. mode is MPOL_BIND or MPOL_INTERLEAVE
+*/
+bool
+SetPolicy(void const* data, size_t bytes, int mode, unsigned long const* nodeMask)
+{
+    void* begin;
+    size_t length;
+    if (!PageRange(data, bytes, begin, length))
+        return false;
+    // the kernel takes one bit less than maxnode
+    return syscall(SYS_mbind, begin, length, mode, nodeMask, (unsigned long)MaxNodes + 1, MPOL_MF_MOVE) == 0;
+}
+#endif
+
+//------------------------------------------------------------------------------
+/**
+*/
+NumaTopology
+ReadNumaTopology()
+{
+    NumaTopology topology;
+#ifdef __linux__
+    cpu_set_t allowed;
+    bool haveAllowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    std::vector<unsigned> ids;
+    if (DIR* dir = opendir("/sys/devices/system/node"))
+    {
+        while (dirent* entry = readdir(dir))
+        {
+            unsigned id;
+            char rest;
+            if (sscanf(entry->d_name, "node%u%c", &id, &rest) == 1)
+                ids.push_back(id);
+        }
+        closedir(dir);
+    }
+    std::sort(ids.begin(), ids.end());
+    for (unsigned id : ids)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist", id);
+        std::vector<unsigned> cpus = ReadCpuList(path);
+        if (haveAllowed)
+            cpus.erase(std::remove_if(cpus.begin(), cpus.end(), [&](unsigned cpu) { return cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed); }), cpus.end());
+        if (cpus.empty())
+            continue;
+        topology.nodeCpus.push_back(cpus);
+        topology.nodeIds.push_back(id);
+    }
+    if (topology.nodeCpus.empty() && haveAllowed)
+    {
+        std::vector<unsigned> cpus;
+        for (unsigned cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+                cpus.push_back(cpu);
+        }
+        topology.nodeCpus.push_back(cpus);
+        topology.nodeIds.push_back(0);
+    }
+#endif
+    if (topology.nodeCpus.empty())
+    {
+        std::vector<unsigned> cpus(std::max(1u, std::thread::hardware_concurrency()));
+        for (unsigned cpu = 0; cpu < cpus.size(); cpu++)
+            cpus[cpu] = cpu;
+        topology.nodeCpus.push_back(cpus);
+        topology.nodeIds.push_back(0);
+    }
+    return topology;
+}
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+NumaTopology const&
+GetNumaTopology()
+{
+    static NumaTopology const topology = ReadNumaTopology();
+    return topology;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+PinThread(unsigned cpu)
+{
+#ifdef _WIN32
+    return cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(__linux__)
+    if (cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+UnpinThread()
+{
+#ifdef _WIN32
+    DWORD_PTR process, system;
+    return GetProcessAffinityMask(GetCurrentProcess(), &process, &system) && SetThreadAffinityMask(GetCurrentThread(), process) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (std::vector<unsigned> const& cpus : GetNumaTopology().nodeCpus)
+    {
+        for (unsigned cpu : cpus)
+            CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+BindMemory(void const* data, size_t bytes, unsigned node)
+{
+#ifdef __linux__
+    NumaTopology const& topology = GetNumaTopology();
+    if (node >= topology.NumNodes() || topology.nodeIds[node] >= MaxNodes)
+        return false;
+    unsigned long mask[MaxNodes / (8 * sizeof(unsigned long))] = {};
+    unsigned id = topology.nodeIds[node];
+    mask[id / (8 * sizeof(unsigned long))] |= 1ul << (id % (8 * sizeof(unsigned long)));
+    return SetPolicy(data, bytes, MPOL_BIND, mask);
+#else
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+InterleaveMemory(void const* data, size_t bytes)
+{
+#ifdef __linux__
+    unsigned long mask[MaxNodes / (8 * sizeof(unsigned long))] = {};
+    for (unsigned id : GetNumaTopology().nodeIds)
+    {
+        if (id < MaxNodes)
+            mask[id / (8 * sizeof(unsigned long))] |= 1ul << (id % (8 * sizeof(unsigned long)));
+    }
+    return SetPolicy(data, bytes, MPOL_INTERLEAVE, mask);
+#else
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+    Huge pages only fit where the range covers an aligned 2 MB block, smaller
+    ranges are left alone. Marked ranges get huge pages on their next page
+    fault, or when khugepaged gets to them. MADV_COLLAPSE does it right away
+    for the pages that are already in use, kernels before 6.1 reject it
+*/
+bool
+AdviseHugePages(void const* data, size_t bytes)
+{
+#ifdef __linux__
+    uintptr_t first = ((uintptr_t)data + HugePageSize - 1) & ~(uintptr_t)(HugePageSize - 1);
+    uintptr_t last = ((uintptr_t)data + bytes) & ~(uintptr_t)(HugePageSize - 1);
+    if (last <= first)
+        return false;
+    if (madvise((void*)first, last - first, MADV_HUGEPAGE) != 0)
+        return false;
+    madvise((void*)first, last - first, MADV_COLLAPSE);
+    return true;
+#else
+    return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+int
+MemoryNode(void const* p)
+{
+#ifdef __linux__
+    int id = -1;
+    if (syscall(SYS_get_mempolicy, &id, nullptr, 0ul, p, (unsigned long)(MPOL_F_NODE | MPOL_F_ADDR)) != 0)
+        return -1;
+    std::vector<unsigned> const& ids = GetNumaTopology().nodeIds;
+    auto node = std::find(ids.begin(), ids.end(), (unsigned)id);
+    return node != ids.end() ? (int)(node - ids.begin()) : -1;
+#else
+    return -1;
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+size_t
+HugePageBytes()
+{
+    size_t bytes = 0;
+#ifdef __linux__
+    FILE* file = fopen("/proc/self/smaps_rollup", "r");
+    if (file == nullptr)
+        return 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        unsigned long long kb;
+        if (sscanf(line, "AnonHugePages: %llu kB", &kb) == 1)
+        {
+            bytes = (size_t)kb * 1024;
+            break;
+        }
+    }
+    fclose(file);
+#endif
+    return bytes;
+}
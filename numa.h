@@ -0,0 +1,49 @@
+#pragma once
+#include <vector>
+#include <stddef.h>
+
+//------------------------------------------------------------------------------
+/**
+    Memory nodes of the machine, the sockets of a multi socket machine, and
+    the cpus of each that the process may run on. Read from /sys on Linux.
+    Elsewhere, and on machines without nodes, all cpus are one node.
+*/
+struct NumaTopology
+{
+    // cpus of each node, nodes without allowed cpus are left out
+    std::vector<std::vector<unsigned>> nodeCpus;
+    // the Linux node number of each entry of nodeCpus
+    std::vector<unsigned> nodeIds;
+
+    unsigned NumNodes() const { return (unsigned)this->nodeCpus.size(); }
+};
+
+// read once, on the first call
+NumaTopology const& GetNumaTopology();
+
+// run the calling thread on cpu only, false if the platform does not allow it
+bool PinThread(unsigned cpu);
+// let the calling thread run on every cpu of the topology again
+bool UnpinThread();
+
+//------------------------------------------------------------------------------
+/**
+    Placement of memory that is already in use. Each function works on the
+    whole pages inside [data, data + bytes), so neighbouring allocations
+    that share the first or last page are left alone. They return false if
+    the kernel refused, or the platform has no such thing, the memory is
+    usable either way.
+*/
+
+// move the pages to node, an index into NumaTopology::nodeCpus, and keep them there
+bool BindMemory(void const* data, size_t bytes, unsigned node);
+// move the pages round robin over all nodes, so no single node serves all reads of them
+bool InterleaveMemory(void const* data, size_t bytes);
+// back the pages by transparent huge pages, collapsing the ones already touched
+// where the kernel can
+bool AdviseHugePages(void const* data, size_t bytes);
+
+// node the page of p is on, an index into NumaTopology::nodeCpus, -1 if unknown
+int MemoryNode(void const* p);
+// bytes of anonymous memory of the process on transparent huge pages, 0 if unknown
+size_t HugePageBytes();
@@ -1,14 +1,17 @@
 #pragma once
 #include "ray.h"
 #include "color.h"
+#include "bbox.h"
+#include "random.h"
 #include <float.h>
-#include <string>
-#include <memory>
+#include <type_traits>
 
 class Object;
+struct Material;
 
 //------------------------------------------------------------------------------
 /**
+    Filled in place by the intersection tests, never allocated
 */
 struct HitResult
 {
@@ -20,72 +23,48 @@ struct HitResult
     Object* object = nullptr;
     // intersection distance
     float t = FLT_MAX;
-};
-
-template<class TYPE>
-class Optional
-{
-public:
-    Optional() {}
-    Optional(HitResult hit) : hasValue(true)
-    {
-        this->value = std::make_shared<HitResult>(hit);
-    }
 
-    bool HasValue()
-    {
-        return hasValue;
-    }
-    HitResult Get()
-    {
-        assert(this->HasValue());
-        return *value;
-    }
-
-private:
-    bool hasValue = false;
-    std::shared_ptr<HitResult> value = nullptr;
+    SIMD_INLINE HitResult() {}
 };
+static_assert(std::is_trivially_copyable<HitResult>::value, "hit records are copied around as plain memory");
 
 //------------------------------------------------------------------------------
 /**
+    Objects only hold what rendering needs, names and other debug information
+    go to an ObjectMetadata table, keyed by GetId
 */
 class Object
 {
 public:
-    Object() 
+    Object()
     {
         static unsigned long long idCounter = 0;
         id = idCounter++;
-        // Reserve characters for naming this object something!
-        name = new char[256];
-        name[0] = 'U';
-        name[1] = 'n';
-        name[2] = 'n';
-        name[3] = 'a';
-        name[4] = 'm';
-        name[5] = 'e';
-        name[6] = 'd';
-        name[7] = '\0';
-
-        purpose = std::string("I don't have a purpose at the moment, but hopefully the programmer that overrides me will give me one. :)");
     }
 
     virtual ~Object()
     {
-        // clean up name!
-        delete name;
     }
 
-    virtual Optional<HitResult> Intersect(Ray ray, float maxDist) { return {}; };
+    // fills hit and returns true if the ray hits the object closer than maxDist, leaves hit alone otherwise.
+    // hit.object is the object that was hit, instances report the object within their group
+    virtual bool Intersect(Ray const& ray, float maxDist, HitResult& hit) { return false; }
+    // true if Intersect would find a hit, without filling in where
+    virtual bool Occluded(Ray const& ray, float maxDist)
+    {
+        HitResult hit;
+        return this->Intersect(ray, maxDist, hit);
+    }
+    // get world space bounds, returns false if the object is unbounded
+    virtual bool GetBounds(BBox& bounds) { return false; }
     virtual Color GetColor() = 0;
-    virtual Ray ScatterRay(Ray ray, vec3 point, vec3 normal) { return Ray({ 0,0,0 }, {1,1,1}); };
-    std::string GetName() { return std::string((const char*)name); }
-    unsigned long long GetId() { return this->id; }
+    // material that ScatterRay scatters with, or nullptr if the object scatters some other way
+    virtual Material const* GetMaterial() { return nullptr; }
+    // scattered ray of a path that hit the object, with the random numbers of the path at this bounce
+    virtual Ray ScatterRay(Ray ray, vec3 point, vec3 normal, RandomStream& random) { return Ray({ 0,0,0 }, {1,1,1}); };
+    // key of the object in side tables such as ObjectMetadata
+    unsigned long long GetId() const { return this->id; }
 
 private:
-    volatile bool isBigObject = false;
-    volatile char* name;
     unsigned long long id;
-    std::string purpose;
 };
\ No newline at end of file
@@ -0,0 +1,50 @@
+#include "objectmetadata.h"
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ObjectMetadata::SetName(Object const* object, std::string const& name)
+{
+    this->entries[object->GetId()].name = name;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ObjectMetadata::SetPurpose(Object const* object, std::string const& purpose)
+{
+    this->entries[object->GetId()].purpose = purpose;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+std::string
+ObjectMetadata::GetName(Object const* object) const
+{
+    Entry const* entry = this->Find(object);
+    if (entry == nullptr || entry->name.empty())
+        return "Unnamed";
+    return entry->name;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+ObjectMetadata::Entry const*
+ObjectMetadata::Find(Object const* object) const
+{
+    auto it = this->entries.find(object->GetId());
+    return it != this->entries.end() ? &it->second : nullptr;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ObjectMetadata::Remove(Object const* object)
+{
+    this->entries.erase(object->GetId());
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include "object.h"
+
+//------------------------------------------------------------------------------
+/**
+    Names and other debug information of objects, kept apart from the objects
+    so that rendering only touches their geometry. Keyed by Object::GetId.
+    Optional, objects without an entry are simply unnamed, and nothing in the
+    raytracer reads it.
+*/
+class ObjectMetadata
+{
+public:
+    struct Entry
+    {
+        std::string name;
+        // what the object is there for
+        std::string purpose;
+    };
+
+    void SetName(Object const* object, std::string const& name);
+    void SetPurpose(Object const* object, std::string const& purpose);
+    // name of object, "Unnamed" if it has none
+    std::string GetName(Object const* object) const;
+    // entry of object, or nullptr
+    Entry const* Find(Object const* object) const;
+    void Remove(Object const* object);
+
+    // number of objects with an entry
+    size_t Count() const { return this->entries.size(); }
+
+private:
+    std::unordered_map<unsigned long long, Entry> entries;
+};
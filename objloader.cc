@@ -0,0 +1,357 @@
+#include "objloader.h"
+#include "accelerationcache.h"
+#include "parallel.h"
+
+namespace
+{
+// ranges of a file smaller than this are not worth a thread
+constexpr size_t MinChunkSize = 1 << 20;
+
+// vertices and triangles of a range of lines, and where the range starts in the buffers
+struct Chunk
+{
+    char const* begin;
+    char const* end;
+    unsigned vertexCount = 0;
+    unsigned triangleCount = 0;
+    unsigned firstVertex = 0;
+    unsigned firstTriangle = 0;
+    bool valid = true;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline bool
+IsBlank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+//------------------------------------------------------------------------------
+/**
+    Space that separates tokens, or the end of the line
+*/
+inline bool
+IsSeparator(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline char const*
+SkipBlanks(char const* p, char const* end)
+{
+    while (p < end && IsBlank(*p))
+        p++;
+    return p;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Start of the line after p
+*/
+inline char const*
+NextLine(char const* p, char const* end)
+{
+    while (p < end && *p != '\n')
+        p++;
+    return p < end ? p + 1 : end;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Decimal number with optional fraction and exponent. Digits past the
+    precision of the mantissa are dropped, which is far below float
+    precision. Returns the end of the number, or p if there is none
+*/
+char const*
+ParseFloat(char const* p, char const* end, float& value)
+{
+    static double const powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+    char const* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    unsigned long long mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    bool any = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++, any = true)
+    {
+        if (digits < 18)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0;
+        }
+        else
+        {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.')
+    {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = true)
+        {
+            if (digits < 18)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+    if (!any)
+        return start;
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        char const* q = p + 1;
+        bool negativeExponent = false;
+        if (q < end && (*q == '-' || *q == '+'))
+            negativeExponent = *q++ == '-';
+        if (q < end && *q >= '0' && *q <= '9')
+        {
+            int e = 0;
+            for (; q < end && *q >= '0' && *q <= '9'; q++)
+                e = e < 10000 ? e * 10 + (*q - '0') : e;
+            exponent += negativeExponent ? -e : e;
+            p = q;
+        }
+    }
+
+    double v = (double)mantissa;
+    while (exponent > 22)
+    {
+        v *= 1e22;
+        exponent -= 22;
+    }
+    while (exponent < -22)
+    {
+        v /= 1e22;
+        exponent += 22;
+    }
+    v = exponent >= 0 ? v * powers[exponent] : v / powers[-exponent];
+    value = (float)(negative ? -v : v);
+    return p;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Vertex reference of a face corner, v, v/vt, v//vn or v/vt/vn. Only v is
+    read, the rest of the corner is skipped. Returns the end of the corner,
+    or p if there is no number
+*/
+char const*
+ParseCorner(char const* p, char const* end, long long& index)
+{
+    char const* start = p;
+    bool negative = false;
+    if (p < end && *p == '-')
+    {
+        negative = true;
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9')
+        return start;
+    long long v = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++)
+        v = v < (1ll << 40) ? v * 10 + (*p - '0') : v;
+    index = negative ? -v : v;
+    while (p < end && !IsSeparator(*p))
+        p++;
+    return p;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Number of corners of the face statement starting at p
+*/
+unsigned
+CountCorners(char const* p, char const* end)
+{
+    unsigned corners = 0;
+    for (;;)
+    {
+        p = SkipBlanks(p, end);
+        if (p == end || *p == '\r' || *p == '\n')
+            return corners;
+        corners++;
+        while (p < end && !IsSeparator(*p))
+            p++;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    First pass, the vertices and triangles the lines of chunk add
+*/
+void
+CountChunk(Chunk& chunk)
+{
+    char const* end = chunk.end;
+    for (char const* p = chunk.begin; p < end; p = NextLine(p, end))
+    {
+        p = SkipBlanks(p, end);
+        if (end - p < 2 || !IsBlank(p[1]))
+            continue;
+        if (p[0] == 'v')
+        {
+            chunk.vertexCount++;
+        }
+        else if (p[0] == 'f')
+        {
+            unsigned corners = CountCorners(p + 2, end);
+            if (corners >= 3)
+                chunk.triangleCount += corners - 2;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Second pass, fills the vertices and triangles of chunk from where the
+    first pass placed them. Relative indices count back from the vertices
+    read so far, which are the vertices of all chunks before this one
+*/
+void
+ParseChunk(Chunk& chunk, unsigned totalVertices, float* positions, unsigned* indices)
+{
+    char const* end = chunk.end;
+    float* position = positions + (size_t)chunk.firstVertex * 3;
+    unsigned* index = indices + (size_t)chunk.firstTriangle * 3;
+    long long vertexCount = chunk.firstVertex;
+    for (char const* p = chunk.begin; p < end; p = NextLine(p, end))
+    {
+        p = SkipBlanks(p, end);
+        if (end - p < 2 || !IsBlank(p[1]))
+            continue;
+        if (p[0] == 'v')
+        {
+            p += 2;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                float v = 0.0f;
+                p = ParseFloat(SkipBlanks(p, end), end, v);
+                position[axis] = v;
+            }
+            position += 3;
+            vertexCount++;
+        }
+        else if (p[0] == 'f')
+        {
+            p += 2;
+            unsigned corners = 0;
+            unsigned first = 0;
+            unsigned previous = 0;
+            for (;;)
+            {
+                p = SkipBlanks(p, end);
+                long long ref = 0;
+                char const* next = ParseCorner(p, end, ref);
+                if (next == p)
+                    break;
+                p = next;
+                long long v = ref < 0 ? vertexCount + ref : ref - 1;
+                if (ref == 0 || v < 0 || v >= totalVertices)
+                {
+                    chunk.valid = false;
+                    return;
+                }
+                if (corners == 0)
+                    first = (unsigned)v;
+                else if (corners >= 2)
+                {
+                    index[0] = first;
+                    index[1] = previous;
+                    index[2] = (unsigned)v;
+                    index += 3;
+                }
+                previous = (unsigned)v;
+                corners++;
+            }
+            // a corner the first pass counted but that is not a number
+            p = SkipBlanks(p, end);
+            if (p < end && *p != '\r' && *p != '\n')
+            {
+                chunk.valid = false;
+                return;
+            }
+        }
+    }
+}
+}
+
+//------------------------------------------------------------------------------
+/**
+    The file is cut into a chunk per thread at line starts. The first pass
+    counts what each chunk holds, so the second one can parse every chunk
+    straight into its place in the buffers
+*/
+bool
+LoadObj(char const* path, std::vector<float>& positions, std::vector<unsigned>& indices)
+{
+    positions.clear();
+    indices.clear();
+    MappedFile file;
+    if (!file.Open(path))
+        return false;
+
+    char const* data = (char const*)file.Data();
+    size_t size = file.Size();
+    unsigned numChunks = (unsigned)std::min<size_t>(NumParallelThreads(), size / MinChunkSize + 1);
+    std::vector<Chunk> chunks(numChunks);
+    for (unsigned i = 0; i < numChunks; i++)
+    {
+        char const* begin = data + size * i / numChunks;
+        if (i > 0 && begin[-1] != '\n')
+            begin = NextLine(begin, data + size);
+        chunks[i].begin = begin;
+        if (i > 0)
+            chunks[i - 1].end = begin;
+    }
+    chunks[numChunks - 1].end = data + size;
+
+    ParallelRange(numChunks, numChunks, [&](unsigned begin, unsigned end, unsigned)
+    {
+        for (unsigned i = begin; i < end; i++)
+            CountChunk(chunks[i]);
+    });
+
+    unsigned long long vertexCount = 0;
+    unsigned long long triangleCount = 0;
+    for (Chunk& chunk : chunks)
+    {
+        chunk.firstVertex = (unsigned)vertexCount;
+        chunk.firstTriangle = (unsigned)triangleCount;
+        vertexCount += chunk.vertexCount;
+        triangleCount += chunk.triangleCount;
+    }
+    // indices are unsigned
+    if (vertexCount > 0xffffffffull || triangleCount * 3 > 0xffffffffull)
+        return false;
+
+    positions.resize(vertexCount * 3);
+    indices.resize(triangleCount * 3);
+    ParallelRange(numChunks, numChunks, [&](unsigned begin, unsigned end, unsigned)
+    {
+        for (unsigned i = begin; i < end; i++)
+            ParseChunk(chunks[i], (unsigned)vertexCount, positions.data(), indices.data());
+    });
+
+    for (Chunk const& chunk : chunks)
+    {
+        if (!chunk.valid)
+        {
+            positions.clear();
+            indices.clear();
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <vector>
+
+//------------------------------------------------------------------------------
+/**
+    Reads the triangles of a Wavefront OBJ file into the buffers of a
+    TriangleMesh, x, y and z of each vertex in positions and three vertex
+    indices per triangle in indices.
+
+    Only vertices and faces are read, every other statement is skipped, and
+    faces with more than three corners are split into fans. The file is
+    mapped into memory and parsed by all threads, each taking a range of
+    whole lines.
+
+    Returns false if the file can not be opened, or a face refers to a
+    vertex that is not in the file. The buffers are left empty then
+*/
+bool LoadObj(char const* path, std::vector<float>& positions, std::vector<unsigned>& indices);
@@ -0,0 +1,161 @@
+#pragma once
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+
+//------------------------------------------------------------------------------
+/**
+    Number of threads used by the parallel helpers
+*/
+inline unsigned
+NumParallelThreads()
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Split [0, count) into numChunks contiguous chunks and call
+    func(begin, end, chunk) for each of them on its own thread.
+    Chunk boundaries only depend on count and numChunks.
+*/
+template<class FUNC>
+inline void
+ParallelRange(unsigned count, unsigned numChunks, FUNC&& func)
+{
+    if (numChunks <= 1)
+    {
+        func(0u, count, 0u);
+        return;
+    }
+
+    auto chunkBegin = [count, numChunks](unsigned chunk)
+    {
+        return (unsigned)(((unsigned long long)count * chunk) / numChunks);
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(numChunks - 1);
+    for (unsigned chunk = 1; chunk < numChunks; chunk++)
+        threads.emplace_back([&func, &chunkBegin, chunk]() { func(chunkBegin(chunk), chunkBegin(chunk + 1), chunk); });
+
+    func(0u, chunkBegin(1), 0u);
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+//------------------------------------------------------------------------------
+/**
+    Call func(task) for every task in [0, numTasks), handing tasks out
+    to all threads on demand
+*/
+template<class FUNC>
+inline void
+ParallelTasks(unsigned numTasks, FUNC&& func)
+{
+    unsigned numThreads = std::min(NumParallelThreads(), numTasks);
+    std::atomic<unsigned> next(0);
+    ParallelRange(numThreads, numThreads, [&](unsigned, unsigned, unsigned)
+    {
+        unsigned task;
+        while ((task = next.fetch_add(1)) < numTasks)
+            func(task);
+    });
+}
+
+//------------------------------------------------------------------------------
+/**
+    Tasks [0, numTasks) split into one contiguous range per thread, for
+    ThreadPool::RunTasks. A thread takes tasks from the front of its own
+    range, and once that is empty steals the back half of the range of
+    another thread. Begin and end of a range are one atomic word, so taking
+    and stealing are a compare and swap each, and a task is never handed
+    out twice.
+*/
+class TaskRanges
+{
+public:
+    TaskRanges() = default;
+
+    // split numTasks tasks over numThreads threads again. Callers that hand out
+    // tasks every frame keep one around, so that this does not allocate once grown
+    void Reset(unsigned numTasks, unsigned numThreads)
+    {
+        if (numThreads > this->capacity)
+        {
+            this->ranges.reset(new Range[numThreads]);
+            this->capacity = numThreads;
+        }
+        this->numThreads = numThreads;
+        this->steals.store(0, std::memory_order_relaxed);
+        for (unsigned t = 0; t < numThreads; t++)
+        {
+            unsigned begin = (unsigned)(((unsigned long long)numTasks * t) / numThreads);
+            unsigned end = (unsigned)(((unsigned long long)numTasks * (t + 1)) / numThreads);
+            this->ranges[t].bounds.store(Pack(begin, end), std::memory_order_relaxed);
+        }
+    }
+
+    // take the next task of the range of thread, false if it is empty
+    bool Pop(unsigned thread, unsigned& task)
+    {
+        std::atomic<unsigned long long>& bounds = this->ranges[thread].bounds;
+        unsigned long long b = bounds.load(std::memory_order_acquire);
+        while (Begin(b) < End(b))
+        {
+            if (bounds.compare_exchange_weak(b, Pack(Begin(b) + 1, End(b)), std::memory_order_acq_rel))
+            {
+                task = Begin(b);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // move the back half of the range of another thread into the empty range of thread.
+    // Victims are tried in order after thread, false if all ranges were found empty
+    bool Steal(unsigned thread)
+    {
+        for (unsigned i = 1; i < this->numThreads; i++)
+        {
+            unsigned victim = (thread + i) % this->numThreads;
+            std::atomic<unsigned long long>& bounds = this->ranges[victim].bounds;
+            unsigned long long b = bounds.load(std::memory_order_acquire);
+            while (Begin(b) < End(b))
+            {
+                unsigned take = (End(b) - Begin(b) + 1) / 2;
+                unsigned split = End(b) - take;
+                if (bounds.compare_exchange_weak(b, Pack(Begin(b), split), std::memory_order_acq_rel))
+                {
+                    // nobody else writes an empty range, thieves skip it
+                    this->ranges[thread].bounds.store(Pack(split, split + take), std::memory_order_release);
+                    this->steals.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // successful steals so far
+    unsigned Steals() const { return this->steals.load(std::memory_order_relaxed); }
+
+private:
+    static unsigned long long Pack(unsigned begin, unsigned end) { return ((unsigned long long)end << 32) | begin; }
+    static unsigned Begin(unsigned long long bounds) { return (unsigned)bounds; }
+    static unsigned End(unsigned long long bounds) { return (unsigned)(bounds >> 32); }
+
+    // a cache line each, the owner and thieves of one range do not slow down the others
+    struct alignas(64) Range
+    {
+        std::atomic<unsigned long long> bounds;
+    };
+    unsigned numThreads = 0;
+    // ranges allocated
+    unsigned capacity = 0;
+    std::unique_ptr<Range[]> ranges;
+    std::atomic<unsigned> steals{ 0 };
+};
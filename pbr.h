@@ -1,15 +1,22 @@
 #pragma once
 #include "vec3.h"
 #include "mat4.h"
+#include "ray.h"
+#include "material.h"
+#include "random.h"
 #include <math.h>
 
+// the BSDF kernels are compiled per instruction set, see simd.h
+namespace TRAYRACER_ISA
+{
+
 //------------------------------------------------------------------------------
 /**
 */
 inline float
 FresnelSchlick(float cosTheta, float F0, float roughness)
 {
-    return F0 + (fmax(1.0f - roughness, F0) - F0) * pow(2, ((-5.55473f*cosTheta - 6.98316f) * cosTheta));
+    return F0 + (fmaxf(1.0f - roughness, F0) - F0) * pow(2.0, (double)((-5.55473f*cosTheta - 6.98316f) * cosTheta));
 }
 
 //------------------------------------------------------------------------------
@@ -29,10 +36,10 @@ ImportanceSampleGGX_VNDF(float u1, float u2, float roughness, vec3 const& V, mat
     vec3 T1 = lensq > 0.0f ? vec3(-Vh.y, Vh.x, 0.0f) * (1 / sqrtf(lensq)) : vec3(1.0f, 0.0f, 0.0f);
     vec3 T2 = cross(Vh, T1);
 
-    float r = sqrt(u1);
+    float r = sqrtf(u1);
     float phi = 2.0f * MPI * u2;
-    float t1 = r * cos(phi);
-    float t2 = r * sin(phi);
+    float t1 = r * cosf(phi);
+    float t2 = r * sinf(phi);
     float s = 0.5 * (1.0 + Vh.z);
     float t1sq = (t1 * t1);
     t2 = (1.0 - s) * sqrtf(1.0 - t1sq) + s * t2;
@@ -57,9 +64,109 @@ Refract(vec3 v, vec3 n, float niOverNt, vec3& refracted)
     float discriminant = 1.0f - niOverNt * niOverNt * (1.0f - dt * dt);
     if (discriminant > 0)
     {
-        refracted = ((uv - n * dt) * niOverNt) - (n * sqrt(discriminant));
+        refracted = ((uv - n * dt) * niOverNt) - (n * sqrtf(discriminant));
         return true;
     }
 
     return false;
-}
\ No newline at end of file
+}
+
+//------------------------------------------------------------------------------
+/**
+    Lambertian and conductor materials reflect off a microfacet with
+    probability F, using F0 0.04 and 0.95, or scatter diffusely
+*/
+inline Ray
+ScatterMicrofacet(Material const* const material, float F0, Ray ray, vec3 point, vec3 normal, RandomStream& random)
+{
+    float cosTheta = -dot(normalize(ray.m), normalize(normal));
+
+    // probability that a ray will reflect on a microfacet
+    float F = FresnelSchlick(cosTheta, F0, material->roughness);
+
+    float r = random.Next();
+
+    if (r < F)
+    {
+        mat4 basis = TBN(normal);
+        // importance sample with brdf specular lobe
+        vec3 H = ImportanceSampleGGX_VNDF(random.Next(), random.Next(), material->roughness, ray.m, basis);
+        vec3 reflected = reflect(ray.m, H);
+        return { point, normalize(reflected) };
+    }
+    else
+    {
+        return { point, normalize(normalize(normal) + random_point_on_unit_sphere(random)) };
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Dielectric materials reflect or refract
+*/
+inline Ray
+ScatterDielectric(Material const* const material, Ray ray, vec3 point, vec3 normal, RandomStream& random)
+{
+    float cosTheta = -dot(normalize(ray.m), normalize(normal));
+
+    vec3 outwardNormal;
+    float niOverNt;
+    vec3 refracted;
+    float reflect_prob;
+    float cosine;
+    vec3 rayDir = ray.m;
+
+    if (cosTheta <= 0)
+    {
+        outwardNormal = -normal;
+        niOverNt = material->refractionIndex;
+        cosine = cosTheta * niOverNt / len(rayDir);
+    }
+    else
+    {
+        outwardNormal = normal;
+        niOverNt = 1.0 / material->refractionIndex;
+        cosine = cosTheta / len(rayDir);
+    }
+
+    if (Refract(normalize(rayDir), outwardNormal, niOverNt, refracted))
+    {
+        // fresnel reflectance at 0 deg incidence angle
+        float F0 = powf(material->refractionIndex - 1, 2) / powf(material->refractionIndex + 1, 2);
+        reflect_prob = FresnelSchlick(cosine, F0, material->roughness);
+    }
+    else
+    {
+        reflect_prob = 1.0;
+    }
+    if (random.Next() < reflect_prob)
+    {
+        vec3 reflected = reflect(rayDir, normal);
+        return { point, reflected };
+    }
+    else
+    {
+        return { point, refracted };
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Scatter ray against material
+*/
+inline Ray
+BSDF(Material const* const material, Ray ray, vec3 point, vec3 normal, RandomStream& random)
+{
+    switch (GetMaterialType(material))
+    {
+    case MaterialType::Dielectric:
+        return ScatterDielectric(material, ray, point, normal, random);
+    case MaterialType::Conductor:
+        return ScatterMicrofacet(material, 0.95f, ray, point, normal, random);
+    default:
+        return ScatterMicrofacet(material, 0.04f, ray, point, normal, random);
+    }
+}
+
+} // namespace TRAYRACER_ISA
+using namespace TRAYRACER_ISA;
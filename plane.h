@@ -0,0 +1,94 @@
+#pragma once
+#include "object.h"
+#include "ray.h"
+#include "material.h"
+#include "pbr.h"
+
+// compiled per instruction set, see simd.h
+namespace TRAYRACER_ISA
+{
+
+//------------------------------------------------------------------------------
+/**
+    Distance t along ray to the plane of points p with dot(normal, p) == offset.
+    Returns false if it is not within (0.001, maxDist), parallel rays never hit
+*/
+inline bool
+IntersectPlane(vec3 const& normal, float offset, Ray const& ray, float maxDist, float& t)
+{
+    float denom = dot(normal, ray.m);
+    if (denom == 0.0f)
+        return false;
+
+    constexpr float minDist = 0.001f;
+    t = (offset - dot(normal, ray.b)) / denom;
+    return t < maxDist && t > minDist;
+}
+
+} // namespace TRAYRACER_ISA
+using namespace TRAYRACER_ISA;
+
+//------------------------------------------------------------------------------
+/**
+    An infinite plane, the points p with dot(normal, p) == offset.
+    It has no bounds, so the raytracer keeps it out of the acceleration
+    structures and tests it once per ray.
+*/
+class Plane : public Object
+{
+public:
+    vec3 normal;
+    float offset;
+    // index of the material, see AddMaterial
+    unsigned material;
+
+    // normal points to the front side and has to be unit length
+    Plane(vec3 normal, float offset, unsigned material) :
+        normal(normal),
+        offset(offset),
+        material(material)
+    {
+
+    }
+
+    ~Plane() override
+    {
+
+    }
+
+    Color GetColor()
+    {
+        return LookupMaterial(this->material)->color;
+    }
+
+    Material const* GetMaterial() override
+    {
+        return LookupMaterial(this->material);
+    }
+
+    bool Intersect(Ray const& ray, float maxDist, HitResult& hit) override
+    {
+        float t;
+        if (!IntersectPlane(this->normal, this->offset, ray, maxDist, t))
+            return false;
+
+        hit.p = ray.PointAt(t);
+        // like the sphere, the normal points out of the solid behind the plane
+        hit.normal = this->normal;
+        hit.t = t;
+        hit.object = this;
+        return true;
+    }
+
+    bool Occluded(Ray const& ray, float maxDist) override
+    {
+        float t;
+        return IntersectPlane(this->normal, this->offset, ray, maxDist, t);
+    }
+
+    Ray ScatterRay(Ray ray, vec3 point, vec3 normal, RandomStream& random) override
+    {
+        return BSDF(LookupMaterial(this->material), ray, point, normal, random);
+    }
+
+};
@@ -0,0 +1,506 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <tuple>
+#include <utility>
+#include "object.h"
+#include "plane.h"
+#include "spheresoa.h"
+#include "trianglemesh.h"
+#include "simd.h"
+
+// the prepared rays are compiled per instruction set, see simd.h. They are
+// part of the signatures of the intersection functions, so those get one
+// instance per instruction set as well
+namespace TRAYRACER_ISA
+{
+
+//------------------------------------------------------------------------------
+/**
+    Prepared ray of arrays that test the ray as it is
+*/
+struct NoRayPreparation
+{
+    NoRayPreparation(Ray const& ray) { }
+    NoRayPreparation(Ray const* rays, unsigned count) { }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Packet test for arrays without a kernel of their own, every lane of mask
+    on its own
+*/
+template<typename ARRAY>
+inline unsigned
+IntersectLanes(ARRAY const& array, Ray const* rays, unsigned mask, unsigned first, unsigned count, float* tMax, HitResult* hits)
+{
+    unsigned found = 0;
+    for (; mask != 0; mask &= mask - 1)
+    {
+        unsigned lane = FirstLane(mask);
+        if (array.Intersect(rays[lane], typename ARRAY::PreparedRay(rays[lane]), first, count, hits[lane]))
+        {
+            tMax[lane] = hits[lane].t;
+            found |= 1u << lane;
+        }
+    }
+    return found;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The prepared rays of all arrays of a PrimitiveStore
+*/
+template<typename... ARRAYS>
+struct PreparedRays
+{
+    std::tuple<typename ARRAYS::PreparedRay...> rays;
+    PreparedRays(Ray const& ray) : rays(typename ARRAYS::PreparedRay(ray)...) { }
+};
+
+//------------------------------------------------------------------------------
+/**
+    The prepared packets of N rays of all arrays of a PrimitiveStore
+*/
+template<unsigned N, typename... ARRAYS>
+struct PreparedPackets
+{
+    std::tuple<typename ARRAYS::template PreparedPacket<N>...> packets;
+    PreparedPackets(Ray const* rays) : packets(typename ARRAYS::template PreparedPacket<N>(rays, N)...) { }
+};
+
+} // namespace TRAYRACER_ISA
+using namespace TRAYRACER_ISA;
+
+//------------------------------------------------------------------------------
+/**
+    Planes, copied into one contiguous array
+*/
+class PlaneArray
+{
+public:
+    using PreparedRay = NoRayPreparation;
+    template<unsigned N>
+    using PreparedPacket = NoRayPreparation;
+
+    void Clear() { this->slots.clear(); }
+    bool Add(Object* object)
+    {
+        Plane* plane = dynamic_cast<Plane*>(object);
+        if (plane == nullptr)
+            return false;
+        this->slots.push_back({ plane->normal, plane->offset, plane });
+        return true;
+    }
+    void Finish() { }
+    SIMD_INLINE unsigned Count() const { return (unsigned)this->slots.size(); }
+
+    bool Intersect(Ray const& ray, PreparedRay const&, unsigned first, unsigned count, HitResult& hit) const
+    {
+        bool isHit = false;
+        for (unsigned i = first; i < first + count; i++)
+        {
+            Slot const& slot = this->slots[i];
+            float t;
+            if (IntersectPlane(slot.normal, slot.offset, ray, hit.t, t))
+            {
+                hit.p = ray.PointAt(t);
+                hit.normal = slot.normal;
+                hit.t = t;
+                hit.object = slot.plane;
+                isHit = true;
+            }
+        }
+        return isHit;
+    }
+
+    bool Occluded(Ray const& ray, PreparedRay const&, unsigned first, unsigned count, float tMax) const
+    {
+        for (unsigned i = first; i < first + count; i++)
+        {
+            float t;
+            if (IntersectPlane(this->slots[i].normal, this->slots[i].offset, ray, tMax, t))
+                return true;
+        }
+        return false;
+    }
+
+    template<unsigned N>
+    unsigned IntersectPacket(Ray const* rays, PreparedPacket<N> const&, unsigned mask, unsigned first, unsigned count, float* tMax, HitResult* hits) const
+    {
+        return IntersectLanes(*this, rays, mask, first, count, tMax, hits);
+    }
+
+    size_t MemoryUsage() const { return this->slots.size() * sizeof(Slot); }
+    template<class FUNC>
+    void ForEachBuffer(FUNC&& func) const { func(this->slots.data(), this->slots.size() * sizeof(Slot)); }
+
+private:
+    struct Slot
+    {
+        vec3 normal;
+        float offset;
+        // reported as the hit object
+        Plane* plane;
+    };
+    std::vector<Slot> slots;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Triangle meshes, each through its own bvh with the kernels of the
+    instruction set of the store
+*/
+class MeshArray
+{
+public:
+    using PreparedRay = TriangleRay;
+    template<unsigned N>
+    using PreparedPacket = NoRayPreparation;
+
+    void Clear() { this->meshes.clear(); }
+    bool Add(Object* object)
+    {
+        TriangleMesh* mesh = dynamic_cast<TriangleMesh*>(object);
+        if (mesh == nullptr)
+            return false;
+        this->meshes.push_back(mesh);
+        return true;
+    }
+    void Finish() { }
+    SIMD_INLINE unsigned Count() const { return (unsigned)this->meshes.size(); }
+
+    bool Intersect(Ray const& ray, PreparedRay const& prepared, unsigned first, unsigned count, HitResult& hit) const
+    {
+        bool isHit = false;
+        for (unsigned i = first; i < first + count; i++)
+        {
+            if (this->meshes[i]->IntersectTriangles(ray, prepared, hit.t, hit))
+                isHit = true;
+        }
+        return isHit;
+    }
+
+    bool Occluded(Ray const& ray, PreparedRay const& prepared, unsigned first, unsigned count, float tMax) const
+    {
+        for (unsigned i = first; i < first + count; i++)
+        {
+            if (this->meshes[i]->OccludedTriangles(ray, prepared, tMax))
+                return true;
+        }
+        return false;
+    }
+
+    template<unsigned N>
+    unsigned IntersectPacket(Ray const* rays, PreparedPacket<N> const&, unsigned mask, unsigned first, unsigned count, float* tMax, HitResult* hits) const
+    {
+        return IntersectLanes(*this, rays, mask, first, count, tMax, hits);
+    }
+
+    size_t MemoryUsage() const { return this->meshes.size() * sizeof(TriangleMesh*); }
+    template<class FUNC>
+    void ForEachBuffer(FUNC&& func) const
+    {
+        func(this->meshes.data(), this->meshes.size() * sizeof(TriangleMesh*));
+        for (TriangleMesh const* mesh : this->meshes)
+            mesh->ForEachBuffer(func);
+    }
+
+private:
+    std::vector<TriangleMesh*> meshes;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Objects of any type, through their virtual Object::Intersect. Takes every
+    object it is offered, so it goes last in a PrimitiveStore and keeps the
+    types without an array of their own working, instances among them
+*/
+class ObjectArray
+{
+public:
+    using PreparedRay = NoRayPreparation;
+    template<unsigned N>
+    using PreparedPacket = NoRayPreparation;
+
+    void Clear() { this->objects.clear(); }
+    bool Add(Object* object)
+    {
+        this->objects.push_back(object);
+        return true;
+    }
+    void Finish() { }
+    SIMD_INLINE unsigned Count() const { return (unsigned)this->objects.size(); }
+
+    bool Intersect(Ray const& ray, PreparedRay const&, unsigned first, unsigned count, HitResult& hit) const
+    {
+        bool isHit = false;
+        for (unsigned i = first; i < first + count; i++)
+        {
+            if (this->objects[i]->Intersect(ray, hit.t, hit))
+                isHit = true;
+        }
+        return isHit;
+    }
+
+    bool Occluded(Ray const& ray, PreparedRay const&, unsigned first, unsigned count, float tMax) const
+    {
+        for (unsigned i = first; i < first + count; i++)
+        {
+            if (this->objects[i]->Occluded(ray, tMax))
+                return true;
+        }
+        return false;
+    }
+
+    template<unsigned N>
+    unsigned IntersectPacket(Ray const* rays, PreparedPacket<N> const&, unsigned mask, unsigned first, unsigned count, float* tMax, HitResult* hits) const
+    {
+        return IntersectLanes(*this, rays, mask, first, count, tMax, hits);
+    }
+
+    size_t MemoryUsage() const { return this->objects.size() * sizeof(Object*); }
+    template<class FUNC>
+    void ForEachBuffer(FUNC&& func) const { func(this->objects.data(), this->objects.size() * sizeof(Object*)); }
+
+private:
+    std::vector<Object*> objects;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Objects sorted by type into one array per type, each with its own
+    intersection loop. The arrays are part of the type, so the loops are
+    called directly and inlined into the traversal, no virtual call per
+    object and ray.
+
+    Objects are numbered by slots, in the order they are given, usually the
+    primitive order of a tree. Every array keeps its objects in slot order,
+    so the objects of a leaf are one contiguous range in each array, found
+    through the number of objects each array holds before a slot.
+
+    An array is a class with
+
+        PreparedRay             constructed from a Ray once per query
+        PreparedPacket<N>       constructed from N rays once per packet
+        Clear()
+        bool Add(Object*)       appends the object if it is of the type
+        Finish()                after the last Add
+        unsigned Count()
+        bool Intersect(ray, prepared, first, count, hit)
+                                closest hit in [first, first + count) before hit.t
+        bool Occluded(ray, prepared, first, count, tMax)
+        unsigned IntersectPacket<N>(rays, prepared, mask, first, count, tMax, hits)
+                                closest hits of the lanes of mask, tMax[lane] is hits[lane].t
+                                and both are updated, returns the lanes that hit
+        size_t MemoryUsage()
+        ForEachBuffer(func)     calls func(data, bytes) for each of its arrays
+
+    Objects go to the first array that takes them. New primitive types get
+    their array added to the list of ScenePrimitives, before ObjectArray,
+    which takes the rest.
+*/
+template<typename... ARRAYS>
+class PrimitiveStore
+{
+public:
+    static constexpr unsigned NumArrays = sizeof...(ARRAYS);
+
+    // the prepared rays of all arrays
+    using PreparedRay = PreparedRays<ARRAYS...>;
+    template<unsigned N>
+    using PreparedPacket = PreparedPackets<N, ARRAYS...>;
+
+    // fill the slots with objects[order[i]], or objects[i] if order is null.
+    // Build again after objects have moved
+    void Build(std::vector<Object*> const& objects, unsigned const* order, unsigned count);
+    void Clear() { this->Build({}, nullptr, 0); }
+
+    // number of slots
+    SIMD_INLINE unsigned Count() const { return this->count; }
+
+    // closest hit in slots [first, first + count) before hit.t, fills hit
+    bool Intersect(Ray const& ray, PreparedRay const& prepared, unsigned first, unsigned count, HitResult& hit) const;
+    // true if anything in slots [first, first + count) is hit before tMax
+    bool Occluded(Ray const& ray, PreparedRay const& prepared, unsigned first, unsigned count, float tMax) const;
+    // closest hits of the lanes of mask in slots [first, first + count). tMax[lane] is hits[lane].t,
+    // both are updated for the lanes that hit, and those are returned
+    template<unsigned N>
+    unsigned IntersectPacket(Ray const* rays, PreparedPacket<N> const& prepared, unsigned mask, unsigned first, unsigned count, float* tMax, HitResult* hits) const;
+
+    // bytes used by the arrays and the slot ranges
+    size_t MemoryUsage() const;
+    // calls func(data, bytes) for the same memory
+    template<class FUNC>
+    void ForEachBuffer(FUNC&& func) const
+    {
+        func(this->starts.data(), this->starts.size() * sizeof(this->starts[0]));
+        ForEach([&](auto i) { std::get<i>(this->arrays).ForEachBuffer(func); });
+    }
+
+private:
+    // calls func with std::integral_constant of every array index
+    template<typename FUNC>
+    static void ForEach(FUNC&& func) { ForEach(func, std::index_sequence_for<ARRAYS...>()); }
+    template<typename FUNC, size_t... I>
+    static void ForEach(FUNC& func, std::index_sequence<I...>) { (func(std::integral_constant<size_t, I>()), ...); }
+    // same, until func returns true
+    template<typename FUNC>
+    static bool Any(FUNC&& func) { return Any(func, std::index_sequence_for<ARRAYS...>()); }
+    template<typename FUNC, size_t... I>
+    static bool Any(FUNC& func, std::index_sequence<I...>) { return (func(std::integral_constant<size_t, I>()) || ...); }
+
+    std::tuple<ARRAYS...> arrays;
+    // objects each array holds before a slot, one entry per slot and one past the last.
+    // Empty while one array holds every slot
+    std::vector<std::array<unsigned, NumArrays>> starts;
+    // index of the array that holds every slot, or NumArrays for mixed stores.
+    // Its slots are the store slots, so the lookups in starts are skipped
+    unsigned onlyArray = NumArrays;
+    unsigned count = 0;
+};
+
+// the arrays of the raytracer and instance groups
+using ScenePrimitives = PrimitiveStore<SphereSoA, PlaneArray, MeshArray, ObjectArray>;
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename... ARRAYS>
+inline void
+PrimitiveStore<ARRAYS...>::Build(std::vector<Object*> const& objects, unsigned const* order, unsigned count)
+{
+    ForEach([this](auto i) { std::get<i>(this->arrays).Clear(); });
+    this->starts.clear();
+    this->starts.shrink_to_fit();
+    this->count = count;
+
+    // the slot ranges are only filled in once a second array takes an object, until
+    // then the slots of the first array are the store slots
+    std::array<unsigned, NumArrays> counts = {};
+    unsigned firstArray = NumArrays;
+    for (unsigned slot = 0; slot < count; slot++)
+    {
+        Object* object = objects[order != nullptr ? order[slot] : slot];
+        unsigned array = NumArrays;
+        Any([&](auto i)
+        {
+            if (!std::get<i>(this->arrays).Add(object))
+                return false;
+            array = i;
+            return true;
+        });
+
+        if (slot == 0)
+            firstArray = array;
+        if (this->starts.empty() && (array != firstArray || array == NumArrays))
+        {
+            this->starts.resize(count + 1);
+            for (unsigned s = 0; s < slot; s++)
+            {
+                this->starts[s] = {};
+                if (firstArray != NumArrays)
+                    this->starts[s][firstArray] = s;
+            }
+        }
+        if (!this->starts.empty())
+            this->starts[slot] = counts;
+        if (array != NumArrays)
+            counts[array]++;
+    }
+    if (!this->starts.empty())
+        this->starts[count] = counts;
+    // an empty store keeps the entry past the last slot, its queries look it up
+    if (count == 0)
+        this->starts.assign(1, counts);
+    this->onlyArray = count > 0 && this->starts.empty() ? firstArray : NumArrays;
+
+    ForEach([this](auto i) { std::get<i>(this->arrays).Finish(); });
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename... ARRAYS>
+inline bool
+PrimitiveStore<ARRAYS...>::Intersect(Ray const& ray, PreparedRay const& prepared, unsigned first, unsigned count, HitResult& hit) const
+{
+    if (this->onlyArray != NumArrays)
+    {
+        return Any([&](auto i)
+        {
+            return i == this->onlyArray && std::get<i>(this->arrays).Intersect(ray, std::get<i>(prepared.rays), first, count, hit);
+        });
+    }
+    std::array<unsigned, NumArrays> const& begin = this->starts[first];
+    std::array<unsigned, NumArrays> const& end = this->starts[first + count];
+    bool isHit = false;
+    ForEach([&](auto i)
+    {
+        if (begin[i] != end[i] && std::get<i>(this->arrays).Intersect(ray, std::get<i>(prepared.rays), begin[i], end[i] - begin[i], hit))
+            isHit = true;
+    });
+    return isHit;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename... ARRAYS>
+inline bool
+PrimitiveStore<ARRAYS...>::Occluded(Ray const& ray, PreparedRay const& prepared, unsigned first, unsigned count, float tMax) const
+{
+    if (this->onlyArray != NumArrays)
+    {
+        return Any([&](auto i)
+        {
+            return i == this->onlyArray && std::get<i>(this->arrays).Occluded(ray, std::get<i>(prepared.rays), first, count, tMax);
+        });
+    }
+    std::array<unsigned, NumArrays> const& begin = this->starts[first];
+    std::array<unsigned, NumArrays> const& end = this->starts[first + count];
+    return Any([&](auto i)
+    {
+        return begin[i] != end[i] && std::get<i>(this->arrays).Occluded(ray, std::get<i>(prepared.rays), begin[i], end[i] - begin[i], tMax);
+    });
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename... ARRAYS>
+template<unsigned N>
+inline unsigned
+PrimitiveStore<ARRAYS...>::IntersectPacket(Ray const* rays, PreparedPacket<N> const& prepared, unsigned mask, unsigned first, unsigned count, float* tMax, HitResult* hits) const
+{
+    unsigned found = 0;
+    if (this->onlyArray != NumArrays)
+    {
+        ForEach([&](auto i)
+        {
+            if (i == this->onlyArray)
+                found = std::get<i>(this->arrays).template IntersectPacket<N>(rays, std::get<i>(prepared.packets), mask, first, count, tMax, hits);
+        });
+        return found;
+    }
+    std::array<unsigned, NumArrays> const& begin = this->starts[first];
+    std::array<unsigned, NumArrays> const& end = this->starts[first + count];
+    ForEach([&](auto i)
+    {
+        if (begin[i] != end[i])
+            found |= std::get<i>(this->arrays).template IntersectPacket<N>(rays, std::get<i>(prepared.packets), mask, begin[i], end[i] - begin[i], tMax, hits);
+    });
+    return found;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<typename... ARRAYS>
+inline size_t
+PrimitiveStore<ARRAYS...>::MemoryUsage() const
+{
+    size_t bytes = this->starts.size() * sizeof(this->starts[0]);
+    ForEach([&](auto i) { bytes += std::get<i>(this->arrays).MemoryUsage(); });
+    return bytes;
+}
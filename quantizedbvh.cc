@@ -0,0 +1,305 @@
+#include "quantizedbvh.h"
+#include <assert.h>
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<unsigned WIDTH>
+void
+QuantizedBVH<WIDTH>::Build(BVH const& bvh)
+{
+    this->attachedNodes = nullptr;
+    this->attachedPrims = nullptr;
+    this->nodes.clear();
+    this->primIndices.clear();
+    this->uncompressedMemoryUsage = 0;
+    if (bvh.nodes.empty())
+        return;
+
+    WideBVH<WIDTH> wide;
+    wide.Build(bvh);
+    this->uncompressedMemoryUsage = wide.nodes.size() * sizeof(WideBVHNode<WIDTH>) + wide.primIndices.size() * sizeof(unsigned);
+
+    this->nodes.reserve(wide.nodes.size());
+    this->primIndices.reserve(wide.primIndices.size());
+    this->nodes.emplace_back();
+    this->Quantize(wide, 0, 0);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<unsigned WIDTH>
+size_t
+QuantizedBVH<WIDTH>::MemoryUsage() const
+{
+    return this->NodeCount() * sizeof(QuantizedBVHNode<WIDTH>) + this->PrimCount() * sizeof(unsigned);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<unsigned WIDTH>
+bool
+QuantizedBVH<WIDTH>::Validate(unsigned numObjects) const
+{
+    QuantizedBVHNode<WIDTH> const* nodes = this->NodeData();
+    unsigned const* prims = this->PrimData();
+    unsigned nodeCount = this->NodeCount();
+    unsigned primCount = this->PrimCount();
+    for (unsigned i = 0; i < primCount; i++)
+    {
+        if (prims[i] >= numObjects)
+            return false;
+    }
+
+    std::vector<unsigned char> depth(nodeCount, 0);
+    for (unsigned i = 0; i < nodeCount; i++)
+    {
+        QuantizedBVHNode<WIDTH> const& node = nodes[i];
+        unsigned childIndex[WIDTH];
+        node.ChildIndices(childIndex);
+        for (unsigned s = 0; s < WIDTH; s++)
+        {
+            if ((node.validMask & (1 << s)) == 0)
+                continue;
+            unsigned child = childIndex[s];
+            if (node.count[s] > 0)
+            {
+                if ((unsigned long long)child + node.count[s] > primCount)
+                    return false;
+            }
+            else
+            {
+                if (child <= i || child >= nodeCount || depth[i] >= BVH::MaxDepth)
+                    return false;
+                depth[child] = depth[i] + 1;
+            }
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Smallest exponent so that a 255 cell grid starting at lo reaches hi
+*/
+static signed char
+GridExponent(float lo, float hi)
+{
+    float extent = hi - lo;
+    int exponent = -126;
+    if (extent > 0.0f)
+    {
+        frexpf(extent / 255.0f, &exponent);
+        exponent = exponent < -126 ? -126 : exponent;
+    }
+    while (lo + 255.0f * ldexpf(1.0f, exponent) < hi)
+        exponent++;
+    assert(exponent <= 127);
+    return (signed char)exponent;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Quantize lo/hi to grid cells so that the decoded box always contains them
+*/
+static void
+QuantizeRange(float origin, float scale, float lo, float hi, unsigned char& qLo, unsigned char& qHi)
+{
+    float l = floorf((lo - origin) / scale);
+    float h = ceilf((hi - origin) / scale);
+    int ql = l < 0.0f ? 0 : (l > 255.0f ? 255 : (int)l);
+    int qh = h < 0.0f ? 0 : (h > 255.0f ? 255 : (int)h);
+    while (ql > 0 && origin + ql * scale > lo)
+        ql--;
+    while (qh < 255 && origin + qh * scale < hi)
+        qh++;
+    assert(origin + ql * scale <= lo && origin + qh * scale >= hi);
+    qLo = (unsigned char)ql;
+    qHi = (unsigned char)qh;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<unsigned WIDTH>
+void
+QuantizedBVH<WIDTH>::Quantize(WideBVH<WIDTH> const& wide, unsigned wideIndex, unsigned index)
+{
+    WideBVHNode<WIDTH> const& src = wide.nodes[wideIndex];
+    QuantizedBVHNode<WIDTH> node;
+    memset(&node, 0, sizeof(node));
+
+    // grid covers the union of all children
+    float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    float center[WIDTH][3];
+    unsigned numChildren = 0;
+    for (unsigned c = 0; c < WIDTH; c++)
+    {
+        // unused slots have infinite bounds
+        if (isinf(src.minX[c]))
+            continue;
+        numChildren++;
+        lo[0] = fminf(lo[0], src.minX[c]);
+        lo[1] = fminf(lo[1], src.minY[c]);
+        lo[2] = fminf(lo[2], src.minZ[c]);
+        hi[0] = fmaxf(hi[0], src.maxX[c]);
+        hi[1] = fmaxf(hi[1], src.maxY[c]);
+        hi[2] = fmaxf(hi[2], src.maxZ[c]);
+        center[c][0] = (src.minX[c] + src.maxX[c]) * 0.5f;
+        center[c][1] = (src.minY[c] + src.maxY[c]) * 0.5f;
+        center[c][2] = (src.minZ[c] + src.maxZ[c]) * 0.5f;
+    }
+
+    float scale[3];
+    for (int a = 0; a < 3; a++)
+    {
+        node.origin[a] = lo[a];
+        node.exponent[a] = GridExponent(lo[a], hi[a]);
+        scale[a] = node.Scale(a);
+    }
+
+    // place the children so that each slot bit is set for those on the high side of its
+    // axis, taking the child and slot that fit best first
+    unsigned slotChild[WIDTH];
+    bool placed[WIDTH] = {};
+    for (unsigned s = 0; s < WIDTH; s++)
+        slotChild[s] = ~0u;
+    for (unsigned n = 0; n < numChildren; n++)
+    {
+        float best = 0.0f;
+        unsigned bestChild = ~0u;
+        unsigned bestSlot = 0;
+        for (unsigned c = 0; c < WIDTH; c++)
+        {
+            if (placed[c] || isinf(src.minX[c]))
+                continue;
+            for (unsigned s = 0; s < WIDTH; s++)
+            {
+                if (slotChild[s] != ~0u)
+                    continue;
+                float fit = 0.0f;
+                for (unsigned bit = 0; bit < QuantizedBVHNode<WIDTH>::SlotBits; bit++)
+                {
+                    unsigned axis = node.SlotAxis(bit);
+                    float side = center[c][axis] - (lo[axis] + hi[axis]) * 0.5f;
+                    fit += (s & (1 << bit)) ? side : -side;
+                }
+                if (bestChild == ~0u || fit > best)
+                {
+                    best = fit;
+                    bestChild = c;
+                    bestSlot = s;
+                }
+            }
+        }
+        placed[bestChild] = true;
+        slotChild[bestSlot] = bestChild;
+    }
+
+    // interior children are stored together, leaf primitives as well
+    node.childBase = (unsigned)this->nodes.size();
+    node.primBase = (unsigned)this->primIndices.size();
+    unsigned numInterior = 0;
+    for (unsigned s = 0; s < WIDTH; s++)
+    {
+        unsigned c = slotChild[s];
+        if (c == ~0u)
+            continue;
+
+        node.validMask |= 1 << s;
+        QuantizeRange(node.origin[0], scale[0], src.minX[c], src.maxX[c], node.qMinX[s], node.qMaxX[s]);
+        QuantizeRange(node.origin[1], scale[1], src.minY[c], src.maxY[c], node.qMinY[s], node.qMaxY[s]);
+        QuantizeRange(node.origin[2], scale[2], src.minZ[c], src.maxZ[c], node.qMinZ[s], node.qMaxZ[s]);
+
+        node.count[s] = src.count[c];
+        if (src.count[c] > 0)
+        {
+            for (unsigned p = 0; p < src.count[c]; p++)
+                this->primIndices.push_back(wide.primIndices[src.child[c] + p]);
+        }
+        else
+        {
+            numInterior++;
+        }
+    }
+
+    this->nodes[index] = node;
+    this->nodes.resize(this->nodes.size() + numInterior);
+
+    unsigned childIndex[WIDTH];
+    node.ChildIndices(childIndex);
+    for (unsigned s = 0; s < WIDTH; s++)
+    {
+        if ((node.validMask & (1 << s)) && node.count[s] == 0)
+            this->Quantize(wide, src.child[slotChild[s]], childIndex[s]);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Children come after their parents, so walking the nodes backwards has the
+    full precision bounds of every child ready before its parent is quantized
+*/
+template<unsigned WIDTH>
+void
+QuantizedBVH<WIDTH>::Refit(std::vector<BBox> const& primBounds)
+{
+    if (this->IsAttached())
+    {
+        this->nodes.assign(this->attachedNodes, this->attachedNodes + this->attachedNodeCount);
+        this->primIndices.assign(this->attachedPrims, this->attachedPrims + this->attachedPrimCount);
+        this->attachedNodes = nullptr;
+        this->attachedPrims = nullptr;
+    }
+    assert(primBounds.size() == this->primIndices.size());
+
+    std::vector<BBox> nodeBounds(this->nodes.size());
+    for (unsigned i = (unsigned)this->nodes.size(); i-- > 0;)
+    {
+        QuantizedBVHNode<WIDTH>& node = this->nodes[i];
+        unsigned childIndex[WIDTH];
+        node.ChildIndices(childIndex);
+
+        BBox slotBounds[WIDTH];
+        BBox bounds;
+        for (unsigned s = 0; s < WIDTH; s++)
+        {
+            if ((node.validMask & (1 << s)) == 0)
+                continue;
+            if (node.count[s] > 0)
+            {
+                for (unsigned p = 0; p < node.count[s]; p++)
+                    slotBounds[s].Grow(BVH::PaddedBounds(primBounds[this->primIndices[childIndex[s] + p]]));
+            }
+            else
+            {
+                slotBounds[s] = nodeBounds[childIndex[s]];
+            }
+            bounds.Grow(slotBounds[s]);
+        }
+        nodeBounds[i] = bounds;
+
+        float scale[3];
+        for (int a = 0; a < 3; a++)
+        {
+            node.origin[a] = bounds.min[a];
+            node.exponent[a] = GridExponent(bounds.min[a], bounds.max[a]);
+            scale[a] = node.Scale(a);
+        }
+        for (unsigned s = 0; s < WIDTH; s++)
+        {
+            if ((node.validMask & (1 << s)) == 0)
+                continue;
+            BBox const& b = slotBounds[s];
+            QuantizeRange(node.origin[0], scale[0], b.min[0], b.max[0], node.qMinX[s], node.qMaxX[s]);
+            QuantizeRange(node.origin[1], scale[1], b.min[1], b.max[1], node.qMinY[s], node.qMaxY[s]);
+            QuantizeRange(node.origin[2], scale[2], b.min[2], b.max[2], node.qMinZ[s], node.qMaxZ[s]);
+        }
+    }
+}
+
+template class QuantizedBVH<4>;
+template class QuantizedBVH<8>;
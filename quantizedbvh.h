@@ -0,0 +1,249 @@
+#pragma once
+#include <vector>
+#include <string.h>
+#include "widebvh.h"
+
+//------------------------------------------------------------------------------
+/**
+    Compressed node of a WIDTH-ary BVH. Child bounds are stored as 8 bit
+    offsets on a grid spanning the node, with a power of two cell size so
+    decoding is exact. Bounds are rounded outwards, so no hits are lost.
+
+    Children are placed in the slots by where they sit in the node, each
+    bit of the slot index standing for the low or the high side along one
+    axis, see SlotAxis. The front to back order then follows from the
+    signs of the ray direction, without an order table per octant.
+
+    Interior children of a node are stored next to each other starting at
+    childBase, and primitives of all leaf children starting at primBase,
+    both in slot order, so the index of a child is counted from the slots
+    before it. WIDTH 4 nodes take 52 bytes, 40% of a WideBVHNode, WIDTH 8
+    nodes 80 bytes, a quarter. They are not aligned to cache lines.
+*/
+template<unsigned WIDTH>
+struct QuantizedBVHNode
+{
+    static constexpr unsigned SlotBits = WIDTH == 4 ? 2 : 3;
+
+    // minimum corner of the quantization grid
+    float origin[3];
+    unsigned childBase;
+    unsigned primBase;
+    // cell size of the grid is 2^exponent per axis
+    signed char exponent[3];
+    // bit per slot that holds a child
+    unsigned char validMask;
+    // primitive count of leaf children, 0 for interior children and empty slots
+    unsigned char count[WIDTH];
+    unsigned char qMinX[WIDTH];
+    unsigned char qMaxX[WIDTH];
+    unsigned char qMinY[WIDTH];
+    unsigned char qMaxY[WIDTH];
+    unsigned char qMinZ[WIDTH];
+    unsigned char qMaxZ[WIDTH];
+
+    // axis that bit of the slot index stands for, set if the child is on the high side.
+    // WIDTH 4 leaves out the axis with the smallest grid cells, the node is flattest along it
+    SIMD_INLINE unsigned SlotAxis(unsigned bit) const
+    {
+        if (WIDTH == 8)
+            return bit;
+        unsigned flat = 0;
+        if (this->exponent[1] < this->exponent[flat])
+            flat = 1;
+        if (this->exponent[2] < this->exponent[flat])
+            flat = 2;
+        return bit < flat ? bit : bit + 1;
+    }
+
+    // visiting slot i ^ OrderMask(octant) for i = 0, 1, ... goes roughly front to back
+    SIMD_INLINE unsigned OrderMask(unsigned octant) const
+    {
+        unsigned mask = 0;
+        for (unsigned bit = 0; bit < SlotBits; bit++)
+            mask |= ((octant >> this->SlotAxis(bit)) & 1) << bit;
+        return mask;
+    }
+
+    // node index of each interior child and first primitive of each leaf child
+    SIMD_INLINE void ChildIndices(unsigned index[WIDTH]) const
+    {
+        unsigned child = this->childBase;
+        unsigned prim = this->primBase;
+        for (unsigned s = 0; s < WIDTH; s++)
+        {
+            index[s] = this->count[s] > 0 ? prim : child;
+            prim += this->count[s];
+            child += ((this->validMask >> s) & 1) & (this->count[s] == 0);
+        }
+    }
+
+    // 2^exponent, built straight from the float bits
+    SIMD_INLINE float Scale(int axis) const
+    {
+        unsigned bits = (unsigned)(this->exponent[axis] + 127) << 23;
+        float scale;
+        memcpy(&scale, &bits, sizeof(scale));
+        return scale;
+    }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Multi branching BVH with quantized child bounds, built from a binary BVH
+*/
+template<unsigned WIDTH>
+class QuantizedBVH
+{
+public:
+    void Build(BVH const& bvh);
+
+    // same as BVH::Refit, the grids of the nodes are fitted to the moved children
+    // while their slots stay as they are. An attached tree is copied into the vectors first
+    void Refit(std::vector<BBox> const& primBounds);
+
+    // same as BVH::Validate
+    bool Validate(unsigned numObjects) const;
+
+    // same contract as BVH::Intersect
+    template<class INTERSECT>
+    void Intersect(Ray const& ray, float& tMax, INTERSECT&& intersect) const;
+
+    // same contract as BVH::IntersectLeaves
+    template<class LEAF>
+    void IntersectLeaves(Ray const& ray, float& tMax, LEAF&& leaf) const;
+
+    // same as BVH::Attach, the next Build goes back to the vectors
+    void Attach(QuantizedBVHNode<WIDTH> const* nodes, unsigned nodeCount, unsigned const* primIndices, unsigned primCount)
+    {
+        this->nodes.clear();
+        this->nodes.shrink_to_fit();
+        this->primIndices.clear();
+        this->primIndices.shrink_to_fit();
+        this->attachedNodes = nodes;
+        this->attachedNodeCount = nodeCount;
+        this->attachedPrims = primIndices;
+        this->attachedPrimCount = primCount;
+    }
+    SIMD_INLINE bool IsAttached() const { return this->attachedNodes != nullptr; }
+    SIMD_INLINE unsigned NodeCount() const { return this->IsAttached() ? this->attachedNodeCount : (unsigned)this->nodes.size(); }
+    SIMD_INLINE unsigned PrimCount() const { return this->IsAttached() ? this->attachedPrimCount : (unsigned)this->primIndices.size(); }
+    SIMD_INLINE QuantizedBVHNode<WIDTH> const* NodeData() const { return this->IsAttached() ? this->attachedNodes : this->nodes.data(); }
+    SIMD_INLINE unsigned const* PrimData() const { return this->IsAttached() ? this->attachedPrims : this->primIndices.data(); }
+
+    // bytes used by nodes and primitive indices
+    size_t MemoryUsage() const;
+
+    std::vector<QuantizedBVHNode<WIDTH>> nodes;
+    std::vector<unsigned> primIndices;
+
+    // size the same tree takes with full precision WideBVH nodes
+    size_t uncompressedMemoryUsage = 0;
+
+private:
+    QuantizedBVHNode<WIDTH> const* attachedNodes = nullptr;
+    unsigned const* attachedPrims = nullptr;
+    unsigned attachedNodeCount = 0;
+    unsigned attachedPrimCount = 0;
+
+    void Quantize(WideBVH<WIDTH> const& wide, unsigned wideIndex, unsigned index);
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<unsigned WIDTH>
+template<class INTERSECT>
+inline void
+QuantizedBVH<WIDTH>::Intersect(Ray const& ray, float& tMax, INTERSECT&& intersect) const
+{
+    unsigned const* primIndices = this->PrimData();
+    this->IntersectLeaves(ray, tMax, [&](unsigned first, unsigned count)
+    {
+        for (unsigned i = 0; i < count; i++)
+            intersect(primIndices[first + i]);
+    });
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<unsigned WIDTH>
+template<class LEAF>
+inline void
+QuantizedBVH<WIDTH>::IntersectLeaves(Ray const& ray, float& tMax, LEAF&& leaf) const
+{
+    if (this->NodeCount() == 0)
+        return;
+
+    QuantizedBVHNode<WIDTH> const* nodes = this->NodeData();
+    using vf = vfloat<WIDTH>;
+    BVHRay r(ray);
+    vf ox = vf::Broadcast(r.origin[0]);
+    vf oy = vf::Broadcast(r.origin[1]);
+    vf oz = vf::Broadcast(r.origin[2]);
+    vf idx = vf::Broadcast(r.invDir[0]);
+    vf idy = vf::Broadcast(r.invDir[1]);
+    vf idz = vf::Broadcast(r.invDir[2]);
+    vf zero = vf::Broadcast(0.0f);
+    vf widen = vf::Broadcast(1.0000004f);
+    unsigned octant = (r.invDir[0] < 0.0f ? 1 : 0) | (r.invDir[1] < 0.0f ? 2 : 0) | (r.invDir[2] < 0.0f ? 4 : 0);
+
+    struct Entry
+    {
+        unsigned index;
+        // primitive count for leaves, 0 for nodes
+        unsigned count;
+        float dist;
+    };
+    Entry stack[BVH::MaxDepth * WIDTH];
+    unsigned stackPtr = 0;
+    stack[stackPtr++] = { 0, 0, 0.0f };
+
+    while (stackPtr > 0)
+    {
+        Entry entry = stack[--stackPtr];
+        if (entry.dist >= tMax)
+            continue;
+
+        if (entry.count > 0)
+        {
+            leaf(entry.index, entry.count);
+            continue;
+        }
+
+        QuantizedBVHNode<WIDTH> const& node = nodes[entry.index];
+
+        // decode relative to the ray origin, origin + q * scale is exact in the multiply
+        vf sx = vf::Broadcast(node.Scale(0));
+        vf sy = vf::Broadcast(node.Scale(1));
+        vf sz = vf::Broadcast(node.Scale(2));
+        vf bx = vf::Broadcast(node.origin[0]);
+        vf by = vf::Broadcast(node.origin[1]);
+        vf bz = vf::Broadcast(node.origin[2]);
+        vf tx1 = ((bx + vf::LoadBytes(node.qMinX) * sx) - ox) * idx;
+        vf tx2 = ((bx + vf::LoadBytes(node.qMaxX) * sx) - ox) * idx;
+        vf ty1 = ((by + vf::LoadBytes(node.qMinY) * sy) - oy) * idy;
+        vf ty2 = ((by + vf::LoadBytes(node.qMaxY) * sy) - oy) * idy;
+        vf tz1 = ((bz + vf::LoadBytes(node.qMinZ) * sz) - oz) * idz;
+        vf tz2 = ((bz + vf::LoadBytes(node.qMaxZ) * sz) - oz) * idz;
+        vf tNear = Max(Max(Min(tx1, tx2), Min(ty1, ty2)), Min(tz1, tz2));
+        vf tFar = Min(Min(Max(tx1, tx2), Max(ty1, ty2)), Max(tz1, tz2)) * widen;
+        unsigned hits = Mask((tFar >= tNear) & (tNear < vf::Broadcast(tMax)) & (tFar > zero)) & node.validMask;
+        if (hits == 0)
+            continue;
+
+        alignas(32) float dist[WIDTH];
+        tNear.Store(dist);
+
+        unsigned childIndex[WIDTH];
+        node.ChildIndices(childIndex);
+        unsigned mask = node.OrderMask(octant);
+        for (unsigned i = WIDTH; i-- > 0;)
+        {
+            unsigned c = i ^ mask;
+            if (hits & (1u << c))
+                stack[stackPtr++] = { childIndex[c], node.count[c], dist[c] };
+        }
+    }
+}
@@ -0,0 +1,109 @@
+#include "radixsort.h"
+#include "parallel.h"
+#include "threadpool.h"
+#include <assert.h>
+
+namespace
+{
+// small inputs are not worth waking up other threads for
+constexpr unsigned MinParallelCount = 65536;
+
+//------------------------------------------------------------------------------
+/**
+    The passes of RadixSort, with range(count, func) calling
+    func(begin, end, chunk) for numChunks contiguous chunks of [0, count)
+*/
+template<class RANGE>
+void
+RadixSortPasses(std::vector<unsigned>& keys, std::vector<unsigned>& values, unsigned keyBits, RadixSortBuffers& buffers,
+    unsigned numChunks, RANGE&& range)
+{
+    assert(keys.size() == values.size());
+    unsigned count = (unsigned)keys.size();
+    constexpr unsigned Radix = 256;
+
+    std::vector<unsigned>& tmpKeys = buffers.keys;
+    std::vector<unsigned>& tmpValues = buffers.values;
+    std::vector<unsigned>& histograms = buffers.histograms;
+    tmpKeys.resize(count);
+    tmpValues.resize(count);
+    histograms.resize(numChunks * Radix);
+
+    for (unsigned shift = 0; shift < keyBits; shift += 8)
+    {
+        // count digits per chunk
+        range(count, [&](unsigned begin, unsigned end, unsigned chunk)
+        {
+            unsigned* histogram = &histograms[chunk * Radix];
+            std::fill(histogram, histogram + Radix, 0);
+            for (unsigned i = begin; i < end; i++)
+                histogram[(keys[i] >> shift) & (Radix - 1)]++;
+        });
+
+        // turn counts into scatter offsets, ordered by digit then chunk to keep the sort stable
+        unsigned offset = 0;
+        for (unsigned digit = 0; digit < Radix; digit++)
+        {
+            for (unsigned chunk = 0; chunk < numChunks; chunk++)
+            {
+                unsigned n = histograms[chunk * Radix + digit];
+                histograms[chunk * Radix + digit] = offset;
+                offset += n;
+            }
+        }
+
+        range(count, [&](unsigned begin, unsigned end, unsigned chunk)
+        {
+            unsigned* offsets = &histograms[chunk * Radix];
+            for (unsigned i = begin; i < end; i++)
+            {
+                unsigned dst = offsets[(keys[i] >> shift) & (Radix - 1)]++;
+                tmpKeys[dst] = keys[i];
+                tmpValues[dst] = values[i];
+            }
+        });
+
+        keys.swap(tmpKeys);
+        values.swap(tmpValues);
+    }
+}
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+RadixSort(std::vector<unsigned>& keys, std::vector<unsigned>& values, unsigned keyBits)
+{
+    RadixSortBuffers buffers;
+    RadixSort(keys, values, keyBits, buffers);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+RadixSort(std::vector<unsigned>& keys, std::vector<unsigned>& values, unsigned keyBits, RadixSortBuffers& buffers)
+{
+    unsigned numChunks = keys.size() < MinParallelCount ? 1 : NumParallelThreads();
+    RadixSortPasses(keys, values, keyBits, buffers, numChunks, [numChunks](unsigned count, auto&& func)
+    {
+        ParallelRange(count, numChunks, func);
+    });
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+RadixSort(std::vector<unsigned>& keys, std::vector<unsigned>& values, unsigned keyBits, RadixSortBuffers& buffers, ThreadPool& pool)
+{
+    unsigned numChunks = keys.size() < MinParallelCount ? 1 : pool.NumThreads();
+    RadixSortPasses(keys, values, keyBits, buffers, numChunks, [numChunks, &pool](unsigned count, auto&& func)
+    {
+        if (numChunks == 1)
+            func(0u, count, 0u);
+        else
+            pool.RunRange(count, func);
+    });
+}
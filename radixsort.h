@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+
+class ThreadPool;
+
+//------------------------------------------------------------------------------
+/**
+    Stable LSD radix sort of 32 bit keys, 8 bits per pass, with every pass
+    split across all threads. values are permuted along with the keys.
+    Only the lowest keyBits bits of the keys are considered.
+*/
+void RadixSort(std::vector<unsigned>& keys, std::vector<unsigned>& values, unsigned keyBits = 32);
+
+//------------------------------------------------------------------------------
+/**
+    Scratch memory of RadixSort. Callers that sort every frame keep one
+    around, so that sorting does not allocate once it has grown.
+*/
+struct RadixSortBuffers
+{
+    std::vector<unsigned> keys;
+    std::vector<unsigned> values;
+    std::vector<unsigned> histograms;
+};
+
+void RadixSort(std::vector<unsigned>& keys, std::vector<unsigned>& values, unsigned keyBits, RadixSortBuffers& buffers);
+
+// the passes split across the threads of pool rather than threads started for each of them
+void RadixSort(std::vector<unsigned>& keys, std::vector<unsigned>& values, unsigned keyBits, RadixSortBuffers& buffers, ThreadPool& pool);
+
+//------------------------------------------------------------------------------
+/**
+    Spread the lower 10 bits of v out so that there are two zero bits between each,
+    interleaving three of them gives a morton code
+*/
+inline unsigned
+ExpandBits(unsigned v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
@@ -1,12 +1,103 @@
 #pragma once
+#include <string.h>
+#include "vec3.h"
 
-/// Produces an xorshift128 pseudo random number.
-unsigned FastRandom();
+//------------------------------------------------------------------------------
+/**
+    Counter based random numbers. A number is a hash of where it is used:
+    the pixel, the sample of the pixel, the bounce of the path and the
+    dimension within that bounce. There is no state shared between threads,
+    and a path draws the same numbers whichever thread traces it, in
+    whichever order, so frames are reproducible.
 
-/// Produces an xorshift128 psuedo based floating point random number in range 0..1
-/// Note that this is not a truly random random number generator
-float RandomFloat();
+    The hash is pcg4d of Jarzynski and Olano, "Hash Functions for GPU
+    Rendering", which mixes all four inputs into each output.
 
-/// Produces an xorshift128 psuedo based floating point random number in range -1..1
-/// Note that this is not a truly random random number generator
-float RandomFloatNTP();
\ No newline at end of file
+    A stream is the numbers of one path at one bounce, Next draws its
+    dimensions in order. Functions that are compiled per instruction set
+    call it, so the members are forced inline, see simd.h.
+*/
+struct RandomStream
+{
+    // bounce of the camera ray, scattering after the n-th hit uses bounce n + 1
+    static constexpr unsigned CameraBounce = 0;
+
+    SIMD_INLINE RandomStream(unsigned pixel, unsigned sample, unsigned bounce) :
+        pixel(pixel),
+        sample(sample),
+        bounce(bounce)
+    {
+    }
+
+    // next number of the stream, in [0, 1)
+    SIMD_INLINE float Next()
+    {
+        return ToFloat(Hash(this->pixel, this->sample, this->bounce, this->dimension++), 0x3f800000) - 1.0f;
+    }
+
+    // next number of the stream, in [-1, 1)
+    SIMD_INLINE float NextSigned()
+    {
+        return ToFloat(Hash(this->pixel, this->sample, this->bounce, this->dimension++), 0x40000000) - 3.0f;
+    }
+
+    // the same stream at the next bounce
+    SIMD_INLINE RandomStream NextBounce() const
+    {
+        return RandomStream(this->pixel, this->sample, this->bounce + 1);
+    }
+
+    // the counter hashed to 32 random bits
+    static SIMD_INLINE unsigned Hash(unsigned x, unsigned y, unsigned z, unsigned w)
+    {
+        x = x * 1664525u + 1013904223u;
+        y = y * 1664525u + 1013904223u;
+        z = z * 1664525u + 1013904223u;
+        w = w * 1664525u + 1013904223u;
+        x += y * w;
+        y += z * x;
+        z += x * y;
+        w += y * z;
+        x ^= x >> 16;
+        y ^= y >> 16;
+        z ^= z >> 16;
+        w ^= w >> 16;
+        // the first output of the second round, the others are not needed
+        return x + y * w;
+    }
+
+    unsigned pixel;
+    unsigned sample;
+    unsigned bounce;
+    // numbers drawn so far
+    unsigned dimension = 0;
+
+private:
+    // the top 23 bits as the mantissa of a float with the given exponent bits,
+    // [1, 2) for 0x3f800000 and [2, 4) for 0x40000000
+    static SIMD_INLINE float ToFloat(unsigned bits, unsigned exponent)
+    {
+        unsigned i = (bits >> 9) | exponent;
+        float f;
+        memcpy(&f, &i, sizeof(f));
+        return f;
+    }
+};
+
+// compiled per instruction set, see simd.h
+namespace TRAYRACER_ISA
+{
+
+// returns a random point on the surface of a unit sphere, from the next three
+// numbers of random
+inline vec3 random_point_on_unit_sphere(RandomStream& random)
+{
+    float x = random.NextSigned();
+    float y = random.NextSigned();
+    float z = random.NextSigned();
+    vec3 v( x, y, z );
+    return normalize(v);
+}
+
+} // namespace TRAYRACER_ISA
+using namespace TRAYRACER_ISA;
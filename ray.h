@@ -7,19 +7,15 @@
 class Ray
 {
 public:
-    Ray(vec3 startpoint, vec3 dir) :
+    SIMD_INLINE Ray() {}
+    SIMD_INLINE Ray(vec3 startpoint, vec3 dir) :
         b(startpoint),
         m(dir)
     {
 
     }
 
-    ~Ray()
-    {
-
-    }
-
-    vec3 PointAt(float t)
+    SIMD_INLINE vec3 PointAt(float t) const
     {
         return {b + m * t};
     }
@@ -1,5 +1,10 @@
 #include "raytracer.h"
-#include <random>
+#include "renderkernels.h"
+#include "sphere.h"
+#include "numa.h"
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
 
 //------------------------------------------------------------------------------
 /**
@@ -16,102 +21,675 @@ Raytracer::Raytracer(unsigned w, unsigned h, std::vector<Color>& frameBuffer, un
 
 //------------------------------------------------------------------------------
 /**
+    The loops run in the kernels of the instruction set of the cpu, see renderkernels.h.
+    Tiles are handed out in rows, each thread starts on a band of them, and
+    threads that finish early steal from the others, so regions that are
+    expensive to render, glass behind glass, are shared out at the end.
+    The threads are those of threadPool, which wait for the next frame
+    rather than being started for every one.
+    Random numbers are keyed by pixel and sample, see RandomStream, so a
+    frame does not depend on which thread rendered what.
 */
 void
 Raytracer::Raytrace()
 {
-    static int leet = 1337;
-    std::mt19937 generator(leet++);
-    std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+    // every frame adds new samples to the accumulated ones
+    unsigned firstSample = this->frameIndex++ * this->rpp;
+    this->threadPool.Resize(this->numThreads, this->numaPlacement);
 
-    for (int x = 0; x < this->width; ++x)
+    // the structure decides whether packets can be used
+    if (this->sceneDirty || this->builtStructure != this->accelerationStructure)
+        this->BuildAccelerationStructure();
+    if (this->numaPlacement)
+        this->PlaceMemory();
+    if (this->integrator == Integrator::Wavefront)
     {
-        for (int y = 0; y < this->height; ++y)
-        {
-            Color color;
-            for (int i = 0; i < this->rpp; ++i)
-            {
-                float u = ((float(x + dis(generator)) * (1.0f / this->width)) * 2.0f) - 1.0f;
-                float v = ((float(y + dis(generator)) * (1.0f / this->height)) * 2.0f) - 1.0f;
-
-                vec3 direction = vec3(u, v, -1.0f);
-                direction = transform(direction, this->frustum);
+        this->wavefront.Render(*this, firstSample);
+        return;
+    }
 
-                Ray ray(get_position(this->view), direction);
-                color += this->TracePath(ray, 0);
-            }
+    RenderKernels const& kernels = GetRenderKernels();
+    unsigned tilesX = (this->width + TileSize - 1) / TileSize;
+    unsigned tilesY = (this->height + TileSize - 1) / TileSize;
+    unsigned numTiles = tilesX * tilesY;
+    this->tileSteals = this->threadPool.RunTasks(numTiles, [&](unsigned tile, unsigned)
+    {
+        unsigned x0 = (tile % tilesX) * TileSize;
+        unsigned y0 = (tile / tilesX) * TileSize;
+        kernels.raytraceTile(*this, x0, y0, std::min(x0 + TileSize, this->width), std::min(y0 + TileSize, this->height), firstSample);
+    });
+}
 
-            // divide by number of samples per pixel, to get the average of the distribution
-            color.r /= this->rpp;
-            color.g /= this->rpp;
-            color.b /= this->rpp;
+//------------------------------------------------------------------------------
+/**
+    RunTasks starts thread t on tiles [t * numTiles / numThreads, (t + 1) * numTiles / numThreads),
+    and the pool gives each node a block of consecutive threads, so each node starts on a
+    band of tile rows. Rows of the frame buffer are contiguous, the pixels of a band are one
+    range of it, and its pages are moved to the node. A row of tiles shared by two nodes
+    goes to the second one.
 
-            this->frameBuffer[y * this->width + x] += color;
+    The scene arrays are found through the structures that own them. Rebuilding and
+    refitting reallocate some of them, so only arrays that are not where they were at the
+    last call are placed again.
+*/
+void
+Raytracer::PlaceMemory()
+{
+    ThreadPool const& pool = this->threadPool;
+    unsigned numNodes = GetNumaTopology().NumNodes();
+    unsigned numThreads = pool.NumThreads();
+    if (numNodes > 1 && (this->placedFrameBuffer != this->frameBuffer.data() || this->placedThreads != numThreads))
+    {
+        unsigned tilesX = (this->width + TileSize - 1) / TileSize;
+        unsigned numTiles = tilesX * ((this->height + TileSize - 1) / TileSize);
+        // first pixel row of the band of the threads from thread on
+        auto bandStart = [&](unsigned thread)
+        {
+            if (thread == numThreads)
+                return this->height;
+            unsigned tile = (unsigned)(((unsigned long long)numTiles * thread) / numThreads);
+            return std::min(this->height, (tile / tilesX) * TileSize);
+        };
+        for (unsigned first = 0; first < numThreads; )
+        {
+            unsigned node = pool.ThreadNode(first);
+            unsigned end = first + 1;
+            while (end < numThreads && pool.ThreadNode(end) == node)
+                end++;
+            unsigned y0 = bandStart(first);
+            unsigned y1 = bandStart(end);
+            if (y1 > y0)
+                BindMemory(&this->frameBuffer[(size_t)y0 * this->width], (size_t)(y1 - y0) * this->width * sizeof(Color), node);
+            first = end;
         }
+        this->placedFrameBuffer = this->frameBuffer.data();
+        this->placedThreads = numThreads;
     }
 
+    std::vector<std::pair<void const*, size_t>>& buffers = this->sceneBuffers;
+    buffers.clear();
+    auto add = [&buffers](void const* data, size_t bytes)
+    {
+        if (bytes > 0)
+            buffers.push_back({ data, bytes });
+    };
+    auto addVector = [&add](auto const& v) { add(v.data(), v.size() * sizeof(v[0])); };
+    addVector(this->bvh.nodes);
+    addVector(this->bvh.primIndices);
+    addVector(this->bvh4.nodes);
+    addVector(this->bvh4.primIndices);
+    addVector(this->bvh8.nodes);
+    addVector(this->bvh8.primIndices);
+    addVector(this->qbvh4.nodes);
+    addVector(this->qbvh4.primIndices);
+    addVector(this->qbvh8.nodes);
+    addVector(this->qbvh8.primIndices);
+    addVector(this->grid.cellStart);
+    addVector(this->grid.cellPrims);
+    addVector(this->grid.largePrims);
+    this->primitives.ForEachBuffer(add);
+    this->unboundedPrimitives.ForEachBuffer(add);
+
+    for (std::pair<void const*, size_t> const& buffer : buffers)
+    {
+        if (std::find(this->placedBuffers.begin(), this->placedBuffers.end(), buffer) != this->placedBuffers.end())
+            continue;
+        if (numNodes > 1)
+            InterleaveMemory(buffer.first, buffer.second);
+        AdviseHugePages(buffer.first, buffer.second);
+    }
+    this->placedBuffers.swap(buffers);
 }
 
 //------------------------------------------------------------------------------
 /**
- * @parameter n - the current bounce level
 */
-Color
-Raytracer::TracePath(Ray ray, unsigned n)
+bool
+Raytracer::Raycast(Ray ray, vec3& hitPoint, vec3& hitNormal, Object*& hitObject, float& distance)
+{
+    if (this->sceneDirty || this->builtStructure != this->accelerationStructure)
+        this->BuildAccelerationStructure();
+
+    HitResult closestHit;
+    bool isHit = GetRenderKernels().raycast(*this, ray, closestHit);
+
+    hitPoint = closestHit.p;
+    hitNormal = closestHit.normal;
+    hitObject = closestHit.object;
+    distance = closestHit.t;
+
+    return isHit;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+Raytracer::Occluded(Ray ray, float maxDist)
+{
+    if (this->sceneDirty || this->builtStructure != this->accelerationStructure)
+        this->BuildAccelerationStructure();
+
+    return GetRenderKernels().occluded(*this, ray, maxDist);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Packets walk the binary bvh, and the primitives of a leaf are tested
+    against all lanes that reach it. The wide trees share its primitive order,
+    so the slots of the primitive store fit it as well.
+*/
+bool
+Raytracer::PacketsSupported() const
+{
+    if (!this->staticDispatch)
+        return false;
+    switch (this->activeStructure)
+    {
+    case AccelerationStructure::BruteForce:
+    case AccelerationStructure::BVH:
+    case AccelerationStructure::BVH4:
+    case AccelerationStructure::BVH8:
+        return true;
+    default:
+        return false;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Raytracer::BuildAccelerationStructure()
 {
-    vec3 hitPoint;
-    vec3 hitNormal;
-    Object* hitObject = nullptr;
-    float distance = FLT_MAX;
+    this->boundedObjects.clear();
+    this->unboundedObjects.clear();
+    this->primBounds.clear();
 
-    if (Raycast(ray, hitPoint, hitNormal, hitObject, distance))
+    for (Object* object : this->objects)
     {
-        Ray scatteredRay = Ray(hitObject->ScatterRay(ray, hitPoint, hitNormal));
-        if (n < this->bounces)
+        BBox bounds;
+        if (object->GetBounds(bounds))
         {
-            return hitObject->GetColor() * this->TracePath(scatteredRay, n + 1);
+            this->boundedObjects.push_back(object);
+            this->primBounds.push_back(bounds);
         }
         else
         {
-            return { 0, 0, 0 };
+            this->unboundedObjects.push_back(object);
+        }
+    }
+
+    // the cache is only consulted for new scenes, not for rebuilds after refitting
+    bool useCache = this->sceneDirty && !this->accelerationCacheDirectory.empty();
+    this->sceneDirty = false;
+    this->builtStructure = this->accelerationStructure;
+    this->activeStructure = this->accelerationStructure;
+    // nothing may point into the cache file once it is closed
+    this->bvh = BVH();
+    this->bvh4 = WideBVH<4>();
+    this->bvh8 = WideBVH<8>();
+    this->qbvh4 = QuantizedBVH<4>();
+    this->qbvh8 = QuantizedBVH<8>();
+    this->accelerationCache.Close();
+    this->grid = UniformGrid();
+    if (this->accelerationStructure == AccelerationStructure::Auto)
+        this->activeStructure = this->SelectAccelerationStructure();
+    if (this->activeStructure != AccelerationStructure::Grid)
+        this->grid = UniformGrid();
+
+    if (this->activeStructure == AccelerationStructure::BruteForce)
+    {
+        this->UpdateWideBVH();
+        this->UpdatePrimitives();
+        return;
+    }
+
+    const float MB = 1.0f / (1024.0f * 1024.0f);
+    if (this->activeStructure == AccelerationStructure::Grid)
+    {
+        // Auto has built it already
+        if (this->accelerationStructure == AccelerationStructure::Grid)
+            this->grid.Build(this->primBounds);
+        this->UpdateWideBVH();
+        this->UpdatePrimitives();
+        printf("Grid: %u x %u x %u cells over %u objects took %.2f ms, %.0f%% occupied, %u left out, %.2f MB\n",
+            this->grid.res[0], this->grid.res[1], this->grid.res[2],
+            (unsigned)this->primBounds.size(),
+            this->grid.buildTime,
+            this->grid.occupancy * 100.0f,
+            (unsigned)this->grid.largePrims.size(),
+            this->grid.MemoryUsage() * MB);
+        return;
+    }
+
+    unsigned long long cacheKey = 0;
+    if (useCache)
+    {
+        unsigned long long settings = ((unsigned long long)this->bvhLayout << 16) | ((unsigned long long)this->activeStructure << 8) | (unsigned long long)this->bvhBuilder;
+        cacheKey = (HashPrimitiveBounds(this->primBounds) ^ settings) * 1099511628211ull;
+        if (this->LoadAccelerationCache(cacheKey))
+        {
+            this->UpdatePrimitives();
+            return;
         }
     }
 
-    return this->Skybox(ray.m);
+    this->bvh.Build(this->primBounds, this->bvhBuilder);
+    this->bvh.Reorder(this->bvhLayout);
+
+    printf("BVH: %s build of %u objects took %.2f ms, %u nodes, SAH cost %.2f\n",
+        this->bvhBuilder == BVHBuilder::LBVH ? "LBVH" : "SAH",
+        (unsigned)this->primBounds.size(),
+        this->bvh.buildTime,
+        (unsigned)this->bvh.nodes.size(),
+        this->bvh.buildCost);
+
+    this->UpdateWideBVH();
+    this->UpdatePrimitives();
+
+    switch (this->activeStructure)
+    {
+    case AccelerationStructure::BVH4:
+        printf("BVH4: %u nodes, %u bytes each\n", (unsigned)this->bvh4.nodes.size(), (unsigned)sizeof(WideBVHNode<4>));
+        break;
+    case AccelerationStructure::BVH8:
+        printf("BVH8: %u nodes, %u bytes each\n", (unsigned)this->bvh8.nodes.size(), (unsigned)sizeof(WideBVHNode<8>));
+        break;
+    case AccelerationStructure::QuantizedBVH4:
+        printf("Quantized BVH4: %u nodes, %u bytes each, %.2f MB (%.2f MB uncompressed)\n",
+            (unsigned)this->qbvh4.nodes.size(), (unsigned)sizeof(QuantizedBVHNode<4>),
+            this->qbvh4.MemoryUsage() * MB, this->qbvh4.uncompressedMemoryUsage * MB);
+        break;
+    case AccelerationStructure::QuantizedBVH8:
+        printf("Quantized BVH8: %u nodes, %u bytes each, %.2f MB (%.2f MB uncompressed)\n",
+            (unsigned)this->qbvh8.nodes.size(), (unsigned)sizeof(QuantizedBVHNode<8>),
+            this->qbvh8.MemoryUsage() * MB, this->qbvh8.uncompressedMemoryUsage * MB);
+        break;
+    default:
+        break;
+    }
+
+    if (useCache)
+        this->SaveAccelerationCache(cacheKey);
 }
 
 //------------------------------------------------------------------------------
 /**
+    Linear scans win for a handful of objects. Grids win when objects are
+    spread evenly and have similar sizes: every ray then walks few cells that
+    hold few objects. Anything else is left to the tree.
 */
-bool Raytracer::Raycast(Ray ray, vec3& hitPoint, vec3& hitNormal, Object*& hitObject, float& distance)
+AccelerationStructure
+Raytracer::SelectAccelerationStructure()
 {
-    bool isHit = false;
-    HitResult closestHit;
-    HitResult hit;
+    AccelerationStructure selected;
+    char const* reason;
+    unsigned count = (unsigned)this->primBounds.size();
 
-    for (Object* object : this->objects)
+    // a trial grid gives the occupancy, and is kept if it wins
+    this->grid.Build(this->primBounds);
+
+    // coefficient of variation of the longest extent, over the objects in the grid
+    double sum = 0.0;
+    double sumSq = 0.0;
+    for (BBox const& b : this->primBounds)
     {
-        auto opt = object->Intersect(ray, closestHit.t);
-        if (opt.HasValue())
-        {
-            HitResult hit = opt.Get();
-            if (hit.t < closestHit.t)
-            {
-                closestHit = hit;
-                closestHit.object = object;
-                isHit = true;
-            }
-        }
+        double size = std::max(b.Extent(0), std::max(b.Extent(1), b.Extent(2)));
+        sum += size;
+        sumSq += size * size;
+    }
+    for (unsigned prim : this->grid.largePrims)
+    {
+        BBox const& b = this->primBounds[prim];
+        double size = std::max(b.Extent(0), std::max(b.Extent(1), b.Extent(2)));
+        sum -= size;
+        sumSq -= size * size;
     }
+    unsigned gridCount = count - (unsigned)this->grid.largePrims.size();
+    double mean = gridCount > 0 ? sum / gridCount : 0.0;
+    double variance = gridCount > 0 ? std::max(sumSq / gridCount - mean * mean, 0.0) : 0.0;
+    float sizeVariation = mean > 0.0 ? (float)(sqrt(variance) / mean) : 0.0f;
 
-    hitPoint = closestHit.p;
-    hitNormal = closestHit.normal;
-    hitObject = closestHit.object;
-    distance = closestHit.t;
+    if (count + this->unboundedObjects.size() <= AutoBruteForceLimit)
+    {
+        selected = AccelerationStructure::BruteForce;
+        reason = "few objects, testing all of them is cheapest";
+    }
+    else if (sizeVariation > AutoMaxSizeVariation)
+    {
+        selected = AccelerationStructure::BVH8;
+        reason = "object sizes vary too much for a grid";
+    }
+    else if (this->grid.occupancy < AutoMinOccupancy)
+    {
+        selected = AccelerationStructure::BVH8;
+        reason = "objects are clustered, most grid cells would be empty";
+    }
+    else
+    {
+        selected = AccelerationStructure::Grid;
+        reason = "objects are spread evenly and have similar sizes";
+    }
 
-    return isHit;
+    printf("Acceleration structure: %s, %s (%u objects, size variation %.2f, grid occupancy %.2f)\n",
+        selected == AccelerationStructure::BruteForce ? "brute force" : (selected == AccelerationStructure::Grid ? "grid" : "BVH8"),
+        reason, count, sizeVariation, this->grid.occupancy);
+    return selected;
 }
 
+//------------------------------------------------------------------------------
+/**
+    Collapse the binary bvh into the wide layout that is in use, if any
+*/
+void
+Raytracer::UpdateWideBVH()
+{
+    this->bvh4 = WideBVH<4>();
+    this->bvh8 = WideBVH<8>();
+    this->qbvh4 = QuantizedBVH<4>();
+    this->qbvh8 = QuantizedBVH<8>();
+    switch (this->activeStructure)
+    {
+    case AccelerationStructure::BVH4:
+        this->bvh4.Build(this->bvh);
+        this->bvh4.Reorder(this->bvhLayout);
+        break;
+    case AccelerationStructure::BVH8:
+        this->bvh8.Build(this->bvh);
+        this->bvh8.Reorder(this->bvhLayout);
+        break;
+    case AccelerationStructure::QuantizedBVH4:
+        this->qbvh4.Build(this->bvh);
+        break;
+    case AccelerationStructure::QuantizedBVH8:
+        this->qbvh8.Build(this->bvh);
+        break;
+    default:
+        break;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Leaves of the trees are ranges of their primitive indices, storing the
+    primitives in that order makes every leaf a contiguous run of slots.
+    Grid cells list objects, their slots are in object order
+*/
+void
+Raytracer::UpdatePrimitives()
+{
+    unsigned count = (unsigned)this->boundedObjects.size();
+    this->unboundedPrimitives.Build(this->unboundedObjects, nullptr, (unsigned)this->unboundedObjects.size());
+    switch (this->activeStructure)
+    {
+    case AccelerationStructure::BruteForce:
+        this->primitives.Build(this->objects, nullptr, (unsigned)this->objects.size());
+        break;
+    case AccelerationStructure::BVH4:
+        this->primitives.Build(this->boundedObjects, this->bvh4.PrimData(), count);
+        break;
+    case AccelerationStructure::BVH8:
+        this->primitives.Build(this->boundedObjects, this->bvh8.PrimData(), count);
+        break;
+    case AccelerationStructure::QuantizedBVH4:
+        this->primitives.Build(this->boundedObjects, this->qbvh4.PrimData(), count);
+        break;
+    case AccelerationStructure::QuantizedBVH8:
+        this->primitives.Build(this->boundedObjects, this->qbvh8.PrimData(), count);
+        break;
+    case AccelerationStructure::Grid:
+        this->primitives.Build(this->boundedObjects, nullptr, count);
+        break;
+    default:
+        this->primitives.Build(this->boundedObjects, this->bvh.PrimData(), count);
+        break;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+unsigned
+Raytracer::LayoutNodeSize() const
+{
+    switch (this->activeStructure)
+    {
+    case AccelerationStructure::BVH4:
+        return sizeof(WideBVHNode<4>);
+    case AccelerationStructure::BVH8:
+        return sizeof(WideBVHNode<8>);
+    case AccelerationStructure::QuantizedBVH4:
+        return sizeof(QuantizedBVHNode<4>);
+    case AccelerationStructure::QuantizedBVH8:
+        return sizeof(QuantizedBVHNode<8>);
+    default:
+        return sizeof(BVHNode);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+std::string
+Raytracer::AccelerationCachePath(unsigned long long key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.accel", key);
+    return this->accelerationCacheDirectory + "/" + name;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Trees are traversed straight from the mapping, pages are only read in as rays touch them
+*/
+bool
+Raytracer::LoadAccelerationCache(unsigned long long key)
+{
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::string path = this->AccelerationCachePath(key);
+    if (!this->accelerationCache.Open(path.c_str()))
+        return false;
+
+    MappedFile const& file = this->accelerationCache;
+    AccelerationCacheHeader const* header = ReadAccelerationCache(file, key, this->LayoutNodeSize());
+    if (header == nullptr ||
+        header->structure != (unsigned)this->activeStructure ||
+        header->builder != (unsigned)this->bvhBuilder ||
+        header->bvhPrims.count != this->primBounds.size())
+    {
+        printf("Acceleration structure cache: %s is stale, rebuilding\n", path.c_str());
+        this->accelerationCache.Close();
+        return false;
+    }
+
+    // the wide and quantized trees index the same primitives as the binary one they were collapsed from
+    bool wide =
+        this->activeStructure == AccelerationStructure::BVH4 || this->activeStructure == AccelerationStructure::BVH8 ||
+        this->activeStructure == AccelerationStructure::QuantizedBVH4 || this->activeStructure == AccelerationStructure::QuantizedBVH8;
+    if ((header->bvhNodes.count == 0 && header->bvhPrims.count > 0) ||
+        (wide && (header->nodes.count == 0 || header->prims.count != header->bvhPrims.count)))
+    {
+        printf("Acceleration structure cache: %s is corrupt, rebuilding\n", path.c_str());
+        this->accelerationCache.Close();
+        return false;
+    }
+
+    this->bvh.Attach(
+        AccelerationCacheData<BVHNode>(file, header->bvhNodes), (unsigned)header->bvhNodes.count,
+        AccelerationCacheData<unsigned>(file, header->bvhPrims), (unsigned)header->bvhPrims.count);
+    this->bvh.builder = this->bvhBuilder;
+    this->bvh.buildCost = header->buildCost;
+
+    unsigned const* prims = AccelerationCacheData<unsigned>(file, header->prims);
+    unsigned nodeCount = (unsigned)header->nodes.count;
+    unsigned primCount = (unsigned)header->prims.count;
+    switch (this->activeStructure)
+    {
+    case AccelerationStructure::BVH4:
+        this->bvh4.Attach(AccelerationCacheData<WideBVHNode<4>>(file, header->nodes), nodeCount, prims, primCount);
+        break;
+    case AccelerationStructure::BVH8:
+        this->bvh8.Attach(AccelerationCacheData<WideBVHNode<8>>(file, header->nodes), nodeCount, prims, primCount);
+        break;
+    case AccelerationStructure::QuantizedBVH4:
+        this->qbvh4.Attach(AccelerationCacheData<QuantizedBVHNode<4>>(file, header->nodes), nodeCount, prims, primCount);
+        break;
+    case AccelerationStructure::QuantizedBVH8:
+        this->qbvh8.Attach(AccelerationCacheData<QuantizedBVHNode<8>>(file, header->nodes), nodeCount, prims, primCount);
+        break;
+    default:
+        nodeCount = (unsigned)header->bvhNodes.count;
+        break;
+    }
+
+    // nothing past this point bounds checks an index, check them all once here
+    unsigned numObjects = (unsigned)this->primBounds.size();
+    bool valid = this->bvh.Validate(numObjects);
+    switch (this->activeStructure)
+    {
+    case AccelerationStructure::BVH4:
+        valid = valid && this->bvh4.Validate(numObjects);
+        break;
+    case AccelerationStructure::BVH8:
+        valid = valid && this->bvh8.Validate(numObjects);
+        break;
+    case AccelerationStructure::QuantizedBVH4:
+        valid = valid && this->qbvh4.Validate(numObjects);
+        break;
+    case AccelerationStructure::QuantizedBVH8:
+        valid = valid && this->qbvh8.Validate(numObjects);
+        break;
+    default:
+        break;
+    }
+    if (!valid)
+    {
+        printf("Acceleration structure cache: %s is corrupt, rebuilding\n", path.c_str());
+        this->bvh = BVH();
+        this->bvh4 = WideBVH<4>();
+        this->bvh8 = WideBVH<8>();
+        this->qbvh4 = QuantizedBVH<4>();
+        this->qbvh8 = QuantizedBVH<8>();
+        this->accelerationCache.Close();
+        return false;
+    }
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    printf("Acceleration structure cache: mapped %s in %.2f ms, %u nodes\n",
+        path.c_str(), std::chrono::duration<float, std::milli>(stop - start).count(), nodeCount);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+Raytracer::SaveAccelerationCache(unsigned long long key)
+{
+    AccelerationCacheHeader header = {};
+    header.structure = (unsigned)this->activeStructure;
+    header.builder = (unsigned)this->bvhBuilder;
+    header.nodeSize = this->LayoutNodeSize();
+    header.key = key;
+    header.buildCost = this->bvh.buildCost;
+    header.bvhNodes.count = this->bvh.nodes.size();
+    header.bvhPrims.count = this->bvh.primIndices.size();
+
+    void const* nodes = nullptr;
+    void const* prims = nullptr;
+    auto layout = [&header, &nodes, &prims](auto const& tree)
+    {
+        header.nodes.count = tree.nodes.size();
+        header.prims.count = tree.primIndices.size();
+        nodes = tree.nodes.data();
+        prims = tree.primIndices.data();
+    };
+    switch (this->activeStructure)
+    {
+    case AccelerationStructure::BVH4:
+        layout(this->bvh4);
+        break;
+    case AccelerationStructure::BVH8:
+        layout(this->bvh8);
+        break;
+    case AccelerationStructure::QuantizedBVH4:
+        layout(this->qbvh4);
+        break;
+    case AccelerationStructure::QuantizedBVH8:
+        layout(this->qbvh8);
+        break;
+    default:
+        break;
+    }
+
+    std::string path = this->AccelerationCachePath(key);
+    if (WriteAccelerationCache(path, header, this->bvh.nodes.data(), this->bvh.primIndices.data(), nodes, prims))
+        printf("Acceleration structure cache: wrote %s\n", path.c_str());
+    else
+        printf("Acceleration structure cache: could not write %s\n", path.c_str());
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+Raytracer::RefitAccelerationStructure()
+{
+    if (this->sceneDirty)
+    {
+        this->BuildAccelerationStructure();
+        return true;
+    }
+
+    for (size_t i = 0; i < this->boundedObjects.size(); i++)
+        this->boundedObjects[i]->GetBounds(this->primBounds[i]);
+
+    // without a structure only the primitive arrays follow the objects
+    if (this->activeStructure == AccelerationStructure::BruteForce)
+    {
+        this->UpdatePrimitives();
+        return false;
+    }
+    // grids build in linear time, there is nothing to gain from refitting them
+    if (this->activeStructure == AccelerationStructure::Grid)
+    {
+        this->grid.Build(this->primBounds);
+        this->UpdatePrimitives();
+        return false;
+    }
+
+    this->bvh.Refit(this->primBounds);
+
+    // moving objects around makes nodes overlap more and more, start over when it gets too bad
+    if (this->bvh.SAHCost() > this->bvh.buildCost * this->refitRebuildThreshold)
+    {
+        this->BuildAccelerationStructure();
+        return true;
+    }
+
+    // the wide trees keep the topology they were collapsed into, only their bounds follow
+    switch (this->activeStructure)
+    {
+    case AccelerationStructure::BVH4:
+        this->bvh4.Refit(this->primBounds);
+        break;
+    case AccelerationStructure::BVH8:
+        this->bvh8.Refit(this->primBounds);
+        break;
+    case AccelerationStructure::QuantizedBVH4:
+        this->qbvh4.Refit(this->primBounds);
+        break;
+    case AccelerationStructure::QuantizedBVH8:
+        this->qbvh8.Refit(this->primBounds);
+        break;
+    default:
+        break;
+    }
+    this->UpdatePrimitives();
+    return false;
+}
 
 //------------------------------------------------------------------------------
 /**
@@ -144,7 +722,7 @@ Raytracer::UpdateMatrices()
 Color
 Raytracer::Skybox(vec3 direction)
 {
-    float t = 0.5 * (direction.y + 1.0);
-    vec3 vec = vec3(1.0, 1.0, 1.0) * (1.0 - t) + vec3(0.5, 0.7, 1.0) * t;
-    return { (float)vec.x, (float)vec.y, (float)vec.z };
+    float t = 0.5f * (direction.y + 1.0f);
+    vec3 vec = vec3(1.0f, 1.0f, 1.0f) * (1.0f - t) + vec3(0.5f, 0.7f, 1.0f) * t;
+    return { vec.x, vec.y, vec.z };
 }
@@ -5,8 +5,56 @@
 #include "color.h"
 #include "ray.h"
 #include "object.h"
+#include "bvh.h"
+#include "widebvh.h"
+#include "quantizedbvh.h"
+#include "grid.h"
+#include "primitivestore.h"
+#include "accelerationcache.h"
+#include "wavefront.h"
+#include "threadpool.h"
+#include <string>
 #include <float.h>
 
+//------------------------------------------------------------------------------
+/**
+    Acceleration structures that Raycast can use
+*/
+enum class AccelerationStructure
+{
+    // test every object, in the order they were added
+    BruteForce,
+    // bounding volume hierarchy over all bounded objects
+    BVH,
+    // the bvh collapsed to 4 children per node, tested with SSE
+    BVH4,
+    // the bvh collapsed to 8 children per node, tested with AVX
+    BVH8,
+    // BVH4 with child bounds quantized to 8 bits, 52 byte nodes instead of 128
+    QuantizedBVH4,
+    // BVH8 with child bounds quantized to 8 bits, 80 byte nodes instead of 320
+    QuantizedBVH8,
+    // uniform grid over all bounded objects
+    Grid,
+    // pick one of BruteForce, Grid and BVH8 from scene statistics at build time
+    Auto,
+};
+
+//------------------------------------------------------------------------------
+/**
+    Ways Raytrace can follow paths
+*/
+enum class Integrator
+{
+    // TracePath follows one path at a time to its end
+    Recursive,
+    // WavefrontIntegrator advances all paths of a frame one bounce at a time
+    Wavefront,
+    // preview, shades the first hit by the fraction of aoSamples rays around its
+    // normal that are not occluded within aoDistance
+    AmbientOcclusion,
+};
+
 //------------------------------------------------------------------------------
 /**
 */
@@ -16,15 +64,36 @@ public:
     Raytracer(unsigned w, unsigned h, std::vector<Color>& frameBuffer, unsigned rpp, unsigned bounces);
     ~Raytracer() { }
 
-    // start raytracing!
+    // start raytracing! The frame is rendered in tiles of TileSize pixels on numThreads threads
     void Raytrace();
 
     // add object to scene
     void AddObject(Object* obj);
 
+    // objects in the scene, in the order they were added
+    std::vector<Object*> const& GetObjects() const { return this->objects; }
+
+    // path queues and statistics of Integrator::Wavefront
+    WavefrontIntegrator& GetWavefront() { return this->wavefront; }
+
+    // threads Raytrace renders on, started by the first frame and kept
+    ThreadPool& GetThreadPool() { return this->threadPool; }
+
     // single raycast, find object
     bool Raycast(Ray ray, vec3& hitPoint, vec3& hitNormal, Object*& hitObject, float& distance);
 
+    // true if anything is hit along ray before maxDist. Stops at the first hit it finds and
+    // computes neither hit point nor normal, for shadow rays and other visibility queries
+    bool Occluded(Ray ray, float maxDist);
+
+    // (re)build acceleration structures. Called automatically when the scene has changed
+    void BuildAccelerationStructure();
+
+    // update acceleration structures after objects have moved or resized, but none were added.
+    // the bvh is refit in place, and rebuilt once its quality has degraded too much.
+    // returns true if it was rebuilt
+    bool RefitAccelerationStructure();
+
     // set camera matrix
     void SetViewMatrix(mat4 val);
 
@@ -34,10 +103,6 @@ public:
     // update matrices. Called automatically after setting view matrix
     void UpdateMatrices();
 
-    // trace a path and return intersection color
-    // n is bounce depth
-    Color TracePath(Ray ray, unsigned n);
-
     // get the color of the skybox in a direction
     Color Skybox(vec3 direction);
 
@@ -48,6 +113,59 @@ public:
     // max number of bounces before termination
     unsigned bounces = 5;
 
+    // acceleration structure used by Raycast
+    AccelerationStructure accelerationStructure = AccelerationStructure::Auto;
+    // construction algorithm for the bvh
+    BVHBuilder bvhBuilder = BVHBuilder::SAH;
+    // node layout of the binary and wide trees
+    BVHLayout bvhLayout = BVHLayout::DepthFirst;
+    // refitting rebuilds the bvh once its SAH cost exceeds the cost at build time by this factor
+    float refitRebuildThreshold = 1.5f;
+    // intersect objects through the per type arrays of ScenePrimitives, spheres with the SIMD
+    // kernels of SphereSoA. false calls the virtual Object::Intersect one object at a time
+    bool staticDispatch = true;
+    // how paths are traced, Recursive and Wavefront converge to the same image
+    Integrator integrator = Integrator::Recursive;
+    // rays per hit of Integrator::AmbientOcclusion, and the distance they look for occluders in
+    unsigned aoSamples = 8;
+    float aoDistance = 1.0f;
+    // the wavefront integrator sorts scattered rays by direction and origin before tracing them
+    bool sortSecondaryRays = false;
+    // primary rays are traced in packets of 4, 8 or 16, from tiles of 2x2, 4x2 or 4x4 pixels.
+    // Packets walk the binary bvh, so they are used with BruteForce, BVH, BVH4 and BVH8 and
+    // staticDispatch. Any other size traces primary rays one at a time.
+    // Only used by the recursive integrator
+    unsigned packetSize = 16;
+
+    // threads Raytrace renders tiles on, 0 for one per core. The wavefront integrator
+    // traces its rays on them, and shades on the calling thread. They are kept in a
+    // pool between frames, changing this restarts them at the next frame
+    unsigned numThreads = 0;
+    // tiles idle threads took over from busy ones during the last frame
+    unsigned tileSteals = 0;
+    // frames rendered so far. Frame f draws samples f * rpp to (f + 1) * rpp - 1 of every pixel
+    unsigned frameIndex = 0;
+    // pin the threads to cores, spread evenly over the memory nodes, and move memory next to
+    // the threads that use it. The rows of the frame buffer go to the node whose threads start
+    // on their tiles, the scene and structure arrays to transparent huge pages, interleaved over
+    // the nodes as every thread reads them. Tiles that are stolen are written across nodes.
+    // Takes effect at the next frame, see PlaceMemory
+    bool numaPlacement = false;
+
+    // directory for cached trees, keyed by a hash of the object bounds. Empty disables the cache.
+    // Only trees are cached, grids build in linear time anyway
+    std::string accelerationCacheDirectory;
+
+    // width and height of the tiles of Raytrace, a multiple of the packet tiles
+    static constexpr unsigned TileSize = 16;
+
+    // AccelerationStructure::Auto tests every object up to this many objects,
+    static constexpr unsigned AutoBruteForceLimit = 16;
+    // and uses a grid if the coefficient of variation of object sizes is below this,
+    static constexpr float AutoMaxSizeVariation = 0.5f;
+    // and at least this fraction of grid cells hold an object
+    static constexpr float AutoMinOccupancy = 0.3f;
+
     // width of framebuffer
     const unsigned width;
     // height of framebuffer
@@ -64,12 +182,71 @@ public:
     mat4 frustum;
 
 private:
+    // the loops of Raytrace, Raycast and Occluded, compiled per instruction set
+    template<class> friend class RaytracerKernels;
+
+    // true if the active structure can trace packets
+    bool PacketsSupported() const;
+
+    void UpdateWideBVH();
+    // sort the objects into the primitive store, in the primitive order of the active structure
+    void UpdatePrimitives();
+    // choose the structure for AccelerationStructure::Auto and report the choice
+    AccelerationStructure SelectAccelerationStructure();
+    // place the frame buffer and the scene arrays for numaPlacement, those that have
+    // not been placed since they were allocated
+    void PlaceMemory();
+
+    // size of a node of the active layout, for the cache
+    unsigned LayoutNodeSize() const;
+    // file of the cache for a key
+    std::string AccelerationCachePath(unsigned long long key) const;
+    // attach the trees to a mapped cache file, returns false if there is no valid one
+    bool LoadAccelerationCache(unsigned long long key);
+    void SaveAccelerationCache(unsigned long long key);
+
     std::vector<Object*> objects;
+
+    // true if objects have been added since the last build
+    bool sceneDirty = true;
+    // requested structure at the last build
+    AccelerationStructure builtStructure = AccelerationStructure::BruteForce;
+    // structure in use, differs from the requested one for Auto
+    AccelerationStructure activeStructure = AccelerationStructure::BruteForce;
+    // objects with finite bounds, indexed by the bvh
+    std::vector<Object*> boundedObjects;
+    // objects without bounds, tested against every ray
+    std::vector<Object*> unboundedObjects;
+    // bounds of boundedObjects, kept around for refitting
+    std::vector<BBox> primBounds;
+    BVH bvh;
+    WideBVH<4> bvh4;
+    WideBVH<8> bvh8;
+    QuantizedBVH<4> qbvh4;
+    QuantizedBVH<8> qbvh8;
+    UniformGrid grid;
+    // boundedObjects in the primitive order of the active structure, or all objects for brute force
+    ScenePrimitives primitives;
+    // unboundedObjects, in the order they were added
+    ScenePrimitives unboundedPrimitives;
+    // cache file the trees are attached to, if they were loaded
+    MappedFile accelerationCache;
+    // path queues, kept between frames
+    WavefrontIntegrator wavefront;
+    // workers of Raytrace, kept between frames
+    ThreadPool threadPool;
+    // frame buffer and threads its rows were placed for
+    Color const* placedFrameBuffer = nullptr;
+    unsigned placedThreads = 0;
+    // scene arrays placed by the last PlaceMemory, and those of the current one
+    std::vector<std::pair<void const*, size_t>> placedBuffers;
+    std::vector<std::pair<void const*, size_t>> sceneBuffers;
 };
 
 inline void Raytracer::AddObject(Object* o)
 {
     this->objects.push_back(o);
+    this->sceneDirty = true;
 }
 
 inline void Raytracer::SetViewMatrix(mat4 val)
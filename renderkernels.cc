@@ -0,0 +1,40 @@
+#include "renderkernels.h"
+#include "cpufeatures.h"
+
+// the baseline kernels, compiled with the flags of the rest of the build
+namespace TRAYRACER_ISA
+{
+RenderKernels const Kernels = RaytracerKernels<Isa>::Table();
+}
+
+#if TRAYRACER_DISPATCH
+// the kernels of renderkernelsavx2.cc and renderkernelsavx512.cc
+namespace avx2
+{
+extern RenderKernels const Kernels;
+}
+namespace avx512
+{
+extern RenderKernels const Kernels;
+}
+#endif
+
+//------------------------------------------------------------------------------
+/**
+*/
+RenderKernels const&
+GetRenderKernels()
+{
+#if TRAYRACER_DISPATCH
+    switch (GetInstructionSet())
+    {
+    case InstructionSet::AVX512:
+        return avx512::Kernels;
+    case InstructionSet::AVX2:
+        return avx2::Kernels;
+    default:
+        break;
+    }
+#endif
+    return TRAYRACER_ISA::Kernels;
+}
@@ -0,0 +1,473 @@
+#pragma once
+#include "raytracer.h"
+#include "pbr.h"
+#include "random.h"
+
+//------------------------------------------------------------------------------
+/**
+    Entry points of the render kernels of one instruction set
+*/
+struct RenderKernels
+{
+    // the recursive and ambient occlusion integrators on the pixels [x0, x1) x [y0, y1),
+    // samples firstSample to firstSample + rpp of each pixel, after the structure is built
+    void (*raytraceTile)(Raytracer& rt, unsigned x0, unsigned y0, unsigned x1, unsigned y1, unsigned firstSample);
+    // closest hit before hit.t, fills hit
+    bool (*raycast)(Raytracer& rt, Ray const& ray, HitResult& hit);
+    // true if anything is hit before maxDist
+    bool (*occluded)(Raytracer& rt, Ray const& ray, float maxDist);
+};
+
+// kernels of GetInstructionSet, see cpufeatures.h
+RenderKernels const& GetRenderKernels();
+
+//------------------------------------------------------------------------------
+/**
+    The hot loops of Raytracer: camera rays, paths, shading and the walks
+    of the acceleration structures down to the primitive kernels. They are
+    compiled once per instruction set, by renderkernels.cc for the baseline
+    and by renderkernelsavx2.cc and renderkernelsavx512.cc with the flags of
+    their level, and Raytracer calls the ones GetRenderKernels picks.
+
+    ISA is the Isa tag of simd.h, so every instruction set has its own
+    instance, and everything the kernels inline comes from the namespace of
+    that instruction set. A file compiling the kernels defines
+    TRAYRACER_ISA before its first include.
+*/
+template<class ISA>
+class RaytracerKernels
+{
+public:
+    // render the pixels [x0, x1) x [y0, y1) with Raytracer::integrator, Recursive or AmbientOcclusion,
+    // adding samples firstSample to firstSample + rpp. Tiles of a frame may run on several threads at once
+    static void RaytraceTile(Raytracer& rt, unsigned x0, unsigned y0, unsigned x1, unsigned y1, unsigned firstSample);
+    // trace a path and return intersection color
+    // n is bounce depth, random the numbers of the path for scattering at the hit
+    static Color TracePath(Raytracer& rt, Ray ray, unsigned n, RandomStream random);
+    // color of a path that hit object at the given point, continues it with a scattered ray
+    static Color Shade(Raytracer& rt, Ray ray, vec3 hitPoint, vec3 hitNormal, Object* hitObject, unsigned n, RandomStream random);
+    // color of a camera ray for Integrator::AmbientOcclusion, random is drawn for the occlusion rays
+    static Color AmbientOcclusion(Raytracer& rt, Ray ray, RandomStream random);
+    // closest hit before hit.t, fills hit. The structure must be built
+    static bool Raycast(Raytracer& rt, Ray const& ray, HitResult& hit);
+    // true if anything is hit before maxDist. The structure must be built
+    static bool Occluded(Raytracer& rt, Ray const& ray, float maxDist);
+
+    // entry points for GetRenderKernels
+    static constexpr RenderKernels Table() { return { &RaytraceTile, &Raycast, &Occluded }; }
+
+private:
+    // RaytraceTile with primary rays in packets of N
+    template<unsigned N>
+    static void RaytracePackets(Raytracer& rt, unsigned x0, unsigned y0, unsigned x1, unsigned y1, unsigned firstSample);
+    // closest hits of the lanes of mask, returns the lanes that hit something
+    template<unsigned N>
+    static unsigned RaycastPacket(Raytracer& rt, Ray const* rays, unsigned mask, HitResult* hits);
+};
+
+//------------------------------------------------------------------------------
+/**
+    The structure must be built
+*/
+template<class ISA>
+inline void
+RaytracerKernels<ISA>::RaytraceTile(Raytracer& rt, unsigned x0, unsigned y0, unsigned x1, unsigned y1, unsigned firstSample)
+{
+    if (rt.integrator == Integrator::Recursive && rt.PacketsSupported())
+    {
+        switch (rt.packetSize)
+        {
+        case 4:
+            RaytracePackets<4>(rt, x0, y0, x1, y1, firstSample);
+            return;
+        case 8:
+            RaytracePackets<8>(rt, x0, y0, x1, y1, firstSample);
+            return;
+        case 16:
+            RaytracePackets<16>(rt, x0, y0, x1, y1, firstSample);
+            return;
+        default:
+            break;
+        }
+    }
+
+    for (unsigned x = x0; x < x1; ++x)
+    {
+        for (unsigned y = y0; y < y1; ++y)
+        {
+            Color color;
+            for (unsigned i = 0; i < rt.rpp; ++i)
+            {
+                RandomStream random(y * rt.width + x, firstSample + i, RandomStream::CameraBounce);
+                float u = ((float(x + random.Next()) * (1.0f / rt.width)) * 2.0f) - 1.0f;
+                float v = ((float(y + random.Next()) * (1.0f / rt.height)) * 2.0f) - 1.0f;
+
+                vec3 direction = vec3(u, v, -1.0f);
+                direction = transform(direction, rt.frustum);
+
+                Ray ray(get_position(rt.view), direction);
+                if (rt.integrator == Integrator::AmbientOcclusion)
+                    color += AmbientOcclusion(rt, ray, random.NextBounce());
+                else
+                    color += TracePath(rt, ray, 0, random.NextBounce());
+            }
+
+            // divide by number of samples per pixel, to get the average of the distribution
+            color.r /= rt.rpp;
+            color.g /= rt.rpp;
+            color.b /= rt.rpp;
+
+            rt.frameBuffer[y * rt.width + x] += color;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Same sampling as RaytraceTile, a packet tile of pixels at a time. Each
+    sample traces the primary rays of the packet tile as one packet, and
+    continues every path on its own from its first hit.
+*/
+template<class ISA>
+template<unsigned N>
+inline void
+RaytracerKernels<ISA>::RaytracePackets(Raytracer& rt, unsigned tx0, unsigned ty0, unsigned tx1, unsigned ty1, unsigned firstSample)
+{
+    constexpr unsigned tileWidth = N == 4 ? 2 : 4;
+    constexpr unsigned tileHeight = N / tileWidth;
+    vec3 origin = get_position(rt.view);
+
+    for (unsigned y0 = ty0; y0 < ty1; y0 += tileHeight)
+    {
+        for (unsigned x0 = tx0; x0 < tx1; x0 += tileWidth)
+        {
+            // lanes of pixels within the tile
+            unsigned mask = 0;
+            for (unsigned lane = 0; lane < N; lane++)
+            {
+                if (x0 + lane % tileWidth < tx1 && y0 + lane / tileWidth < ty1)
+                    mask |= 1u << lane;
+            }
+
+            Color colors[N];
+            for (unsigned i = 0; i < rt.rpp; ++i)
+            {
+                Ray rays[N];
+                for (unsigned lanes = mask; lanes != 0; lanes &= lanes - 1)
+                {
+                    unsigned lane = FirstLane(lanes);
+                    unsigned x = x0 + lane % tileWidth;
+                    unsigned y = y0 + lane / tileWidth;
+                    RandomStream random(y * rt.width + x, firstSample + i, RandomStream::CameraBounce);
+                    float u = ((float(x + random.Next()) * (1.0f / rt.width)) * 2.0f) - 1.0f;
+                    float v = ((float(y + random.Next()) * (1.0f / rt.height)) * 2.0f) - 1.0f;
+                    rays[lane] = Ray(origin, transform(vec3(u, v, -1.0f), rt.frustum));
+                }
+
+                HitResult hits[N];
+                unsigned hitMask = RaycastPacket<N>(rt, rays, mask, hits);
+                for (unsigned lanes = mask; lanes != 0; lanes &= lanes - 1)
+                {
+                    unsigned lane = FirstLane(lanes);
+                    RandomStream random((y0 + lane / tileWidth) * rt.width + x0 + lane % tileWidth, firstSample + i, RandomStream::CameraBounce + 1);
+                    if (hitMask & (1u << lane))
+                        colors[lane] += Shade(rt, rays[lane], hits[lane].p, hits[lane].normal, hits[lane].object, 0, random);
+                    else
+                        colors[lane] += rt.Skybox(rays[lane].m);
+                }
+            }
+
+            for (unsigned lanes = mask; lanes != 0; lanes &= lanes - 1)
+            {
+                unsigned lane = FirstLane(lanes);
+                Color color = colors[lane];
+                // divide by number of samples per pixel, to get the average of the distribution
+                color.r /= rt.rpp;
+                color.g /= rt.rpp;
+                color.b /= rt.rpp;
+                rt.frameBuffer[(y0 + lane / tileWidth) * rt.width + x0 + lane % tileWidth] += color;
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+ * @parameter n - the current bounce level
+*/
+template<class ISA>
+inline Color
+RaytracerKernels<ISA>::TracePath(Raytracer& rt, Ray ray, unsigned n, RandomStream random)
+{
+    HitResult hit;
+    if (Raycast(rt, ray, hit))
+        return Shade(rt, ray, hit.p, hit.normal, hit.object, n, random);
+
+    return rt.Skybox(ray.m);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Objects that scatter with a material go through the BSDF of this
+    instruction set, only the others through Object::ScatterRay
+*/
+template<class ISA>
+inline Color
+RaytracerKernels<ISA>::Shade(Raytracer& rt, Ray ray, vec3 hitPoint, vec3 hitNormal, Object* hitObject, unsigned n, RandomStream random)
+{
+    Material const* material = hitObject->GetMaterial();
+    Ray scatteredRay = material != nullptr ? BSDF(material, ray, hitPoint, hitNormal, random) : hitObject->ScatterRay(ray, hitPoint, hitNormal, random);
+    if (n < rt.bounces)
+    {
+        return hitObject->GetColor() * TracePath(rt, scatteredRay, n + 1, random.NextBounce());
+    }
+    else
+    {
+        return { 0, 0, 0 };
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Directions are cosine weighted around the normal, like the diffuse lobe of BSDF
+*/
+template<class ISA>
+inline Color
+RaytracerKernels<ISA>::AmbientOcclusion(Raytracer& rt, Ray ray, RandomStream random)
+{
+    HitResult hit;
+    if (!Raycast(rt, ray, hit))
+        return rt.Skybox(ray.m);
+
+    unsigned open = 0;
+    for (unsigned i = 0; i < rt.aoSamples; i++)
+    {
+        Ray aoRay(hit.p, normalize(normalize(hit.normal) + random_point_on_unit_sphere(random)));
+        if (!Occluded(rt, aoRay, rt.aoDistance))
+            open++;
+    }
+    float ao = rt.aoSamples > 0 ? (float)open / rt.aoSamples : 1.0f;
+    return { ao, ao, ao };
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<class ISA>
+inline bool
+RaytracerKernels<ISA>::Raycast(Raytracer& rt, Ray const& ray, HitResult& closestHit)
+{
+    bool isHit = false;
+
+    auto intersect = [&](Object* object)
+    {
+        if (object->Intersect(ray, closestHit.t, closestHit))
+            isHit = true;
+    };
+
+    auto intersectPrim = [&](unsigned prim)
+    {
+        intersect(rt.boundedObjects[prim]);
+    };
+
+    ScenePrimitives::PreparedRay prepared(ray);
+    auto intersectLeaf = [&](unsigned first, unsigned count)
+    {
+        if (rt.primitives.Intersect(ray, prepared, first, count, closestHit))
+            isHit = true;
+    };
+
+    auto traverse = [&](auto const& tree)
+    {
+        if (rt.staticDispatch)
+            tree.IntersectLeaves(ray, closestHit.t, intersectLeaf);
+        else
+            tree.Intersect(ray, closestHit.t, intersectPrim);
+    };
+
+    if (rt.activeStructure == AccelerationStructure::BruteForce)
+    {
+        if (rt.staticDispatch)
+        {
+            intersectLeaf(0, rt.primitives.Count());
+        }
+        else
+        {
+            for (Object* object : rt.objects)
+                intersect(object);
+        }
+    }
+    else
+    {
+        // unbounded objects first, they usually shrink the search distance the most
+        if (rt.staticDispatch)
+        {
+            if (rt.unboundedPrimitives.Intersect(ray, prepared, 0, rt.unboundedPrimitives.Count(), closestHit))
+                isHit = true;
+        }
+        else
+        {
+            for (Object* object : rt.unboundedObjects)
+                intersect(object);
+        }
+
+        switch (rt.activeStructure)
+        {
+        case AccelerationStructure::BVH4:
+            traverse(rt.bvh4);
+            break;
+        case AccelerationStructure::BVH8:
+            traverse(rt.bvh8);
+            break;
+        case AccelerationStructure::QuantizedBVH4:
+            traverse(rt.qbvh4);
+            break;
+        case AccelerationStructure::QuantizedBVH8:
+            traverse(rt.qbvh8);
+            break;
+        case AccelerationStructure::Grid:
+            // the slots are in object order, a cell lists single slots
+            if (rt.staticDispatch)
+                rt.grid.Intersect(ray, closestHit.t, [&](unsigned prim) { intersectLeaf(prim, 1); });
+            else
+                rt.grid.Intersect(ray, closestHit.t, intersectPrim);
+            break;
+        default:
+            traverse(rt.bvh);
+            break;
+        }
+    }
+
+    return isHit;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The walk of Raycast, ended by a negative search distance at the first hit
+*/
+template<class ISA>
+inline bool
+RaytracerKernels<ISA>::Occluded(Raytracer& rt, Ray const& ray, float maxDist)
+{
+    bool occluded = false;
+    float tMax = maxDist;
+
+    auto test = [&](Object* object)
+    {
+        if (!occluded && object->Occluded(ray, maxDist))
+        {
+            occluded = true;
+            tMax = -FLT_MAX;
+        }
+    };
+
+    auto testPrim = [&](unsigned prim)
+    {
+        test(rt.boundedObjects[prim]);
+    };
+
+    ScenePrimitives::PreparedRay prepared(ray);
+    auto testLeaf = [&](unsigned first, unsigned count)
+    {
+        if (rt.primitives.Occluded(ray, prepared, first, count, maxDist))
+        {
+            occluded = true;
+            tMax = -FLT_MAX;
+        }
+    };
+
+    auto traverse = [&](auto const& tree)
+    {
+        if (rt.staticDispatch)
+            tree.IntersectLeaves(ray, tMax, testLeaf);
+        else
+            tree.Intersect(ray, tMax, testPrim);
+    };
+
+    if (rt.activeStructure == AccelerationStructure::BruteForce)
+    {
+        if (rt.staticDispatch)
+        {
+            testLeaf(0, rt.primitives.Count());
+        }
+        else
+        {
+            for (Object* object : rt.objects)
+                test(object);
+        }
+        return occluded;
+    }
+
+    if (rt.staticDispatch)
+    {
+        if (rt.unboundedPrimitives.Occluded(ray, prepared, 0, rt.unboundedPrimitives.Count(), maxDist))
+            return true;
+    }
+    else
+    {
+        for (Object* object : rt.unboundedObjects)
+            test(object);
+        if (occluded)
+            return true;
+    }
+
+    switch (rt.activeStructure)
+    {
+    case AccelerationStructure::BVH4:
+        traverse(rt.bvh4);
+        break;
+    case AccelerationStructure::BVH8:
+        traverse(rt.bvh8);
+        break;
+    case AccelerationStructure::QuantizedBVH4:
+        traverse(rt.qbvh4);
+        break;
+    case AccelerationStructure::QuantizedBVH8:
+        traverse(rt.qbvh8);
+        break;
+    case AccelerationStructure::Grid:
+        if (rt.staticDispatch)
+            rt.grid.Intersect(ray, tMax, [&](unsigned prim) { testLeaf(prim, 1); });
+        else
+            rt.grid.Intersect(ray, tMax, testPrim);
+        break;
+    default:
+        traverse(rt.bvh);
+        break;
+    }
+    return occluded;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The structure must be built, and support packets
+*/
+template<class ISA>
+template<unsigned N>
+inline unsigned
+RaytracerKernels<ISA>::RaycastPacket(Raytracer& rt, Ray const* rays, unsigned mask, HitResult* hits)
+{
+    alignas(64) float tMax[N];
+    for (unsigned lane = 0; lane < N; lane++)
+        tMax[lane] = hits[lane].t = FLT_MAX;
+    unsigned hitMask = 0;
+
+    ScenePrimitives::PreparedPacket<N> prepared(rays);
+    auto leaf = [&](unsigned first, unsigned count, unsigned lanes)
+    {
+        hitMask |= rt.primitives.IntersectPacket(rays, prepared, lanes, first, count, tMax, hits);
+    };
+
+    if (rt.activeStructure == AccelerationStructure::BruteForce)
+    {
+        leaf(0, rt.primitives.Count(), mask);
+    }
+    else
+    {
+        hitMask |= rt.unboundedPrimitives.IntersectPacket(rays, prepared, mask, 0, rt.unboundedPrimitives.Count(), tMax, hits);
+        BVHPacket<N> packet(rays, N);
+        rt.bvh.IntersectPacket(packet, mask, tMax, leaf);
+    }
+
+    return hitMask;
+}
@@ -0,0 +1,13 @@
+// the render kernels compiled for AVX2 and FMA, picked by GetRenderKernels on cpus that have them
+#define TRAYRACER_ISA avx2
+#include "renderkernels.h"
+
+#if !defined(__AVX2__)
+#error "renderkernelsavx2.cc must be compiled with AVX2 and FMA enabled, see CMakeLists.txt"
+#endif
+
+namespace TRAYRACER_ISA
+{
+extern RenderKernels const Kernels;
+RenderKernels const Kernels = RaytracerKernels<Isa>::Table();
+}
@@ -0,0 +1,13 @@
+// the render kernels compiled for AVX-512, picked by GetRenderKernels on cpus that have it
+#define TRAYRACER_ISA avx512
+#include "renderkernels.h"
+
+#if !defined(__AVX512F__)
+#error "renderkernelsavx512.cc must be compiled with AVX-512 enabled, see CMakeLists.txt"
+#endif
+
+namespace TRAYRACER_ISA
+{
+extern RenderKernels const Kernels;
+RenderKernels const Kernels = RaytracerKernels<Isa>::Table();
+}
@@ -0,0 +1,317 @@
+#pragma once
+//------------------------------------------------------------------------------
+/**
+    Thin wrappers around SSE, AVX and AVX-512 registers, so that kernels can be
+    written once for any width. Without AVX, 8 wide vectors are emulated with
+    two SSE registers, without AVX-512 16 wide vectors with two 8 wide ones.
+    Without SSE everything falls back to plain loops.
+*/
+//------------------------------------------------------------------------------
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRAYRACER_SSE 1
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX__)
+#define TRAYRACER_AVX 1
+#endif
+
+#if defined(__AVX512F__)
+#define TRAYRACER_AVX512 1
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SIMD_INLINE __forceinline
+#else
+#define SIMD_INLINE inline __attribute__((always_inline))
+#endif
+
+//------------------------------------------------------------------------------
+/**
+    4 wide float vector
+*/
+struct vfloat4
+{
+#if TRAYRACER_SSE
+    __m128 v;
+
+    static SIMD_INLINE vfloat4 Load(float const* p) { return { _mm_loadu_ps(p) }; }
+    static SIMD_INLINE vfloat4 Broadcast(float f) { return { _mm_set1_ps(f) }; }
+    static SIMD_INLINE vfloat4 Set(float x, float y, float z, float w) { return { _mm_setr_ps(x, y, z, w) }; }
+    // convert 4 unsigned bytes
+    static SIMD_INLINE vfloat4 LoadBytes(unsigned char const* p)
+    {
+        int bytes;
+        memcpy(&bytes, p, sizeof(bytes));
+        __m128i zero = _mm_setzero_si128();
+        __m128i i = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+        return { _mm_cvtepi32_ps(i) };
+    }
+    SIMD_INLINE void Store(float* p) const { _mm_storeu_ps(p, this->v); }
+
+    friend SIMD_INLINE vfloat4 operator+(vfloat4 a, vfloat4 b) { return { _mm_add_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat4 operator-(vfloat4 a, vfloat4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat4 operator*(vfloat4 a, vfloat4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat4 operator/(vfloat4 a, vfloat4 b) { return { _mm_div_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat4 Min(vfloat4 a, vfloat4 b) { return { _mm_min_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat4 Max(vfloat4 a, vfloat4 b) { return { _mm_max_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat4 Sqrt(vfloat4 a) { return { _mm_sqrt_ps(a.v) }; }
+
+    // comparisons return lane masks, turned into bits with Mask()
+    friend SIMD_INLINE vfloat4 operator<(vfloat4 a, vfloat4 b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat4 operator<=(vfloat4 a, vfloat4 b) { return { _mm_cmple_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat4 operator>(vfloat4 a, vfloat4 b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat4 operator>=(vfloat4 a, vfloat4 b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat4 operator&(vfloat4 a, vfloat4 b) { return { _mm_and_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat4 operator|(vfloat4 a, vfloat4 b) { return { _mm_or_ps(a.v, b.v) }; }
+    // pick b where mask is set, a elsewhere
+    friend SIMD_INLINE vfloat4 Select(vfloat4 mask, vfloat4 a, vfloat4 b) { return { _mm_or_ps(_mm_andnot_ps(mask.v, a.v), _mm_and_ps(mask.v, b.v)) }; }
+    friend SIMD_INLINE unsigned Mask(vfloat4 a) { return (unsigned)_mm_movemask_ps(a.v); }
+
+    // lanes 1, 2, 0, 3, for cross products
+    friend SIMD_INLINE vfloat4 RotateXYZ(vfloat4 a) { return { _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(3, 0, 2, 1)) }; }
+    // sum of all lanes
+    friend SIMD_INLINE float Sum(vfloat4 a)
+    {
+        __m128 pairs = _mm_add_ps(a.v, _mm_shuffle_ps(a.v, a.v, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_movehl_ps(pairs, pairs)));
+    }
+#else
+    float v[4];
+
+    static SIMD_INLINE vfloat4 Load(float const* p) { vfloat4 r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+    static SIMD_INLINE vfloat4 Broadcast(float f) { vfloat4 r; for (int i = 0; i < 4; i++) r.v[i] = f; return r; }
+    static SIMD_INLINE vfloat4 Set(float x, float y, float z, float w) { return { { x, y, z, w } }; }
+    static SIMD_INLINE vfloat4 LoadBytes(unsigned char const* p) { vfloat4 r; for (int i = 0; i < 4; i++) r.v[i] = p[i]; return r; }
+    SIMD_INLINE void Store(float* p) const { for (int i = 0; i < 4; i++) p[i] = this->v[i]; }
+
+#define VFLOAT4_OP(expr) vfloat4 r; for (int i = 0; i < 4; i++) r.v[i] = (expr); return r;
+#define VFLOAT4_CMP(cond) vfloat4 r; for (int i = 0; i < 4; i++) r.v[i] = (cond) ? Ones() : 0.0f; return r;
+    static SIMD_INLINE float Ones() { union { unsigned i; float f; } u; u.i = 0xFFFFFFFFu; return u.f; }
+    static SIMD_INLINE unsigned Bits(float f) { union { float f; unsigned i; } u; u.f = f; return u.i; }
+    static SIMD_INLINE float Float(unsigned i) { union { unsigned i; float f; } u; u.i = i; return u.f; }
+
+    friend SIMD_INLINE vfloat4 operator+(vfloat4 a, vfloat4 b) { VFLOAT4_OP(a.v[i] + b.v[i]) }
+    friend SIMD_INLINE vfloat4 operator-(vfloat4 a, vfloat4 b) { VFLOAT4_OP(a.v[i] - b.v[i]) }
+    friend SIMD_INLINE vfloat4 operator*(vfloat4 a, vfloat4 b) { VFLOAT4_OP(a.v[i] * b.v[i]) }
+    friend SIMD_INLINE vfloat4 operator/(vfloat4 a, vfloat4 b) { VFLOAT4_OP(a.v[i] / b.v[i]) }
+    friend SIMD_INLINE vfloat4 Min(vfloat4 a, vfloat4 b) { VFLOAT4_OP(a.v[i] < b.v[i] ? a.v[i] : b.v[i]) }
+    friend SIMD_INLINE vfloat4 Max(vfloat4 a, vfloat4 b) { VFLOAT4_OP(a.v[i] > b.v[i] ? a.v[i] : b.v[i]) }
+    friend SIMD_INLINE vfloat4 Sqrt(vfloat4 a) { VFLOAT4_OP(sqrtf(a.v[i])) }
+    friend SIMD_INLINE vfloat4 operator<(vfloat4 a, vfloat4 b) { VFLOAT4_CMP(a.v[i] < b.v[i]) }
+    friend SIMD_INLINE vfloat4 operator<=(vfloat4 a, vfloat4 b) { VFLOAT4_CMP(a.v[i] <= b.v[i]) }
+    friend SIMD_INLINE vfloat4 operator>(vfloat4 a, vfloat4 b) { VFLOAT4_CMP(a.v[i] > b.v[i]) }
+    friend SIMD_INLINE vfloat4 operator>=(vfloat4 a, vfloat4 b) { VFLOAT4_CMP(a.v[i] >= b.v[i]) }
+    friend SIMD_INLINE vfloat4 operator&(vfloat4 a, vfloat4 b) { VFLOAT4_OP(Float(Bits(a.v[i]) & Bits(b.v[i]))) }
+    friend SIMD_INLINE vfloat4 operator|(vfloat4 a, vfloat4 b) { VFLOAT4_OP(Float(Bits(a.v[i]) | Bits(b.v[i]))) }
+    friend SIMD_INLINE vfloat4 Select(vfloat4 mask, vfloat4 a, vfloat4 b) { VFLOAT4_OP(Bits(mask.v[i]) ? b.v[i] : a.v[i]) }
+    friend SIMD_INLINE unsigned Mask(vfloat4 a)
+    {
+        unsigned m = 0;
+        for (int i = 0; i < 4; i++)
+            m |= (Bits(a.v[i]) >> 31) << i;
+        return m;
+    }
+    friend SIMD_INLINE vfloat4 RotateXYZ(vfloat4 a) { return Set(a.v[1], a.v[2], a.v[0], a.v[3]); }
+    friend SIMD_INLINE float Sum(vfloat4 a) { return (a.v[0] + a.v[1]) + (a.v[2] + a.v[3]); }
+#undef VFLOAT4_OP
+#undef VFLOAT4_CMP
+#endif
+};
+
+//------------------------------------------------------------------------------
+/**
+    The wider vectors, and everything else whose code differs between
+    instruction sets, live in a namespace named after the instruction set the
+    file is compiled for. The render kernels are compiled once per level, see
+    renderkernels.h, and the namespace keeps the copies from being merged by
+    the linker. vfloat4 is the same SSE register at every level.
+
+    Shared classes stay outside of it, so the inline members the kernels call
+    on them are SIMD_INLINE, and the kernels call the C float functions, such
+    as sqrtf, instead of the float overloads of <cmath>. Neither is emitted
+    out of line, where the linker could pick the copy of any level.
+*/
+#ifndef TRAYRACER_ISA
+#define TRAYRACER_ISA baseline
+#endif
+
+namespace TRAYRACER_ISA
+{
+
+// tag type, instantiates templates once per instruction set
+struct Isa {};
+
+//------------------------------------------------------------------------------
+/**
+    8 wide float vector
+*/
+struct vfloat8
+{
+#if TRAYRACER_AVX
+    __m256 v;
+
+    static SIMD_INLINE vfloat8 Load(float const* p) { return { _mm256_loadu_ps(p) }; }
+    static SIMD_INLINE vfloat8 Broadcast(float f) { return { _mm256_set1_ps(f) }; }
+    // convert 8 unsigned bytes
+    static SIMD_INLINE vfloat8 LoadBytes(unsigned char const* p)
+    {
+#if defined(__AVX2__)
+        return { _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i const*)p))) };
+#else
+        return { _mm256_insertf128_ps(_mm256_castps128_ps256(vfloat4::LoadBytes(p).v), vfloat4::LoadBytes(p + 4).v, 1) };
+#endif
+    }
+    SIMD_INLINE void Store(float* p) const { _mm256_storeu_ps(p, this->v); }
+
+    friend SIMD_INLINE vfloat8 operator+(vfloat8 a, vfloat8 b) { return { _mm256_add_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat8 operator-(vfloat8 a, vfloat8 b) { return { _mm256_sub_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat8 operator*(vfloat8 a, vfloat8 b) { return { _mm256_mul_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat8 operator/(vfloat8 a, vfloat8 b) { return { _mm256_div_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat8 Min(vfloat8 a, vfloat8 b) { return { _mm256_min_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat8 Max(vfloat8 a, vfloat8 b) { return { _mm256_max_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat8 Sqrt(vfloat8 a) { return { _mm256_sqrt_ps(a.v) }; }
+
+    friend SIMD_INLINE vfloat8 operator<(vfloat8 a, vfloat8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+    friend SIMD_INLINE vfloat8 operator<=(vfloat8 a, vfloat8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+    friend SIMD_INLINE vfloat8 operator>(vfloat8 a, vfloat8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+    friend SIMD_INLINE vfloat8 operator>=(vfloat8 a, vfloat8 b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+    friend SIMD_INLINE vfloat8 operator&(vfloat8 a, vfloat8 b) { return { _mm256_and_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat8 operator|(vfloat8 a, vfloat8 b) { return { _mm256_or_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat8 Select(vfloat8 mask, vfloat8 a, vfloat8 b) { return { _mm256_blendv_ps(a.v, b.v, mask.v) }; }
+    friend SIMD_INLINE unsigned Mask(vfloat8 a) { return (unsigned)_mm256_movemask_ps(a.v); }
+#else
+    vfloat4 lo, hi;
+
+    static SIMD_INLINE vfloat8 Load(float const* p) { return { vfloat4::Load(p), vfloat4::Load(p + 4) }; }
+    static SIMD_INLINE vfloat8 Broadcast(float f) { return { vfloat4::Broadcast(f), vfloat4::Broadcast(f) }; }
+    static SIMD_INLINE vfloat8 LoadBytes(unsigned char const* p) { return { vfloat4::LoadBytes(p), vfloat4::LoadBytes(p + 4) }; }
+    SIMD_INLINE void Store(float* p) const { this->lo.Store(p); this->hi.Store(p + 4); }
+
+    friend SIMD_INLINE vfloat8 operator+(vfloat8 a, vfloat8 b) { return { a.lo + b.lo, a.hi + b.hi }; }
+    friend SIMD_INLINE vfloat8 operator-(vfloat8 a, vfloat8 b) { return { a.lo - b.lo, a.hi - b.hi }; }
+    friend SIMD_INLINE vfloat8 operator*(vfloat8 a, vfloat8 b) { return { a.lo * b.lo, a.hi * b.hi }; }
+    friend SIMD_INLINE vfloat8 operator/(vfloat8 a, vfloat8 b) { return { a.lo / b.lo, a.hi / b.hi }; }
+    friend SIMD_INLINE vfloat8 Min(vfloat8 a, vfloat8 b) { return { Min(a.lo, b.lo), Min(a.hi, b.hi) }; }
+    friend SIMD_INLINE vfloat8 Max(vfloat8 a, vfloat8 b) { return { Max(a.lo, b.lo), Max(a.hi, b.hi) }; }
+    friend SIMD_INLINE vfloat8 Sqrt(vfloat8 a) { return { Sqrt(a.lo), Sqrt(a.hi) }; }
+
+    friend SIMD_INLINE vfloat8 operator<(vfloat8 a, vfloat8 b) { return { a.lo < b.lo, a.hi < b.hi }; }
+    friend SIMD_INLINE vfloat8 operator<=(vfloat8 a, vfloat8 b) { return { a.lo <= b.lo, a.hi <= b.hi }; }
+    friend SIMD_INLINE vfloat8 operator>(vfloat8 a, vfloat8 b) { return { a.lo > b.lo, a.hi > b.hi }; }
+    friend SIMD_INLINE vfloat8 operator>=(vfloat8 a, vfloat8 b) { return { a.lo >= b.lo, a.hi >= b.hi }; }
+    friend SIMD_INLINE vfloat8 operator&(vfloat8 a, vfloat8 b) { return { a.lo & b.lo, a.hi & b.hi }; }
+    friend SIMD_INLINE vfloat8 operator|(vfloat8 a, vfloat8 b) { return { a.lo | b.lo, a.hi | b.hi }; }
+    friend SIMD_INLINE vfloat8 Select(vfloat8 mask, vfloat8 a, vfloat8 b) { return { Select(mask.lo, a.lo, b.lo), Select(mask.hi, a.hi, b.hi) }; }
+    friend SIMD_INLINE unsigned Mask(vfloat8 a) { return Mask(a.lo) | (Mask(a.hi) << 4); }
+#endif
+};
+
+//------------------------------------------------------------------------------
+/**
+    16 wide float vector
+*/
+struct vfloat16
+{
+#if TRAYRACER_AVX512
+    __m512 v;
+
+    static SIMD_INLINE vfloat16 Load(float const* p) { return { _mm512_loadu_ps(p) }; }
+    static SIMD_INLINE vfloat16 Broadcast(float f) { return { _mm512_set1_ps(f) }; }
+    SIMD_INLINE void Store(float* p) const { _mm512_storeu_ps(p, this->v); }
+
+    friend SIMD_INLINE vfloat16 operator+(vfloat16 a, vfloat16 b) { return { _mm512_add_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat16 operator-(vfloat16 a, vfloat16 b) { return { _mm512_sub_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat16 operator*(vfloat16 a, vfloat16 b) { return { _mm512_mul_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat16 operator/(vfloat16 a, vfloat16 b) { return { _mm512_div_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat16 Min(vfloat16 a, vfloat16 b) { return { _mm512_min_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat16 Max(vfloat16 a, vfloat16 b) { return { _mm512_max_ps(a.v, b.v) }; }
+    friend SIMD_INLINE vfloat16 Sqrt(vfloat16 a) { return { _mm512_sqrt_ps(a.v) }; }
+
+    // AVX-512 compares into mask registers, expand them to lanes so the interface matches the other widths.
+    // Only uses AVX-512F, the float logic ops of AVX-512DQ are done on integers
+    static SIMD_INLINE vfloat16 FromMask(__mmask16 m) { return { _mm512_castsi512_ps(_mm512_maskz_set1_epi32(m, -1)) }; }
+    static SIMD_INLINE __mmask16 ToMask(vfloat16 a) { return _mm512_cmplt_epi32_mask(_mm512_castps_si512(a.v), _mm512_setzero_si512()); }
+    friend SIMD_INLINE vfloat16 operator<(vfloat16 a, vfloat16 b) { return FromMask(_mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ)); }
+    friend SIMD_INLINE vfloat16 operator<=(vfloat16 a, vfloat16 b) { return FromMask(_mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ)); }
+    friend SIMD_INLINE vfloat16 operator>(vfloat16 a, vfloat16 b) { return FromMask(_mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ)); }
+    friend SIMD_INLINE vfloat16 operator>=(vfloat16 a, vfloat16 b) { return FromMask(_mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ)); }
+    friend SIMD_INLINE vfloat16 operator&(vfloat16 a, vfloat16 b) { return { _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(a.v), _mm512_castps_si512(b.v))) }; }
+    friend SIMD_INLINE vfloat16 operator|(vfloat16 a, vfloat16 b) { return { _mm512_castsi512_ps(_mm512_or_si512(_mm512_castps_si512(a.v), _mm512_castps_si512(b.v))) }; }
+    friend SIMD_INLINE vfloat16 Select(vfloat16 mask, vfloat16 a, vfloat16 b) { return { _mm512_mask_blend_ps(ToMask(mask), a.v, b.v) }; }
+    friend SIMD_INLINE unsigned Mask(vfloat16 a) { return (unsigned)ToMask(a); }
+#else
+    vfloat8 lo, hi;
+
+    static SIMD_INLINE vfloat16 Load(float const* p) { return { vfloat8::Load(p), vfloat8::Load(p + 8) }; }
+    static SIMD_INLINE vfloat16 Broadcast(float f) { return { vfloat8::Broadcast(f), vfloat8::Broadcast(f) }; }
+    SIMD_INLINE void Store(float* p) const { this->lo.Store(p); this->hi.Store(p + 8); }
+
+    friend SIMD_INLINE vfloat16 operator+(vfloat16 a, vfloat16 b) { return { a.lo + b.lo, a.hi + b.hi }; }
+    friend SIMD_INLINE vfloat16 operator-(vfloat16 a, vfloat16 b) { return { a.lo - b.lo, a.hi - b.hi }; }
+    friend SIMD_INLINE vfloat16 operator*(vfloat16 a, vfloat16 b) { return { a.lo * b.lo, a.hi * b.hi }; }
+    friend SIMD_INLINE vfloat16 operator/(vfloat16 a, vfloat16 b) { return { a.lo / b.lo, a.hi / b.hi }; }
+    friend SIMD_INLINE vfloat16 Min(vfloat16 a, vfloat16 b) { return { Min(a.lo, b.lo), Min(a.hi, b.hi) }; }
+    friend SIMD_INLINE vfloat16 Max(vfloat16 a, vfloat16 b) { return { Max(a.lo, b.lo), Max(a.hi, b.hi) }; }
+    friend SIMD_INLINE vfloat16 Sqrt(vfloat16 a) { return { Sqrt(a.lo), Sqrt(a.hi) }; }
+
+    friend SIMD_INLINE vfloat16 operator<(vfloat16 a, vfloat16 b) { return { a.lo < b.lo, a.hi < b.hi }; }
+    friend SIMD_INLINE vfloat16 operator<=(vfloat16 a, vfloat16 b) { return { a.lo <= b.lo, a.hi <= b.hi }; }
+    friend SIMD_INLINE vfloat16 operator>(vfloat16 a, vfloat16 b) { return { a.lo > b.lo, a.hi > b.hi }; }
+    friend SIMD_INLINE vfloat16 operator>=(vfloat16 a, vfloat16 b) { return { a.lo >= b.lo, a.hi >= b.hi }; }
+    friend SIMD_INLINE vfloat16 operator&(vfloat16 a, vfloat16 b) { return { a.lo & b.lo, a.hi & b.hi }; }
+    friend SIMD_INLINE vfloat16 operator|(vfloat16 a, vfloat16 b) { return { a.lo | b.lo, a.hi | b.hi }; }
+    friend SIMD_INLINE vfloat16 Select(vfloat16 mask, vfloat16 a, vfloat16 b) { return { Select(mask.lo, a.lo, b.lo), Select(mask.hi, a.hi, b.hi) }; }
+    friend SIMD_INLINE unsigned Mask(vfloat16 a) { return Mask(a.lo) | (Mask(a.hi) << 8); }
+#endif
+};
+
+//------------------------------------------------------------------------------
+/**
+    Pick the vector type for a given width
+*/
+template<unsigned WIDTH> struct SimdFloat;
+template<> struct SimdFloat<4> { using Type = vfloat4; };
+template<> struct SimdFloat<8> { using Type = vfloat8; };
+template<> struct SimdFloat<16> { using Type = vfloat16; };
+
+template<unsigned WIDTH>
+using vfloat = typename SimdFloat<WIDTH>::Type;
+
+} // namespace TRAYRACER_ISA
+using namespace TRAYRACER_ISA;
+
+//------------------------------------------------------------------------------
+/**
+    Index of the lowest set bit of a lane mask, mask must not be 0
+*/
+SIMD_INLINE unsigned
+FirstLane(unsigned mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+//------------------------------------------------------------------------------
+/**
+    Number of set bits of a lane mask
+*/
+SIMD_INLINE unsigned
+PopCount(unsigned mask)
+{
+#ifdef _MSC_VER
+    return (unsigned)__popcnt(mask);
+#else
+    return (unsigned)__builtin_popcount(mask);
+#endif
+}
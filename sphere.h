@@ -8,27 +8,17 @@
 #include "ray.h"
 #include "material.h"
 
-// returns a random point on the surface of a unit sphere
-inline vec3 random_point_on_unit_sphere()
-{
-    float x = RandomFloatNTP();
-    float y = RandomFloatNTP();
-    float z = RandomFloatNTP();
-    vec3 v( x, y, z );
-    return normalize(v);
-}
-
-// a spherical object
+// a spherical object, its geometry and the index of its material, see AddMaterial
 class Sphere : public Object
 {
 public:
-    float radius;
     vec3 center;
-    Material const* const material;
+    float radius;
+    unsigned material;
 
-    Sphere(float radius, vec3 center, Material const* const material) : 
-        radius(radius),
+    Sphere(float radius, vec3 center, unsigned material) :
         center(center),
+        radius(radius),
         material(material)
     {
 
@@ -41,19 +31,29 @@ public:
 
     Color GetColor()
     {
-        return material->color;
+        return LookupMaterial(this->material)->color;
+    }
+
+    Material const* GetMaterial() override
+    {
+        return LookupMaterial(this->material);
+    }
+
+    bool GetBounds(BBox& bounds) override
+    {
+        bounds = SphereBounds(this->center, this->radius);
+        return true;
     }
 
-    Optional<HitResult> Intersect(Ray ray, float maxDist) override
+    bool Intersect(Ray const& ray, float maxDist, HitResult& hit) override
     {
-        HitResult hit;
         vec3 oc = ray.b - this->center;
         vec3 dir = ray.m;
         float b = dot(oc, dir);
     
         // early out if sphere is "behind" ray
         if (b > 0)
-            return Optional<HitResult>();
+            return false;
 
         float a = dot(dir, dir);
         float c = dot(oc, oc) - this->radius * this->radius;
@@ -74,7 +74,7 @@ public:
                 hit.normal = (p - this->center) * (1.0f / this->radius);
                 hit.t = temp;
                 hit.object = this;
-                return Optional<HitResult>(hit);
+                return true;
             }
             if (temp2 < maxDist && temp2 > minDist)
             {
@@ -83,16 +83,38 @@ public:
                 hit.normal = (p - this->center) * (1.0f / this->radius);
                 hit.t = temp2;
                 hit.object = this;
-                return Optional<HitResult>(hit);
+                return true;
             }
         }
 
-        return Optional<HitResult>();
+        return false;
+    }
+
+    bool Occluded(Ray const& ray, float maxDist) override
+    {
+        vec3 oc = ray.b - this->center;
+        vec3 dir = ray.m;
+        float b = dot(oc, dir);
+        if (b > 0)
+            return false;
+
+        float a = dot(dir, dir);
+        float c = dot(oc, oc) - this->radius * this->radius;
+        float discriminant = b * b - a * c;
+        if (discriminant <= 0)
+            return false;
+
+        constexpr float minDist = 0.001f;
+        float div = 1.0f / a;
+        float sqrtDisc = sqrt(discriminant);
+        float temp = (-b - sqrtDisc) * div;
+        float temp2 = (-b + sqrtDisc) * div;
+        return (temp < maxDist && temp > minDist) || (temp2 < maxDist && temp2 > minDist);
     }
 
-    Ray ScatterRay(Ray ray, vec3 point, vec3 normal) override
+    Ray ScatterRay(Ray ray, vec3 point, vec3 normal, RandomStream& random) override
     {
-        return BSDF(this->material, ray, point, normal);
+        return BSDF(LookupMaterial(this->material), ray, point, normal, random);
     }
 
 };
\ No newline at end of file
@@ -0,0 +1,73 @@
+#include "spheresoa.h"
+#include "sphere.h"
+
+//------------------------------------------------------------------------------
+/**
+    Keeps the memory, refitting fills the arrays again every frame
+*/
+void
+SphereSoA::Clear()
+{
+    this->centerX.clear();
+    this->centerY.clear();
+    this->centerZ.clear();
+    this->radiusSq.clear();
+    this->spheres.clear();
+    this->packed.clear();
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+bool
+SphereSoA::Add(Object* object)
+{
+    Sphere* sphere = dynamic_cast<Sphere*>(object);
+    if (sphere == nullptr)
+        return false;
+    this->centerX.push_back(sphere->center.x);
+    this->centerY.push_back(sphere->center.y);
+    this->centerZ.push_back(sphere->center.z);
+    this->radiusSq.push_back(sphere->radius * sphere->radius);
+    this->spheres.push_back(sphere);
+    this->packed.push_back({ { sphere->center.x, sphere->center.y, sphere->center.z, sphere->radius * sphere->radius } });
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Padding never hits, the kernels mask it out anyway
+*/
+void
+SphereSoA::Finish()
+{
+    unsigned count = this->Count();
+    this->centerX.resize(count + MaxWidth, 0.0f);
+    this->centerY.resize(count + MaxWidth, 0.0f);
+    this->centerZ.resize(count + MaxWidth, 0.0f);
+    this->radiusSq.resize(count + MaxWidth, -1.0f);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+SphereSoA::GetHit(Ray const& ray, unsigned slot, float t, HitResult& hit) const
+{
+    Sphere* sphere = this->spheres[slot];
+    vec3 p = ray.PointAt(t);
+    hit.p = p;
+    hit.normal = (p - sphere->center) * (1.0f / sphere->radius);
+    hit.t = t;
+    hit.object = sphere;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+size_t
+SphereSoA::MemoryUsage() const
+{
+    return (this->centerX.size() + this->centerY.size() + this->centerZ.size() + this->radiusSq.size()) * sizeof(float) +
+        this->spheres.size() * sizeof(Sphere*) + this->packed.size() * sizeof(Packed);
+}
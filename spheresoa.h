@@ -0,0 +1,374 @@
+#pragma once
+#include <vector>
+#include "object.h"
+#include "simd.h"
+
+class Sphere;
+
+// the kernels are compiled per instruction set, see simd.h
+namespace TRAYRACER_ISA
+{
+
+// lanes of the kernels, 16 with AVX-512, 8 otherwise
+#if TRAYRACER_AVX512
+constexpr unsigned SphereWidth = 16;
+#else
+constexpr unsigned SphereWidth = 8;
+#endif
+
+//------------------------------------------------------------------------------
+/**
+    Ray prepared for the sphere kernels, in single precision
+*/
+struct SphereRay
+{
+    float origin[3];
+    float dir[3];
+    // dot(dir, dir) and its inverse, directions are not necessarily normalized
+    float a;
+    float invA;
+
+    SphereRay(Ray const& ray)
+    {
+        ray.b.Load().Store(this->origin);
+        ray.m.Load().Store(this->dir);
+        this->a = dot(ray.m, ray.m);
+        this->invA = 1.0f / this->a;
+    }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Up to N rays prepared for the sphere kernels, each lane of the arrays is a ray
+*/
+template<unsigned N>
+struct SpherePacket
+{
+    alignas(64) float origin[3][N];
+    alignas(64) float dir[3][N];
+    alignas(64) float a[N];
+    alignas(64) float invA[N];
+
+    // lanes past count repeat the first ray, callers leave them out of the lane mask
+    SpherePacket(Ray const* rays, unsigned count)
+    {
+        for (unsigned i = 0; i < N; i++)
+        {
+            SphereRay r(rays[i < count ? i : 0]);
+            for (int axis = 0; axis < 3; axis++)
+            {
+                this->origin[axis][i] = r.origin[axis];
+                this->dir[axis][i] = r.dir[axis];
+            }
+            this->a[i] = r.a;
+            this->invA[i] = r.invA;
+        }
+    }
+};
+
+} // namespace TRAYRACER_ISA
+using namespace TRAYRACER_ISA;
+
+//------------------------------------------------------------------------------
+/**
+    Spheres stored as structure of arrays, so that they are intersected a
+    whole vector register at a time instead of through Object::Intersect.
+
+    The sphere array of PrimitiveStore, see there for the interface. Only
+    spheres are stored, in the order they are added, so the spheres of a
+    leaf of the tree are a contiguous range of slots.
+*/
+class SphereSoA
+{
+public:
+    // widest kernel of any instruction set, the arrays are padded for it
+    static constexpr unsigned MaxWidth = 16;
+
+    using PreparedRay = SphereRay;
+    template<unsigned N>
+    using PreparedPacket = SpherePacket<N>;
+
+    void Clear();
+    // appends object if it is a sphere, returns false otherwise
+    bool Add(Object* object);
+    // pads the arrays after the last Add
+    void Finish();
+
+    // number of slots
+    unsigned Count() const { return (unsigned)this->spheres.size(); }
+
+    // closest hit in slots [first, first + count) before hit.t, fills hit
+    bool Intersect(Ray const& ray, SphereRay const& prepared, unsigned first, unsigned count, HitResult& hit) const;
+    // true if any sphere in slots [first, first + count) is hit before tMax, stops at the
+    // first register that has one
+    bool Occluded(Ray const& ray, SphereRay const& prepared, unsigned first, unsigned count, float tMax) const;
+    // closest hits of the lanes of mask, single lanes go through Intersect
+    template<unsigned N>
+    unsigned IntersectPacket(Ray const* rays, SpherePacket<N> const& packet, unsigned mask, unsigned first, unsigned count, float* tMax, HitResult* hits) const;
+
+    // closest sphere in slots [first, first + count) that is hit before tMax.
+    // Shrinks tMax to the hit distance and sets slot, returns false if nothing was hit
+    template<unsigned WIDTH = SphereWidth>
+    bool Closest(SphereRay const& ray, unsigned first, unsigned count, float& tMax, unsigned& slot) const;
+
+    // the transpose for packets, every sphere in slots [first, first + count) against the lanes of mask.
+    // Shrinks tMax and sets slot of lanes that hit, returns those lanes
+    template<unsigned N>
+    unsigned ClosestPacket(SpherePacket<N> const& packet, unsigned mask, unsigned first, unsigned count, float* tMax, unsigned* slot) const;
+
+    // hit record of a ray that hit the sphere in slot at distance t, as Sphere::Intersect would fill it
+    void GetHit(Ray const& ray, unsigned slot, float t, HitResult& hit) const;
+
+    // bytes used by the arrays
+    size_t MemoryUsage() const;
+    // calls func(data, bytes) for each of them
+    template<class FUNC>
+    void ForEachBuffer(FUNC&& func) const
+    {
+        for (std::vector<float> const* axis : { &this->centerX, &this->centerY, &this->centerZ, &this->radiusSq })
+            func(axis->data(), axis->size() * sizeof(float));
+        func(this->spheres.data(), this->spheres.size() * sizeof(Sphere*));
+        func(this->packed.data(), this->packed.size() * sizeof(Packed));
+    }
+
+private:
+    // padded by MaxWidth in Finish, so the kernel may load whole registers at the end
+    std::vector<float> centerX;
+    std::vector<float> centerY;
+    std::vector<float> centerZ;
+    std::vector<float> radiusSq;
+    std::vector<Sphere*> spheres;
+    // center and squared radius of each sphere in one record, for ranges of a single
+    // sphere. Four arrays cost four loads and cache lines where one does here
+    struct alignas(16) Packed
+    {
+        float v[4];
+    };
+    std::vector<Packed> packed;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline bool
+SphereSoA::Intersect(Ray const& ray, SphereRay const& prepared, unsigned first, unsigned count, HitResult& hit) const
+{
+    float tMax = hit.t;
+    unsigned slot;
+    if (!this->Closest(prepared, first, count, tMax, slot))
+        return false;
+    this->GetHit(ray, slot, tMax, hit);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Same math as Sphere::Intersect in single precision, including the early
+    out for spheres whose center is behind the ray.
+    tMax is shrunk between registers, lanes of one register are compared
+    against the tMax it started with, and the closest of them is kept.
+*/
+template<unsigned WIDTH>
+inline bool
+SphereSoA::Closest(SphereRay const& ray, unsigned first, unsigned count, float& tMax, unsigned& slot) const
+{
+    // grid cells test their spheres one at a time, without filling a register
+    if (count == 1)
+    {
+        float const* packed = this->packed[first].v;
+        float ocx = ray.origin[0] - packed[0];
+        float ocy = ray.origin[1] - packed[1];
+        float ocz = ray.origin[2] - packed[2];
+        float b = ocx * ray.dir[0] + ocy * ray.dir[1] + ocz * ray.dir[2];
+        float c = ocx * ocx + ocy * ocy + ocz * ocz - packed[3];
+        float discriminant = b * b - ray.a * c;
+        if (b > 0.0f || discriminant <= 0.0f)
+            return false;
+        float sqrtDisc = sqrtf(discriminant);
+        float t1 = (-b - sqrtDisc) * ray.invA;
+        float t2 = (-b + sqrtDisc) * ray.invA;
+        float t = t1 > 0.001f ? t1 : t2;
+        if (t >= tMax || t <= 0.001f)
+            return false;
+        tMax = t;
+        slot = first;
+        return true;
+    }
+
+    using vf = vfloat<WIDTH>;
+    vf ox = vf::Broadcast(ray.origin[0]);
+    vf oy = vf::Broadcast(ray.origin[1]);
+    vf oz = vf::Broadcast(ray.origin[2]);
+    vf dx = vf::Broadcast(ray.dir[0]);
+    vf dy = vf::Broadcast(ray.dir[1]);
+    vf dz = vf::Broadcast(ray.dir[2]);
+    vf a = vf::Broadcast(ray.a);
+    vf invA = vf::Broadcast(ray.invA);
+    vf zero = vf::Broadcast(0.0f);
+    vf minDist = vf::Broadcast(0.001f);
+
+    bool found = false;
+    for (unsigned base = 0; base < count; base += WIDTH)
+    {
+        unsigned i = first + base;
+        vf ocx = ox - vf::Load(&this->centerX[i]);
+        vf ocy = oy - vf::Load(&this->centerY[i]);
+        vf ocz = oz - vf::Load(&this->centerZ[i]);
+        vf b = ocx * dx + ocy * dy + ocz * dz;
+        vf c = ocx * ocx + ocy * ocy + ocz * ocz - vf::Load(&this->radiusSq[i]);
+        vf discriminant = b * b - a * c;
+        vf sqrtDisc = Sqrt(Max(discriminant, zero));
+        vf t1 = (zero - b - sqrtDisc) * invA;
+        vf t2 = (zero - b + sqrtDisc) * invA;
+
+        vf tm = vf::Broadcast(tMax);
+        vf valid1 = (t1 < tm) & (t1 > minDist);
+        vf valid2 = (t2 < tm) & (t2 > minDist);
+        unsigned hits = Mask((b <= zero) & (discriminant > zero) & (valid1 | valid2));
+        // lanes past the range belong to other leaves, or to the padding
+        if (count - base < WIDTH)
+            hits &= (1u << (count - base)) - 1;
+        if (hits == 0)
+            continue;
+
+        alignas(64) float t[WIDTH];
+        Select(valid1, t2, t1).Store(t);
+        do
+        {
+            unsigned lane = FirstLane(hits);
+            hits &= hits - 1;
+            if (t[lane] < tMax)
+            {
+                tMax = t[lane];
+                slot = i + lane;
+                found = true;
+            }
+        } while (hits != 0);
+    }
+    return found;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The tests of Closest, without picking the closest lane
+*/
+inline bool
+SphereSoA::Occluded(Ray const&, SphereRay const& ray, unsigned first, unsigned count, float tMax) const
+{
+    using vf = vfloat<SphereWidth>;
+    vf ox = vf::Broadcast(ray.origin[0]);
+    vf oy = vf::Broadcast(ray.origin[1]);
+    vf oz = vf::Broadcast(ray.origin[2]);
+    vf dx = vf::Broadcast(ray.dir[0]);
+    vf dy = vf::Broadcast(ray.dir[1]);
+    vf dz = vf::Broadcast(ray.dir[2]);
+    vf a = vf::Broadcast(ray.a);
+    vf invA = vf::Broadcast(ray.invA);
+    vf zero = vf::Broadcast(0.0f);
+    vf minDist = vf::Broadcast(0.001f);
+    vf tm = vf::Broadcast(tMax);
+
+    for (unsigned base = 0; base < count; base += SphereWidth)
+    {
+        unsigned i = first + base;
+        vf ocx = ox - vf::Load(&this->centerX[i]);
+        vf ocy = oy - vf::Load(&this->centerY[i]);
+        vf ocz = oz - vf::Load(&this->centerZ[i]);
+        vf b = ocx * dx + ocy * dy + ocz * dz;
+        vf c = ocx * ocx + ocy * ocy + ocz * ocz - vf::Load(&this->radiusSq[i]);
+        vf discriminant = b * b - a * c;
+        vf sqrtDisc = Sqrt(Max(discriminant, zero));
+        vf t1 = (zero - b - sqrtDisc) * invA;
+        vf t2 = (zero - b + sqrtDisc) * invA;
+
+        vf valid = ((t1 < tm) & (t1 > minDist)) | ((t2 < tm) & (t2 > minDist));
+        unsigned hits = Mask((b <= zero) & (discriminant > zero) & valid);
+        if (count - base < SphereWidth)
+            hits &= (1u << (count - base)) - 1;
+        if (hits != 0)
+            return true;
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<unsigned N>
+inline unsigned
+SphereSoA::ClosestPacket(SpherePacket<N> const& packet, unsigned mask, unsigned first, unsigned count, float* tMax, unsigned* slot) const
+{
+    using vf = vfloat<N>;
+    vf ox = vf::Load(packet.origin[0]);
+    vf oy = vf::Load(packet.origin[1]);
+    vf oz = vf::Load(packet.origin[2]);
+    vf dx = vf::Load(packet.dir[0]);
+    vf dy = vf::Load(packet.dir[1]);
+    vf dz = vf::Load(packet.dir[2]);
+    vf a = vf::Load(packet.a);
+    vf invA = vf::Load(packet.invA);
+    vf zero = vf::Broadcast(0.0f);
+    vf minDist = vf::Broadcast(0.001f);
+    vf tm = vf::Load(tMax);
+
+    unsigned found = 0;
+    for (unsigned i = first; i < first + count; i++)
+    {
+        vf ocx = ox - vf::Broadcast(this->centerX[i]);
+        vf ocy = oy - vf::Broadcast(this->centerY[i]);
+        vf ocz = oz - vf::Broadcast(this->centerZ[i]);
+        vf b = ocx * dx + ocy * dy + ocz * dz;
+        vf c = ocx * ocx + ocy * ocy + ocz * ocz - vf::Broadcast(this->radiusSq[i]);
+        vf discriminant = b * b - a * c;
+        vf sqrtDisc = Sqrt(Max(discriminant, zero));
+        vf t1 = (zero - b - sqrtDisc) * invA;
+        vf t2 = (zero - b + sqrtDisc) * invA;
+
+        vf valid1 = (t1 < tm) & (t1 > minDist);
+        vf valid2 = (t2 < tm) & (t2 > minDist);
+        vf hit = (b <= zero) & (discriminant > zero) & (valid1 | valid2);
+        unsigned hits = Mask(hit) & mask;
+        if (hits == 0)
+            continue;
+
+        alignas(64) float t[N];
+        Select(valid1, t2, t1).Store(t);
+        for (; hits != 0; hits &= hits - 1)
+        {
+            unsigned lane = FirstLane(hits);
+            tMax[lane] = t[lane];
+            slot[lane] = i;
+            found |= 1u << lane;
+        }
+        tm = vf::Load(tMax);
+    }
+    return found;
+}
+
+//------------------------------------------------------------------------------
+/**
+    A lane that left the packet is cheaper to test against a register of
+    spheres at a time
+*/
+template<unsigned N>
+inline unsigned
+SphereSoA::IntersectPacket(Ray const* rays, SpherePacket<N> const& packet, unsigned mask, unsigned first, unsigned count, float* tMax, HitResult* hits) const
+{
+    if (PopCount(mask) == 1)
+    {
+        unsigned lane = FirstLane(mask);
+        if (!this->Intersect(rays[lane], SphereRay(rays[lane]), first, count, hits[lane]))
+            return 0;
+        tMax[lane] = hits[lane].t;
+        return mask;
+    }
+
+    unsigned slot[N];
+    unsigned found = this->ClosestPacket(packet, mask, first, count, tMax, slot);
+    for (unsigned lanes = found; lanes != 0; lanes &= lanes - 1)
+    {
+        unsigned lane = FirstLane(lanes);
+        this->GetHit(rays[lane], slot[lane], tMax[lane], hits[lane]);
+    }
+    return found;
+}
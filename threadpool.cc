@@ -0,0 +1,196 @@
+#include "threadpool.h"
+#include "numa.h"
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+//------------------------------------------------------------------------------
+/**
+    Hint to the core that this is a spin loop, so it does not starve its
+    hyperthread or flood the memory bus with speculative loads
+*/
+inline void
+Pause()
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+ThreadPool::~ThreadPool()
+{
+    this->Stop();
+}
+
+//------------------------------------------------------------------------------
+/**
+    The clock is read every few polls only
+*/
+template<class DONE>
+bool
+ThreadPool::Spin(DONE&& done) const
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(this->spinTime);
+    for (;;)
+    {
+        for (int i = 0; i < 64; i++)
+        {
+            if (done())
+                return true;
+            Pause();
+        }
+        if (std::chrono::steady_clock::now() > deadline)
+            return false;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ThreadPool::Resize(unsigned numThreads, bool pin)
+{
+    if (numThreads == 0)
+        numThreads = NumParallelThreads();
+    if (numThreads == this->NumThreads() && pin == this->pinned)
+        return;
+
+    this->Stop();
+    this->spinTime = numThreads <= NumParallelThreads() ? SpinMicroseconds : 0;
+
+    this->pinned = pin;
+    if (pin)
+    {
+        NumaTopology const& topology = GetNumaTopology();
+        this->threadCpus.resize(numThreads);
+        this->threadNodes.resize(numThreads);
+        unsigned numNodes = topology.NumNodes();
+        for (unsigned thread = 0; thread < numThreads; thread++)
+        {
+            unsigned node = (unsigned)(((unsigned long long)thread * numNodes) / numThreads);
+            unsigned first = (unsigned)(((unsigned long long)node * numThreads + numNodes - 1) / numNodes);
+            std::vector<unsigned> const& cpus = topology.nodeCpus[node];
+            this->threadNodes[thread] = node;
+            this->threadCpus[thread] = cpus[(thread - first) % cpus.size()];
+        }
+    }
+
+    this->workers.reserve(numThreads - 1);
+    unsigned generation = this->generation.load(std::memory_order_relaxed);
+    for (unsigned thread = 1; thread < numThreads; thread++)
+        this->workers.emplace_back(&ThreadPool::WorkerLoop, this, thread, generation);
+}
+
+//------------------------------------------------------------------------------
+/**
+    The sleeping flags and the counters they guard are sequentially
+    consistent, so a thread going to sleep either sees the change it
+    waits for, or is seen by the thread making it, which then takes the
+    mutex and notifies it.
+
+    A pinned pool pins the caller only while it runs its share. Left
+    pinned, everything it does between dispatches, the BVH builds and
+    whatever threads ParallelRange starts for them, would inherit the
+    one cpu mask and run on that cpu alone
+*/
+void
+ThreadPool::Dispatch(Call call, void* context)
+{
+    if (this->pinned)
+        PinThread(this->threadCpus[0]);
+    if (this->workers.empty())
+    {
+        call(context, 0);
+        if (this->pinned)
+            UnpinThread();
+        return;
+    }
+
+    this->call = call;
+    this->context = context;
+    this->pending.store((unsigned)this->workers.size(), std::memory_order_relaxed);
+    this->generation.fetch_add(1);
+    if (this->sleepingWorkers.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->wake.notify_all();
+    }
+
+    call(context, 0);
+
+    auto finished = [this]() { return this->pending.load(std::memory_order_acquire) == 0; };
+    if (!this->Spin(finished))
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->callerSleeping.store(true);
+        this->done.wait(lock, [this]() { return this->pending.load() == 0; });
+        this->callerSleeping.store(false, std::memory_order_relaxed);
+    }
+    if (this->pinned)
+        UnpinThread();
+}
+
+//------------------------------------------------------------------------------
+/**
+    generation is the one the worker was started at, it waits for the next
+*/
+void
+ThreadPool::WorkerLoop(unsigned thread, unsigned generation)
+{
+    if (this->pinned)
+        PinThread(this->threadCpus[thread]);
+    for (;;)
+    {
+        auto dispatched = [this, generation]() { return this->generation.load(std::memory_order_acquire) != generation; };
+        if (!this->Spin(dispatched))
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->sleepingWorkers.fetch_add(1);
+            this->wake.wait(lock, [this, generation]() { return this->generation.load() != generation; });
+            this->sleepingWorkers.fetch_sub(1, std::memory_order_relaxed);
+        }
+        generation = this->generation.load(std::memory_order_acquire);
+        if (this->stopping.load(std::memory_order_relaxed))
+            return;
+
+        this->call(this->context, thread);
+
+        if (this->pending.fetch_sub(1) == 1 && this->callerSleeping.load())
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->done.notify_one();
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+ThreadPool::Stop()
+{
+    if (this->workers.empty())
+        return;
+
+    this->stopping.store(true, std::memory_order_relaxed);
+    this->generation.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->wake.notify_all();
+    }
+    for (std::thread& worker : this->workers)
+        worker.join();
+    this->workers.clear();
+    this->stopping.store(false, std::memory_order_relaxed);
+}
@@ -0,0 +1,149 @@
+#pragma once
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include "parallel.h"
+
+//------------------------------------------------------------------------------
+/**
+    Threads that are started once and kept, for work that is handed out
+    every frame. ParallelRange starts and joins its threads on every call,
+    tens of microseconds per thread, which a frame at 60 Hz can not spare.
+
+    Run hands the workers a function by bumping a generation counter and
+    runs its own share on the calling thread, so the caller is thread 0.
+    It returns once every worker has counted down the pending counter,
+    which is the barrier at the end of each dispatch. Between dispatches
+    workers spin on the generation for SpinMicroseconds, which catches the
+    dispatches that follow each other within a frame, and then sleep on
+    a condition variable until the next one. The caller waits for the
+    barrier the same way.
+
+    Run is called from one thread at a time, and not from inside a function
+    it runs.
+*/
+class ThreadPool
+{
+public:
+    ThreadPool() = default;
+    ~ThreadPool();
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    // threads Run calls its function on, the calling thread included
+    unsigned NumThreads() const { return (unsigned)this->workers.size() + 1; }
+    // start or stop workers so that Run uses numThreads threads, 0 for NumParallelThreads.
+    // With pin, every thread runs on one cpu only, see ThreadNode, the calling one as
+    // thread 0 only while Run executes. Does nothing if neither changes
+    void Resize(unsigned numThreads, bool pin = false);
+    // true if the threads are pinned
+    bool Pinned() const { return this->pinned; }
+    // memory node, an index into NumaTopology::nodeCpus, of the cpu of a pinned thread.
+    // Threads are spread evenly over the nodes, in blocks of consecutive threads, so
+    // that the task ranges of RunTasks fall to the nodes in blocks as well. 0 unpinned
+    unsigned ThreadNode(unsigned thread) const { return this->pinned ? this->threadNodes[thread] : 0; }
+
+    // call func(thread) once for each thread in [0, NumThreads), returns once all calls have returned
+    template<class FUNC> void Run(FUNC&& func);
+    // like ParallelRange, call func(begin, end, thread) for a contiguous chunk of [0, count) per thread
+    template<class FUNC> void RunRange(unsigned count, FUNC&& func);
+    // call func(task, thread) for every task in [0, numTasks), each thread starts on a
+    // contiguous range and steals from the others once it runs out, see TaskRanges.
+    // Returns the number of steals
+    template<class FUNC> unsigned RunTasks(unsigned numTasks, FUNC&& func);
+
+    // how long idle workers, and the caller at the barrier, poll before they sleep. Pools with
+    // more threads than cores do not poll, a spinning thread would hold up the one it waits for
+    static constexpr unsigned SpinMicroseconds = 100;
+
+private:
+    // function of the current dispatch, context is the callable it was made from
+    typedef void (*Call)(void* context, unsigned thread);
+
+    void Dispatch(Call call, void* context);
+    void WorkerLoop(unsigned thread, unsigned generation);
+    // stop and join all workers
+    void Stop();
+    // poll done for up to spinTime, true if it became true
+    template<class DONE> bool Spin(DONE&& done) const;
+
+    std::vector<std::thread> workers;
+    // SpinMicroseconds, or 0 if the pool has more threads than cores
+    unsigned spinTime = 0;
+    bool pinned = false;
+    // cpu and node of each thread while pinned
+    std::vector<unsigned> threadCpus;
+    std::vector<unsigned> threadNodes;
+
+    // bumped by every dispatch, and to stop the workers
+    std::atomic<unsigned> generation{ 0 };
+    // workers that have not finished the current dispatch
+    std::atomic<unsigned> pending{ 0 };
+    std::atomic<bool> stopping{ false };
+    Call call = nullptr;
+    void* context = nullptr;
+
+    // sleeping workers wait on wake, a sleeping caller on done
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::atomic<unsigned> sleepingWorkers{ 0 };
+    std::atomic<bool> callerSleeping{ false };
+
+    // task ranges of RunTasks, kept between dispatches
+    TaskRanges taskRanges;
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<class FUNC>
+inline void
+ThreadPool::Run(FUNC&& func)
+{
+    Call call = [](void* context, unsigned thread) { (*(std::remove_reference_t<FUNC>*)context)(thread); };
+    this->Dispatch(call, (void*)&func);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Chunk boundaries only depend on count and NumThreads
+*/
+template<class FUNC>
+inline void
+ThreadPool::RunRange(unsigned count, FUNC&& func)
+{
+    unsigned numThreads = this->NumThreads();
+    this->Run([&](unsigned thread)
+    {
+        unsigned begin = (unsigned)(((unsigned long long)count * thread) / numThreads);
+        unsigned end = (unsigned)(((unsigned long long)count * (thread + 1)) / numThreads);
+        func(begin, end, thread);
+    });
+}
+
+//------------------------------------------------------------------------------
+/**
+    Threads beyond the number of tasks start on an empty range and go
+    straight to stealing, see TaskRanges
+*/
+template<class FUNC>
+inline unsigned
+ThreadPool::RunTasks(unsigned numTasks, FUNC&& func)
+{
+    TaskRanges& ranges = this->taskRanges;
+    ranges.Reset(numTasks, this->NumThreads());
+    this->Run([&](unsigned thread)
+    {
+        do
+        {
+            unsigned task;
+            while (ranges.Pop(thread, task))
+                func(task, thread);
+        } while (ranges.Steal(thread));
+    });
+    return ranges.Steals();
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+/**
+    Node layouts of the trees
+*/
+enum class BVHLayout
+{
+    // the order the builder emitted, every subtree is contiguous
+    DepthFirst,
+    // top levels breadth first, the rest in page sized treelets
+    Treelet,
+};
+
+// the breadth first top of the tree, a quarter of a 32 KB L1. Filling all of it
+// evicts the lines below the top that the rays of a neighbourhood share
+static constexpr unsigned TreeletHotBytes = 8 * 1024;
+// size of the treelets below it, one page
+static constexpr unsigned TreeletBytes = 4096;
+
+//------------------------------------------------------------------------------
+/**
+    Cache friendly order of the nodes of a tree. Returns the old index of
+    every node in its new position.
+
+    The top levels are laid out breadth first up to hotBytes, since every ray
+    passes through them. Below that, each subtree is cut into treelets that
+    grow greedily into the child with the largest surface area, the child a
+    random ray most likely visits next, until treeletBytes are filled. A
+    treelet is stored contiguously, followed by the treelets hanging off it.
+    Parents always come before their children.
+
+    children(node, out) stores the children of a node in out and returns how
+    many there are, area(node) returns its surface area.
+*/
+template<class CHILDREN, class AREA>
+inline std::vector<unsigned>
+TreeletOrder(unsigned numNodes, unsigned nodeBytes, CHILDREN&& children, AREA&& area,
+             unsigned hotBytes = TreeletHotBytes, unsigned treeletBytes = TreeletBytes)
+{
+    std::vector<unsigned> order;
+    order.reserve(numNodes);
+    if (numNodes == 0)
+        return order;
+
+    unsigned childBuffer[8];
+    unsigned hotNodes = hotBytes / nodeBytes;
+    unsigned treeletNodes = treeletBytes / nodeBytes;
+    hotNodes = hotNodes > 0 ? hotNodes : 1;
+    treeletNodes = treeletNodes > 0 ? treeletNodes : 1;
+
+    // breadth first top, whatever is still queued at the end roots the treelets
+    std::vector<unsigned> queue;
+    queue.push_back(0);
+    size_t head = 0;
+    while (head < queue.size() && order.size() < hotNodes)
+    {
+        unsigned node = queue[head++];
+        order.push_back(node);
+        unsigned count = children(node, childBuffer);
+        for (unsigned c = 0; c < count; c++)
+            queue.push_back(childBuffer[c]);
+    }
+
+    // treelet roots, processed depth first so that the treelets of a subtree stay close together
+    std::vector<unsigned> roots(queue.rbegin(), queue.rend() - head);
+    std::vector<std::pair<float, unsigned>> candidates;
+    while (!roots.empty())
+    {
+        unsigned root = roots.back();
+        roots.pop_back();
+
+        candidates.clear();
+        candidates.push_back({ area(root), root });
+        unsigned placed = 0;
+        while (!candidates.empty() && placed < treeletNodes)
+        {
+            // take the candidate with the largest area
+            size_t best = 0;
+            for (size_t i = 1; i < candidates.size(); i++)
+                if (candidates[i].first > candidates[best].first)
+                    best = i;
+            unsigned node = candidates[best].second;
+            candidates[best] = candidates.back();
+            candidates.pop_back();
+
+            order.push_back(node);
+            placed++;
+            unsigned count = children(node, childBuffer);
+            for (unsigned c = 0; c < count; c++)
+                candidates.push_back({ area(childBuffer[c]), childBuffer[c] });
+        }
+
+        // what did not fit roots new treelets, largest first
+        std::sort(candidates.begin(), candidates.end());
+        for (auto const& candidate : candidates)
+            roots.push_back(candidate.second);
+    }
+    return order;
+}
@@ -0,0 +1,84 @@
+#include "trianglemesh.h"
+#include "parallel.h"
+#include <assert.h>
+#include <chrono>
+
+//------------------------------------------------------------------------------
+/**
+*/
+TriangleMesh::TriangleMesh(std::vector<float> positions, std::vector<unsigned> indices, unsigned material, BVHBuilder builder) :
+    positions(std::move(positions)),
+    indices(std::move(indices)),
+    material(material)
+{
+    assert(this->positions.size() % 3 == 0 && this->indices.size() % 3 == 0);
+    auto start = std::chrono::high_resolution_clock::now();
+
+    unsigned triangleCount = this->TriangleCount();
+    unsigned numChunks = std::min(NumParallelThreads(), triangleCount / 4096 + 1);
+    std::vector<BBox> primBounds(triangleCount);
+    std::vector<BBox> chunkBounds(numChunks);
+    ParallelRange(triangleCount, numChunks, [&](unsigned begin, unsigned end, unsigned chunk)
+    {
+        for (unsigned i = begin; i < end; i++)
+        {
+            for (int c = 0; c < 3; c++)
+                primBounds[i].Grow(&this->positions[this->indices[i * 3 + c] * 3]);
+            chunkBounds[chunk].Grow(primBounds[i]);
+        }
+    });
+    for (BBox const& bounds : chunkBounds)
+        this->bounds.Grow(bounds);
+
+    BVH bvh;
+    bvh.Build(primBounds, builder);
+    this->bvh8.Build(bvh);
+
+    unsigned const* order = this->bvh8.PrimData();
+    for (int c = 0; c < 3; c++)
+        for (int axis = 0; axis < 3; axis++)
+            this->corners[c][axis].resize(triangleCount + MaxWidth, 0.0f);
+    ParallelRange(triangleCount, numChunks, [&](unsigned begin, unsigned end, unsigned)
+    {
+        for (unsigned i = begin; i < end; i++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                float const* p = &this->positions[this->indices[order[i] * 3 + c] * 3];
+                for (int axis = 0; axis < 3; axis++)
+                    this->corners[c][axis][i] = p[axis];
+            }
+        }
+    });
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    this->buildTime = std::chrono::duration<float, std::milli>(stop - start).count();
+}
+
+//------------------------------------------------------------------------------
+/**
+    The normal follows the winding, so it points out of closed meshes
+    that are wound counter clockwise seen from outside
+*/
+void
+TriangleMesh::GetHit(Ray const& ray, unsigned slot, float t, HitResult& hit)
+{
+    vec3 a(this->corners[0][0][slot], this->corners[0][1][slot], this->corners[0][2][slot]);
+    vec3 b(this->corners[1][0][slot], this->corners[1][1][slot], this->corners[1][2][slot]);
+    vec3 c(this->corners[2][0][slot], this->corners[2][1][slot], this->corners[2][2][slot]);
+    hit.p = ray.PointAt(t);
+    hit.normal = normalize(cross(b - a, c - a));
+    hit.t = t;
+    hit.object = this;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+size_t
+TriangleMesh::MemoryUsage() const
+{
+    size_t bytes = (this->positions.size() + 9 * (this->TriangleCount() + MaxWidth)) * sizeof(float) +
+        this->indices.size() * sizeof(unsigned);
+    return bytes + this->bvh8.nodes.size() * sizeof(WideBVHNode<8>) + this->bvh8.primIndices.size() * sizeof(unsigned);
+}
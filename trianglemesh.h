@@ -0,0 +1,345 @@
+#pragma once
+#include <vector>
+#include "object.h"
+#include "bvh.h"
+#include "widebvh.h"
+#include "material.h"
+#include "pbr.h"
+#include "simd.h"
+
+// the kernels are compiled per instruction set, see simd.h
+namespace TRAYRACER_ISA
+{
+
+// lanes of the kernels, 16 with AVX-512, 8 otherwise
+#if TRAYRACER_AVX512
+constexpr unsigned TriangleWidth = 16;
+#else
+constexpr unsigned TriangleWidth = 8;
+#endif
+
+//------------------------------------------------------------------------------
+/**
+    Ray prepared for the watertight triangle test. The axes are permuted so
+    that the direction is largest along kz, and sheared so that it becomes
+    the unit z axis. Triangles are then tested in 2D, with edge functions
+    that agree on shared edges, so no ray slips through between triangles.
+*/
+struct TriangleRay
+{
+    unsigned kx, ky, kz;
+    // origin in the permuted axes
+    float origin[3];
+    // shear of x and y, and scale of z
+    float sx, sy, sz;
+
+    TriangleRay(Ray const& ray)
+    {
+        float const* o = &ray.b.x;
+        float const* d = &ray.m.x;
+        this->kz = fabsf(d[0]) > fabsf(d[1]) ? (fabsf(d[0]) > fabsf(d[2]) ? 0 : 2) : (fabsf(d[1]) > fabsf(d[2]) ? 1 : 2);
+        this->kx = this->kz == 2 ? 0 : this->kz + 1;
+        this->ky = this->kx == 2 ? 0 : this->kx + 1;
+        // keep the winding, so the sign of the edge functions does not depend on the direction
+        if (d[this->kz] < 0.0f)
+        {
+            unsigned k = this->kx;
+            this->kx = this->ky;
+            this->ky = k;
+        }
+        this->origin[0] = o[this->kx];
+        this->origin[1] = o[this->ky];
+        this->origin[2] = o[this->kz];
+        this->sx = d[this->kx] / d[this->kz];
+        this->sy = d[this->ky] / d[this->kz];
+        this->sz = 1.0f / d[this->kz];
+    }
+};
+
+} // namespace TRAYRACER_ISA
+using namespace TRAYRACER_ISA;
+
+//------------------------------------------------------------------------------
+/**
+    Indexed triangle mesh, triangles share their vertices through the index
+    buffer. The mesh has its own 8 wide bvh over its triangles, built once,
+    and keeps the corners of every triangle as structure of arrays in the
+    primitive order of that bvh, so that the triangles of a leaf are tested
+    a whole vector register at a time.
+
+    In scenes, meshes are intersected through the MeshArray of
+    ScenePrimitives, with the kernels of the instruction set Raytracer runs.
+    Use an InstanceGroup to place the same mesh several times.
+*/
+class TriangleMesh : public Object
+{
+public:
+    // positions holds x, y and z of each vertex, indices three vertices per triangle,
+    // counter clockwise seen from the front. Builds the bvh
+    TriangleMesh(std::vector<float> positions, std::vector<unsigned> indices, unsigned material, BVHBuilder builder = BVHBuilder::SAH);
+
+    ~TriangleMesh() override
+    {
+
+    }
+
+    Color GetColor() override
+    {
+        return LookupMaterial(this->material)->color;
+    }
+
+    Material const* GetMaterial() override
+    {
+        return LookupMaterial(this->material);
+    }
+
+    bool GetBounds(BBox& bounds) override
+    {
+        bounds = this->bounds;
+        return !bounds.IsEmpty();
+    }
+
+    bool Intersect(Ray const& ray, float maxDist, HitResult& hit) override
+    {
+        return this->IntersectTriangles(ray, TriangleRay(ray), maxDist, hit);
+    }
+
+    bool Occluded(Ray const& ray, float maxDist) override
+    {
+        return this->OccludedTriangles(ray, TriangleRay(ray), maxDist);
+    }
+
+    Ray ScatterRay(Ray ray, vec3 point, vec3 normal, RandomStream& random) override
+    {
+        return BSDF(LookupMaterial(this->material), ray, point, normal, random);
+    }
+
+    // closest triangle hit before maxDist, fills hit. hit.object is the mesh
+    bool IntersectTriangles(Ray const& ray, TriangleRay const& prepared, float maxDist, HitResult& hit);
+    // true if any triangle is hit before maxDist
+    bool OccludedTriangles(Ray const& ray, TriangleRay const& prepared, float maxDist) const;
+
+    // closest triangle in slots [first, first + count) that is hit before tMax.
+    // Shrinks tMax to the hit distance and sets slot, returns false if nothing was hit
+    template<unsigned WIDTH = TriangleWidth>
+    bool Closest(TriangleRay const& ray, unsigned first, unsigned count, float& tMax, unsigned& slot) const;
+    // true if any triangle in slots [first, first + count) is hit before tMax
+    template<unsigned WIDTH = TriangleWidth>
+    bool Any(TriangleRay const& ray, unsigned first, unsigned count, float tMax) const;
+
+    // hit record of a ray that hit the triangle in slot at distance t, with the geometric normal
+    void GetHit(Ray const& ray, unsigned slot, float t, HitResult& hit);
+
+    unsigned VertexCount() const { return (unsigned)(this->positions.size() / 3); }
+    unsigned TriangleCount() const { return (unsigned)(this->indices.size() / 3); }
+
+    // bytes used by the buffers, the bvh and the triangle arrays
+    size_t MemoryUsage() const;
+    // calls func(data, bytes) for the same arrays
+    template<class FUNC>
+    void ForEachBuffer(FUNC&& func) const
+    {
+        func(this->positions.data(), this->positions.size() * sizeof(float));
+        func(this->indices.data(), this->indices.size() * sizeof(unsigned));
+        func(this->bvh8.nodes.data(), this->bvh8.nodes.size() * sizeof(this->bvh8.nodes[0]));
+        func(this->bvh8.primIndices.data(), this->bvh8.primIndices.size() * sizeof(unsigned));
+        for (auto const& corner : this->corners)
+        {
+            for (std::vector<float> const& axis : corner)
+                func(axis.data(), axis.size() * sizeof(float));
+        }
+    }
+
+    // vertex and index buffers as given
+    std::vector<float> const positions;
+    std::vector<unsigned> const indices;
+    // index of the material, see AddMaterial
+    unsigned material;
+
+    // duration of building the bvh and the triangle arrays, in milliseconds
+    float buildTime = 0.0f;
+
+    // widest kernel of any instruction set, the arrays are padded for it
+    static constexpr unsigned MaxWidth = 16;
+
+private:
+    BBox bounds;
+    WideBVH<8> bvh8;
+    // corner c of every triangle along axis a in corners[c][a], in the primitive order of
+    // bvh8 and padded by MaxWidth
+    std::vector<float> corners[3][3];
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+inline bool
+TriangleMesh::IntersectTriangles(Ray const& ray, TriangleRay const& prepared, float maxDist, HitResult& hit)
+{
+    float tMax = maxDist;
+    unsigned slot = 0;
+    bool found = false;
+    this->bvh8.IntersectLeaves(ray, tMax, [&](unsigned first, unsigned count)
+    {
+        if (this->Closest(prepared, first, count, tMax, slot))
+            found = true;
+    });
+    if (!found)
+        return false;
+    this->GetHit(ray, slot, tMax, hit);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+/**
+    A negative tMax ends the traversal once something is hit
+*/
+inline bool
+TriangleMesh::OccludedTriangles(Ray const& ray, TriangleRay const& prepared, float maxDist) const
+{
+    bool occluded = false;
+    float tMax = maxDist;
+    this->bvh8.IntersectLeaves(ray, tMax, [&](unsigned first, unsigned count)
+    {
+        if (this->Any(prepared, first, count, maxDist))
+        {
+            occluded = true;
+            tMax = -FLT_MAX;
+        }
+    });
+    return occluded;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The watertight test of Woop, Benthin and Wald. The corners are moved
+    into the space of the ray, where U, V and W are the 2D edge functions
+    of the opposite edges. The ray hits if they all have the same sign, and
+    their sum is twice the signed area of the projected triangle, which
+    turns the scaled distance T into t. Both sides of a triangle are hit.
+*/
+template<unsigned WIDTH>
+inline bool
+TriangleMesh::Closest(TriangleRay const& ray, unsigned first, unsigned count, float& tMax, unsigned& slot) const
+{
+    using vf = vfloat<WIDTH>;
+    float const* ax = this->corners[0][ray.kx].data();
+    float const* ay = this->corners[0][ray.ky].data();
+    float const* az = this->corners[0][ray.kz].data();
+    float const* bx = this->corners[1][ray.kx].data();
+    float const* by = this->corners[1][ray.ky].data();
+    float const* bz = this->corners[1][ray.kz].data();
+    float const* cx = this->corners[2][ray.kx].data();
+    float const* cy = this->corners[2][ray.ky].data();
+    float const* cz = this->corners[2][ray.kz].data();
+    vf ox = vf::Broadcast(ray.origin[0]);
+    vf oy = vf::Broadcast(ray.origin[1]);
+    vf oz = vf::Broadcast(ray.origin[2]);
+    vf sx = vf::Broadcast(ray.sx);
+    vf sy = vf::Broadcast(ray.sy);
+    vf sz = vf::Broadcast(ray.sz);
+    vf zero = vf::Broadcast(0.0f);
+    vf minDist = vf::Broadcast(0.001f);
+
+    bool found = false;
+    for (unsigned base = 0; base < count; base += WIDTH)
+    {
+        unsigned i = first + base;
+        vf Az = vf::Load(az + i) - oz;
+        vf Bz = vf::Load(bz + i) - oz;
+        vf Cz = vf::Load(cz + i) - oz;
+        vf Ax = vf::Load(ax + i) - ox - sx * Az;
+        vf Ay = vf::Load(ay + i) - oy - sy * Az;
+        vf Bx = vf::Load(bx + i) - ox - sx * Bz;
+        vf By = vf::Load(by + i) - oy - sy * Bz;
+        vf Cx = vf::Load(cx + i) - ox - sx * Cz;
+        vf Cy = vf::Load(cy + i) - oy - sy * Cz;
+
+        vf U = Cx * By - Cy * Bx;
+        vf V = Ax * Cy - Ay * Cx;
+        vf W = Bx * Ay - By * Ax;
+        vf det = U + V + W;
+        vf t = (U * Az + V * Bz + W * Cz) * sz / det;
+
+        vf sameSign = ((U >= zero) & (V >= zero) & (W >= zero)) | ((U <= zero) & (V <= zero) & (W <= zero));
+        vf tm = vf::Broadcast(tMax);
+        unsigned hits = Mask(sameSign & ((det < zero) | (det > zero)) & (t > minDist) & (t < tm));
+        // lanes past the range belong to other leaves, or to the padding
+        if (count - base < WIDTH)
+            hits &= (1u << (count - base)) - 1;
+        if (hits == 0)
+            continue;
+
+        alignas(64) float ts[WIDTH];
+        t.Store(ts);
+        do
+        {
+            unsigned lane = FirstLane(hits);
+            hits &= hits - 1;
+            if (ts[lane] < tMax)
+            {
+                tMax = ts[lane];
+                slot = i + lane;
+                found = true;
+            }
+        } while (hits != 0);
+    }
+    return found;
+}
+
+//------------------------------------------------------------------------------
+/**
+    The tests of Closest, stops at the first register with a hit
+*/
+template<unsigned WIDTH>
+inline bool
+TriangleMesh::Any(TriangleRay const& ray, unsigned first, unsigned count, float tMax) const
+{
+    using vf = vfloat<WIDTH>;
+    float const* ax = this->corners[0][ray.kx].data();
+    float const* ay = this->corners[0][ray.ky].data();
+    float const* az = this->corners[0][ray.kz].data();
+    float const* bx = this->corners[1][ray.kx].data();
+    float const* by = this->corners[1][ray.ky].data();
+    float const* bz = this->corners[1][ray.kz].data();
+    float const* cx = this->corners[2][ray.kx].data();
+    float const* cy = this->corners[2][ray.ky].data();
+    float const* cz = this->corners[2][ray.kz].data();
+    vf ox = vf::Broadcast(ray.origin[0]);
+    vf oy = vf::Broadcast(ray.origin[1]);
+    vf oz = vf::Broadcast(ray.origin[2]);
+    vf sx = vf::Broadcast(ray.sx);
+    vf sy = vf::Broadcast(ray.sy);
+    vf sz = vf::Broadcast(ray.sz);
+    vf zero = vf::Broadcast(0.0f);
+    vf minDist = vf::Broadcast(0.001f);
+    vf tm = vf::Broadcast(tMax);
+
+    for (unsigned base = 0; base < count; base += WIDTH)
+    {
+        unsigned i = first + base;
+        vf Az = vf::Load(az + i) - oz;
+        vf Bz = vf::Load(bz + i) - oz;
+        vf Cz = vf::Load(cz + i) - oz;
+        vf Ax = vf::Load(ax + i) - ox - sx * Az;
+        vf Ay = vf::Load(ay + i) - oy - sy * Az;
+        vf Bx = vf::Load(bx + i) - ox - sx * Bz;
+        vf By = vf::Load(by + i) - oy - sy * Bz;
+        vf Cx = vf::Load(cx + i) - ox - sx * Cz;
+        vf Cy = vf::Load(cy + i) - oy - sy * Cz;
+
+        vf U = Cx * By - Cy * Bx;
+        vf V = Ax * Cy - Ay * Cx;
+        vf W = Bx * Ay - By * Ax;
+        vf det = U + V + W;
+        vf t = (U * Az + V * Bz + W * Cz) * sz / det;
+
+        vf sameSign = ((U >= zero) & (V >= zero) & (W >= zero)) | ((U <= zero) & (V <= zero) & (W <= zero));
+        unsigned hits = Mask(sameSign & ((det < zero) | (det > zero)) & (t > minDist) & (t < tm));
+        if (count - base < WIDTH)
+            hits &= (1u << (count - base)) - 1;
+        if (hits != 0)
+            return true;
+    }
+    return false;
+}
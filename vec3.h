@@ -1,77 +1,106 @@
 #pragma once
 #include <cmath>
-#include <initializer_list>
-#include <assert.h>
+#include <type_traits>
+#include "simd.h"
 
 #define MPI 3.14159265358979323846
 
-class vec3
+//------------------------------------------------------------------------------
+/**
+    3D vector in single precision, the precision of mat4 and of the kernels.
+    It is a 4 wide register, so it is passed around in one and the operations
+    below are an instruction or two. The padding lane is 0 and stays 0 through
+    all of them, dot relies on that
+*/
+class alignas(16) vec3
 {
 public:
-    vec3() : x(0), y(0), z(0) {}
+    SIMD_INLINE vec3() : v(vfloat4::Broadcast(0.0f)) {}
+    SIMD_INLINE vec3(float x, float y, float z) : v(vfloat4::Set(x, y, z, 0.0f)) {}
+    explicit SIMD_INLINE vec3(vfloat4 v) : v(v) {}
 
-    vec3(double x, double y, double z) : x(x), y(y), z(z) {}
+    SIMD_INLINE vfloat4 Load() const { return this->v; }
 
-    vec3(std::initializer_list<double> const il)
+    SIMD_INLINE vec3 operator+(vec3 const& rhs) const { return vec3(this->v + rhs.v); }
+    SIMD_INLINE vec3 operator-(vec3 const& rhs) const { return vec3(this->v - rhs.v); }
+    SIMD_INLINE vec3 operator-() const { return vec3(vfloat4::Broadcast(0.0f) - this->v); }
+    SIMD_INLINE vec3 operator*(float const c) const { return vec3(this->v * vfloat4::Broadcast(c)); }
+
+    union
     {
-        assert(il.size() == 3);
+        vfloat4 v;
+        struct { float x, y, z, pad; };
+    };
+};
 
-        int i = 0;
-        for (auto v : il)
-        {
-            double* d = reinterpret_cast<double*>(this);
-            d += i;
-            *d = v;
-            i++;
-        }
-    }
+static_assert(sizeof(vec3) == 16 && std::is_trivially_copyable<vec3>::value, "vec3 must stay one trivially copyable register");
 
-    ~vec3() {}
+//------------------------------------------------------------------------------
+/**
+    4D vector, rows of mat4 and homogeneous points
+*/
+class alignas(16) vec4
+{
+public:
+    SIMD_INLINE vec4() : v(vfloat4::Broadcast(0.0f)) {}
+    SIMD_INLINE vec4(float x, float y, float z, float w) : v(vfloat4::Set(x, y, z, w)) {}
+    SIMD_INLINE vec4(vec3 const& xyz, float w) : v(vfloat4::Set(xyz.x, xyz.y, xyz.z, w)) {}
+    explicit SIMD_INLINE vec4(vfloat4 v) : v(v) {}
 
-    vec3(vec3 const& rhs)
-    {
-        this->x = rhs.x;
-        this->y = rhs.y;
-        this->z = rhs.z;
-    }
+    SIMD_INLINE vfloat4 Load() const { return this->v; }
 
-    vec3 operator+(vec3 const& rhs) { return { x + rhs.x, y + rhs.y, z + rhs.z }; }
-    vec3 operator-(vec3 const& rhs) { return { x - rhs.x, y - rhs.y, z - rhs.z }; }
-    vec3 operator-() { return { -x, -y, -z }; }
-    vec3 operator*(float const c) { return { x * c, y * c, z * c }; }
+    SIMD_INLINE vec4 operator+(vec4 const& rhs) const { return vec4(this->v + rhs.v); }
+    SIMD_INLINE vec4 operator-(vec4 const& rhs) const { return vec4(this->v - rhs.v); }
+    SIMD_INLINE vec4 operator-() const { return vec4(vfloat4::Broadcast(0.0f) - this->v); }
+    SIMD_INLINE vec4 operator*(float const c) const { return vec4(this->v * vfloat4::Broadcast(c)); }
 
-    double x, y, z;
+    union
+    {
+        vfloat4 v;
+        struct { float x, y, z, w; };
+    };
 };
 
+static_assert(sizeof(vec4) == 16 && std::is_trivially_copyable<vec4>::value, "vec4 must stay one trivially copyable register");
+
+// the free functions are compiled per instruction set, see simd.h
+namespace TRAYRACER_ISA
+{
+
+inline float dot(vec3 a, vec3 b)
+{
+    return Sum(a.v * b.v);
+}
+
+inline float dot(vec4 a, vec4 b)
+{
+    return Sum(a.v * b.v);
+}
+
 // Get length of 3D vector
-inline double len(vec3 const& v)
+inline float len(vec3 const& v)
 {
-    return(sqrtf(v.x * v.x + v.y * v.y + v.z * v.z));
+    return sqrtf(dot(v, v));
 }
 
 // Get normalized version of v
 inline vec3 normalize(vec3 v)
 {
-    double l = len(v);
-    if (len == 0) return v;
-    return vec3((v.x / l), (v.y / l), (v.z / l));
+    float l = len(v);
+    if (l == 0.0f) return v;
+    return v * (1.0f / l);
 }
 
 // piecewise multiplication between two vectors
 inline vec3 mul(vec3 a, vec3 b)
 {
-    return { a.x * b.x, a.y * b.y, a.z * b.z };
+    return vec3(a.v * b.v);
 }
 
 // piecewise add between two vectors
 inline vec3 add(vec3 a, vec3 b)
 {
-    return { a.x + b.x, a.y + b.y, a.z + b.z };
-}
-
-inline float dot(vec3 a, vec3 b)
-{
-    return a.x * b.x + a.y * b.y + a.z * b.z;
+    return vec3(a.v + b.v);
 }
 
 inline vec3 reflect(vec3 v, vec3 n)
@@ -81,7 +110,9 @@ inline vec3 reflect(vec3 v, vec3 n)
 
 inline vec3 cross(vec3 a, vec3 b)
 {
-    return { a.y * b.z - a.z * b.y,
-             a.z * b.x - a.x * b.z,
-             a.x * b.y - a.y * b.x, };
-}
\ No newline at end of file
+    // (a * b.yzx - a.yzx * b).yzx
+    return vec3(RotateXYZ(a.v * RotateXYZ(b.v) - RotateXYZ(a.v) * b.v));
+}
+
+} // namespace TRAYRACER_ISA
+using namespace TRAYRACER_ISA;
@@ -0,0 +1,323 @@
+#include "wavefront.h"
+#include "raytracer.h"
+#include "pbr.h"
+#include <algorithm>
+#include <chrono>
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+PathStates::Resize(unsigned size)
+{
+    this->origin.resize(size);
+    this->direction.resize(size);
+    this->throughput.resize(size);
+    this->pixel.resize(size);
+    this->sample.resize(size);
+    this->hitPoint.resize(size);
+    this->hitNormal.resize(size);
+    this->hitObject.resize(size);
+    this->hitMaterial.resize(size);
+    this->alive.resize(size);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+WavefrontIntegrator::Render(Raytracer& rt, unsigned firstSample)
+{
+    unsigned numSamples = rt.width * rt.height * rt.rpp;
+    this->paths.Resize(std::min(numSamples, MaxPaths));
+
+    for (unsigned first = 0; first < numSamples; first += MaxPaths)
+    {
+        this->Generate(rt, firstSample, first, std::min(numSamples - first, MaxPaths));
+        for (unsigned bounce = 0; this->paths.count > 0; bounce++)
+        {
+            if (this->bounceStats.size() <= bounce)
+                this->bounceStats.resize(bounce + 1);
+            WavefrontBounceStats& stats = this->bounceStats[bounce];
+            stats.rays += this->paths.count;
+
+            // camera rays are coherent in pixel order already
+            auto start = std::chrono::high_resolution_clock::now();
+            if (bounce > 0 && rt.sortSecondaryRays)
+                this->Sort(rt);
+            auto sorted = std::chrono::high_resolution_clock::now();
+            this->Extend(rt);
+            auto extended = std::chrono::high_resolution_clock::now();
+            stats.sortTime += std::chrono::duration<double>(sorted - start).count();
+            stats.extendTime += std::chrono::duration<double>(extended - sorted).count();
+
+            this->Classify(bounce == rt.bounces);
+            this->ShadeMiss(rt);
+            this->ShadeMicrofacet(this->queues[LambertianQueue], 0.04f, bounce);
+            this->ShadeMicrofacet(this->queues[ConductorQueue], 0.95f, bounce);
+            this->ShadeDielectric(this->queues[DielectricQueue], bounce);
+            this->ShadeObject(this->queues[ObjectQueue], bounce);
+            this->Compact();
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Same jittered camera rays as Raytracer::Raytrace
+*/
+void
+WavefrontIntegrator::Generate(Raytracer& rt, unsigned firstSample, unsigned first, unsigned count)
+{
+    vec3 origin = get_position(rt.view);
+    PathStates& paths = this->paths;
+
+    for (unsigned i = 0; i < count; i++)
+    {
+        unsigned pixel = (first + i) / rt.rpp;
+        unsigned x = pixel % rt.width;
+        unsigned y = pixel / rt.width;
+        unsigned sample = firstSample + (first + i) % rt.rpp;
+        RandomStream random(pixel, sample, RandomStream::CameraBounce);
+        float u = ((float(x + random.Next()) * (1.0f / rt.width)) * 2.0f) - 1.0f;
+        float v = ((float(y + random.Next()) * (1.0f / rt.height)) * 2.0f) - 1.0f;
+
+        paths.origin[i] = origin;
+        paths.direction[i] = transform(vec3(u, v, -1.0f), rt.frustum);
+        paths.throughput[i] = { 1.0f, 1.0f, 1.0f };
+        paths.pixel[i] = pixel;
+        paths.sample[i] = sample;
+    }
+    paths.count = count;
+}
+
+//------------------------------------------------------------------------------
+/**
+    Scattered rays leave in all directions, so consecutive paths rarely share
+    nodes of the tree. Sorting groups them by the octant of their direction,
+    which decides the order children are visited in, and within an octant by
+    the morton code of their origin, quantized over the bounds of the wave.
+    With 4 bits per axis the keys fit in 15 bits, two passes of the radix sort
+*/
+void
+WavefrontIntegrator::Sort(Raytracer& rt)
+{
+    PathStates& paths = this->paths;
+    unsigned count = paths.count;
+
+    // fminf and fmaxf are calls without fast math, the vector min and max are one instruction
+    vfloat4 lo = paths.origin[0].Load();
+    vfloat4 hi = lo;
+    for (unsigned i = 1; i < count; i++)
+    {
+        vfloat4 o = paths.origin[i].Load();
+        lo = Min(lo, o);
+        hi = Max(hi, o);
+    }
+    float min[4], extent[4];
+    lo.Store(min);
+    (hi - lo).Store(extent);
+    float scale[3];
+    for (int a = 0; a < 3; a++)
+        scale[a] = extent[a] > 0.0f ? ((1u << SortBitsPerAxis) - 1) / extent[a] : 0.0f;
+
+    this->sortKeys.resize(count);
+    this->sortOrder.resize(count);
+    for (unsigned i = 0; i < count; i++)
+    {
+        vec3 const& o = paths.origin[i];
+        vec3 const& d = paths.direction[i];
+        unsigned octant = (d.x < 0.0f ? 1 : 0) | (d.y < 0.0f ? 2 : 0) | (d.z < 0.0f ? 4 : 0);
+        float origin[3] = { o.x, o.y, o.z };
+        unsigned code = 0;
+        for (int a = 0; a < 3; a++)
+            code |= ExpandBits((unsigned)((origin[a] - min[a]) * scale[a])) << (2 - a);
+        this->sortKeys[i] = (octant << (3 * SortBitsPerAxis)) | code;
+        this->sortOrder[i] = i;
+    }
+    RadixSort(this->sortKeys, this->sortOrder, 3 * SortBitsPerAxis + 3, this->sortBuffers, rt.GetThreadPool());
+
+    // hits and queues are rebuilt by the stages that follow, only the paths move
+    auto gather = [this, count](auto& field, auto& scratch)
+    {
+        scratch.resize(field.size());
+        for (unsigned i = 0; i < count; i++)
+            scratch[i] = field[this->sortOrder[i]];
+        field.swap(scratch);
+    };
+    gather(paths.origin, this->sorted.origin);
+    gather(paths.direction, this->sorted.direction);
+    gather(paths.throughput, this->sorted.throughput);
+    gather(paths.pixel, this->sorted.pixel);
+    gather(paths.sample, this->sorted.sample);
+}
+
+//------------------------------------------------------------------------------
+/**
+    The paths are independent here, chunks of them are traced on the
+    threads of Raytracer::GetThreadPool
+*/
+void
+WavefrontIntegrator::Extend(Raytracer& rt)
+{
+    PathStates& paths = this->paths;
+    constexpr unsigned chunkSize = 1024;
+    rt.GetThreadPool().RunTasks((paths.count + chunkSize - 1) / chunkSize, [&](unsigned chunk, unsigned)
+    {
+        unsigned end = std::min(paths.count, (chunk + 1) * chunkSize);
+        for (unsigned i = chunk * chunkSize; i < end; i++)
+        {
+            float distance = FLT_MAX;
+            Object* object = nullptr;
+            if (!rt.Raycast(Ray(paths.origin[i], paths.direction[i]), paths.hitPoint[i], paths.hitNormal[i], object, distance))
+                object = nullptr;
+            paths.hitObject[i] = object;
+        }
+    });
+}
+
+//------------------------------------------------------------------------------
+/**
+    TracePath returns black for hits past the last bounce, those paths end here
+    without adding anything
+*/
+void
+WavefrontIntegrator::Classify(bool lastBounce)
+{
+    for (std::vector<unsigned>& queue : this->queues)
+        queue.clear();
+
+    PathStates& paths = this->paths;
+    for (unsigned i = 0; i < paths.count; i++)
+    {
+        Object* object = paths.hitObject[i];
+        paths.alive[i] = object != nullptr && !lastBounce;
+        if (object == nullptr)
+        {
+            this->queues[MissQueue].push_back(i);
+            continue;
+        }
+        if (lastBounce)
+            continue;
+
+        Material const* material = object->GetMaterial();
+        paths.hitMaterial[i] = material;
+        if (material == nullptr)
+        {
+            this->queues[ObjectQueue].push_back(i);
+            continue;
+        }
+        switch (GetMaterialType(material))
+        {
+        case MaterialType::Conductor:
+            this->queues[ConductorQueue].push_back(i);
+            break;
+        case MaterialType::Dielectric:
+            this->queues[DielectricQueue].push_back(i);
+            break;
+        default:
+            this->queues[LambertianQueue].push_back(i);
+            break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Each sample adds its share of the pixel, like Raytrace dividing by rpp
+*/
+void
+WavefrontIntegrator::ShadeMiss(Raytracer& rt)
+{
+    PathStates& paths = this->paths;
+    float weight = 1.0f / rt.rpp;
+    for (unsigned i : this->queues[MissQueue])
+    {
+        Color color = paths.throughput[i] * rt.Skybox(paths.direction[i]);
+        Color& pixel = rt.frameBuffer[paths.pixel[i]];
+        pixel.r += color.r * weight;
+        pixel.g += color.g * weight;
+        pixel.b += color.b * weight;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+WavefrontIntegrator::ShadeMicrofacet(std::vector<unsigned> const& queue, float F0, unsigned bounce)
+{
+    PathStates& paths = this->paths;
+    for (unsigned i : queue)
+    {
+        Material const* material = paths.hitMaterial[i];
+        RandomStream random(paths.pixel[i], paths.sample[i], bounce + 1);
+        Ray ray = ScatterMicrofacet(material, F0, Ray(paths.origin[i], paths.direction[i]), paths.hitPoint[i], paths.hitNormal[i], random);
+        paths.origin[i] = ray.b;
+        paths.direction[i] = ray.m;
+        paths.throughput[i] = paths.throughput[i] * material->color;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+WavefrontIntegrator::ShadeDielectric(std::vector<unsigned> const& queue, unsigned bounce)
+{
+    PathStates& paths = this->paths;
+    for (unsigned i : queue)
+    {
+        Material const* material = paths.hitMaterial[i];
+        RandomStream random(paths.pixel[i], paths.sample[i], bounce + 1);
+        Ray ray = ScatterDielectric(material, Ray(paths.origin[i], paths.direction[i]), paths.hitPoint[i], paths.hitNormal[i], random);
+        paths.origin[i] = ray.b;
+        paths.direction[i] = ray.m;
+        paths.throughput[i] = paths.throughput[i] * material->color;
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+void
+WavefrontIntegrator::ShadeObject(std::vector<unsigned> const& queue, unsigned bounce)
+{
+    PathStates& paths = this->paths;
+    for (unsigned i : queue)
+    {
+        Object* object = paths.hitObject[i];
+        RandomStream random(paths.pixel[i], paths.sample[i], bounce + 1);
+        Ray ray = object->ScatterRay(Ray(paths.origin[i], paths.direction[i]), paths.hitPoint[i], paths.hitNormal[i], random);
+        paths.origin[i] = ray.b;
+        paths.direction[i] = ray.m;
+        paths.throughput[i] = paths.throughput[i] * object->GetColor();
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Stable, so paths of neighbouring pixels stay next to each other.
+    Hits are not moved, Extend overwrites them
+*/
+void
+WavefrontIntegrator::Compact()
+{
+    PathStates& paths = this->paths;
+    unsigned count = 0;
+    for (unsigned i = 0; i < paths.count; i++)
+    {
+        if (!paths.alive[i])
+            continue;
+        if (count != i)
+        {
+            paths.origin[count] = paths.origin[i];
+            paths.direction[count] = paths.direction[i];
+            paths.throughput[count] = paths.throughput[i];
+            paths.pixel[count] = paths.pixel[i];
+            paths.sample[count] = paths.sample[i];
+        }
+        count++;
+    }
+    paths.count = count;
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include <vector>
+#include "vec3.h"
+#include "color.h"
+#include "ray.h"
+#include "material.h"
+#include "radixsort.h"
+
+class Raytracer;
+class Object;
+
+//------------------------------------------------------------------------------
+/**
+    State of the paths in flight, one array per field, indexed by path
+*/
+struct PathStates
+{
+    // ray of the next segment
+    std::vector<vec3> origin;
+    std::vector<vec3> direction;
+    // product of the colors of the surfaces hit so far
+    std::vector<Color> throughput;
+    // index into the frame buffer
+    std::vector<unsigned> pixel;
+    // sample of the pixel, keys the random numbers of the path with pixel
+    std::vector<unsigned> sample;
+
+    // closest hit of the last segment, hitObject is null for misses
+    std::vector<vec3> hitPoint;
+    std::vector<vec3> hitNormal;
+    std::vector<Object*> hitObject;
+    std::vector<Material const*> hitMaterial;
+
+    // cleared once a path has terminated, compaction removes it
+    std::vector<unsigned char> alive;
+
+    // number of paths in flight, the arrays are at least this long
+    unsigned count = 0;
+
+    void Resize(unsigned size);
+};
+
+//------------------------------------------------------------------------------
+/**
+    Work of one bounce, summed over the frames rendered since the last ResetStats
+*/
+struct WavefrontBounceStats
+{
+    // rays traced by the extend stage
+    unsigned long long rays = 0;
+    // seconds spent in the extend stage
+    double extendTime = 0.0;
+    // seconds spent sorting the rays before it
+    double sortTime = 0.0;
+};
+
+//------------------------------------------------------------------------------
+/**
+    Breadth first alternative to RaytracerKernels::TracePath. Instead of following
+    one path to the end before starting the next, all paths of a wave are
+    advanced one bounce at a time, in stages that each run a single kind of
+    work over all paths that need it:
+
+    sort        optional, from the first bounce on, see Sort
+    extend      closest hit of every path
+    classify    paths that missed go to the miss queue, paths that hit to the
+                queue of their material, paths that hit at the last bounce end
+    miss        add the skybox seen by missed paths to the frame buffer
+    shade       scatter the paths of one material queue, and weigh them by its color
+    compact     move the paths that go on to the front of the arrays
+
+    The estimator is the one of TracePath, and a path draws the same random
+    numbers as there, keyed by its pixel, sample and bounce, so both give
+    the same image up to rounding.
+*/
+class WavefrontIntegrator
+{
+public:
+    // paths in flight at once, frames with more samples are traced in several waves
+    static constexpr unsigned MaxPaths = 1 << 16;
+
+    // add rt.rpp samples per pixel to the frame buffer of rt, the structure must be built,
+    // the samples of each pixel are numbered from firstSample on
+    void Render(Raytracer& rt, unsigned firstSample);
+
+    // statistics per bounce, the camera rays are bounce 0
+    std::vector<WavefrontBounceStats> bounceStats;
+    void ResetStats() { this->bounceStats.clear(); }
+
+private:
+    // resolution of the origins in the sort keys, finer grids cost more passes
+    // of the radix sort than they save in traversal
+    static constexpr unsigned SortBitsPerAxis = 4;
+
+    // queues of the shade stages
+    enum Queue
+    {
+        MissQueue,
+        LambertianQueue,
+        ConductorQueue,
+        DielectricQueue,
+        // objects without a material scatter through Object::ScatterRay
+        ObjectQueue,
+        NumQueues
+    };
+
+    // camera rays of samples [first, first + count), rpp consecutive samples per pixel
+    void Generate(Raytracer& rt, unsigned firstSample, unsigned first, unsigned count);
+    // reorder the paths so that rays traced one after another are likely to visit the same nodes
+    void Sort(Raytracer& rt);
+    void Extend(Raytracer& rt);
+    void Classify(bool lastBounce);
+    void ShadeMiss(Raytracer& rt);
+    // bounce is the one of the hits being shaded
+    void ShadeMicrofacet(std::vector<unsigned> const& queue, float F0, unsigned bounce);
+    void ShadeDielectric(std::vector<unsigned> const& queue, unsigned bounce);
+    void ShadeObject(std::vector<unsigned> const& queue, unsigned bounce);
+    void Compact();
+
+    PathStates paths;
+    // indices of paths, filled by Classify
+    std::vector<unsigned> queues[NumQueues];
+    // sort keys and the order they give, and the arrays the paths are gathered into
+    std::vector<unsigned> sortKeys;
+    std::vector<unsigned> sortOrder;
+    RadixSortBuffers sortBuffers;
+    PathStates sorted;
+};
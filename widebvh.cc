@@ -0,0 +1,299 @@
+#include "widebvh.h"
+#include <algorithm>
+#include <assert.h>
+
+//------------------------------------------------------------------------------
+/**
+    Union of the used slots of a node
+*/
+template<unsigned WIDTH>
+static BBox
+NodeBounds(WideBVHNode<WIDTH> const& node)
+{
+    BBox bounds;
+    for (unsigned s = 0; s < WIDTH; s++)
+    {
+        if (node.minX[s] == INFINITY)
+            continue;
+        float lo[3] = { node.minX[s], node.minY[s], node.minZ[s] };
+        float hi[3] = { node.maxX[s], node.maxY[s], node.maxZ[s] };
+        bounds.Grow(lo);
+        bounds.Grow(hi);
+    }
+    return bounds;
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<unsigned WIDTH>
+void
+WideBVH<WIDTH>::Build(BVH const& bvh)
+{
+    this->attachedNodes = nullptr;
+    this->attachedPrims = nullptr;
+    this->nodes.clear();
+    // collapsing reads the binary nodes from the vector
+    assert(!bvh.IsAttached());
+    this->primIndices = bvh.primIndices;
+    if (bvh.nodes.empty())
+        return;
+
+    // every wide node replaces at least one binary interior node
+    this->nodes.reserve(bvh.nodes.size() / 2 + 1);
+    this->nodes.emplace_back();
+    this->Collapse(bvh, 0, 0);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<unsigned WIDTH>
+void
+WideBVH<WIDTH>::Collapse(BVH const& bvh, unsigned binaryIndex, unsigned index)
+{
+    // pull up to WIDTH binary nodes into this one, always opening the largest interior node
+    unsigned slots[WIDTH];
+    unsigned numSlots = 0;
+    BVHNode const& binary = bvh.nodes[binaryIndex];
+    if (binary.IsLeaf())
+    {
+        slots[numSlots++] = binaryIndex;
+    }
+    else
+    {
+        slots[numSlots++] = binary.leftFirst;
+        slots[numSlots++] = binary.leftFirst + 1;
+        while (numSlots < WIDTH)
+        {
+            int best = -1;
+            float bestArea = -1.0f;
+            for (unsigned s = 0; s < numSlots; s++)
+            {
+                BVHNode const& n = bvh.nodes[slots[s]];
+                if (!n.IsLeaf() && n.bounds.HalfArea() > bestArea)
+                {
+                    best = s;
+                    bestArea = n.bounds.HalfArea();
+                }
+            }
+            if (best < 0)
+                break;
+
+            unsigned opened = slots[best];
+            slots[best] = bvh.nodes[opened].leftFirst;
+            slots[numSlots++] = bvh.nodes[opened].leftFirst + 1;
+        }
+    }
+
+    WideBVHNode<WIDTH> node;
+    for (unsigned s = 0; s < WIDTH; s++)
+    {
+        node.minX[s] = node.maxX[s] = INFINITY;
+        node.minY[s] = node.maxY[s] = INFINITY;
+        node.minZ[s] = node.maxZ[s] = INFINITY;
+        node.child[s] = 0;
+        node.count[s] = 0;
+    }
+
+    for (unsigned s = 0; s < numSlots; s++)
+    {
+        BVHNode const& n = bvh.nodes[slots[s]];
+        node.minX[s] = n.bounds.min[0];
+        node.maxX[s] = n.bounds.max[0];
+        node.minY[s] = n.bounds.min[1];
+        node.maxY[s] = n.bounds.max[1];
+        node.minZ[s] = n.bounds.min[2];
+        node.maxZ[s] = n.bounds.max[2];
+        if (n.IsLeaf())
+        {
+            assert(n.count <= 255);
+            node.child[s] = n.leftFirst;
+            node.count[s] = (unsigned char)n.count;
+        }
+    }
+
+    // for each octant, order the children by how far along the ray direction their centers are
+    for (unsigned octant = 0; octant < 8; octant++)
+    {
+        float sign[3];
+        for (int a = 0; a < 3; a++)
+            sign[a] = (octant & (1 << a)) ? -1.0f : 1.0f;
+
+        float key[WIDTH];
+        unsigned order[WIDTH];
+        for (unsigned s = 0; s < WIDTH; s++)
+        {
+            order[s] = s;
+            key[s] = FLT_MAX;
+            if (s < numSlots)
+            {
+                BBox const& b = bvh.nodes[slots[s]].bounds;
+                key[s] = sign[0] * b.Center(0) + sign[1] * b.Center(1) + sign[2] * b.Center(2);
+            }
+        }
+        std::stable_sort(order, order + WIDTH, [&key](unsigned a, unsigned b) { return key[a] < key[b]; });
+
+        typename WideBVHNode<WIDTH>::OrderType packed = 0;
+        for (unsigned i = 0; i < WIDTH; i++)
+            packed |= order[i] << (i * WideBVHNode<WIDTH>::OrderBits);
+        node.order[octant] = packed;
+    }
+
+    this->nodes[index] = node;
+
+    for (unsigned s = 0; s < numSlots; s++)
+    {
+        if (bvh.nodes[slots[s]].IsLeaf())
+            continue;
+        unsigned childIndex = (unsigned)this->nodes.size();
+        this->nodes.emplace_back();
+        this->nodes[index].child[s] = childIndex;
+        this->Collapse(bvh, slots[s], childIndex);
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<unsigned WIDTH>
+void
+WideBVH<WIDTH>::Reorder(BVHLayout layout)
+{
+    if (layout == BVHLayout::DepthFirst || this->nodes.size() <= 1)
+        return;
+    assert(!this->IsAttached());
+
+    // the root is never a child, so child 0 without primitives marks an unused slot
+    auto children = [this](unsigned index, unsigned* out)
+    {
+        WideBVHNode<WIDTH> const& node = this->nodes[index];
+        unsigned count = 0;
+        for (unsigned s = 0; s < WIDTH; s++)
+        {
+            if (node.count[s] == 0 && node.child[s] != 0)
+                out[count++] = node.child[s];
+        }
+        return count;
+    };
+    auto area = [this](unsigned index)
+    {
+        return NodeBounds(this->nodes[index]).HalfArea();
+    };
+    std::vector<unsigned> order = TreeletOrder((unsigned)this->nodes.size(), sizeof(WideBVHNode<WIDTH>), children, area);
+    assert(order.size() == this->nodes.size() && order[0] == 0);
+
+    std::vector<unsigned> newIndex(order.size());
+    for (unsigned i = 0; i < (unsigned)order.size(); i++)
+        newIndex[order[i]] = i;
+
+    std::vector<WideBVHNode<WIDTH>> reordered(this->nodes.size());
+    for (unsigned i = 0; i < (unsigned)order.size(); i++)
+    {
+        WideBVHNode<WIDTH> node = this->nodes[order[i]];
+        for (unsigned s = 0; s < WIDTH; s++)
+        {
+            if (node.count[s] == 0 && node.child[s] != 0)
+                node.child[s] = newIndex[node.child[s]];
+        }
+        reordered[i] = node;
+    }
+    this->nodes.swap(reordered);
+}
+
+//------------------------------------------------------------------------------
+/**
+    Children come after their parents in every layout, so walking the nodes
+    backwards updates them before the slots that point to them
+*/
+template<unsigned WIDTH>
+void
+WideBVH<WIDTH>::Refit(std::vector<BBox> const& primBounds)
+{
+    if (this->IsAttached())
+    {
+        this->nodes.assign(this->attachedNodes, this->attachedNodes + this->attachedNodeCount);
+        this->primIndices.assign(this->attachedPrims, this->attachedPrims + this->attachedPrimCount);
+        this->attachedNodes = nullptr;
+        this->attachedPrims = nullptr;
+    }
+    assert(primBounds.size() == this->primIndices.size());
+
+    for (unsigned i = (unsigned)this->nodes.size(); i-- > 0;)
+    {
+        WideBVHNode<WIDTH>& node = this->nodes[i];
+        for (unsigned s = 0; s < WIDTH; s++)
+        {
+            BBox bounds;
+            if (node.count[s] > 0)
+            {
+                for (unsigned p = 0; p < node.count[s]; p++)
+                    bounds.Grow(BVH::PaddedBounds(primBounds[this->primIndices[node.child[s] + p]]));
+            }
+            else if (node.child[s] != 0)
+            {
+                bounds = NodeBounds(this->nodes[node.child[s]]);
+            }
+            else
+            {
+                continue;
+            }
+            node.minX[s] = bounds.min[0];
+            node.maxX[s] = bounds.max[0];
+            node.minY[s] = bounds.min[1];
+            node.maxY[s] = bounds.max[1];
+            node.minZ[s] = bounds.min[2];
+            node.maxZ[s] = bounds.max[2];
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+/**
+    Unused slots must have the infinite bounds no ray can hit, their child 0
+    would lead back to the root
+*/
+template<unsigned WIDTH>
+bool
+WideBVH<WIDTH>::Validate(unsigned numObjects) const
+{
+    WideBVHNode<WIDTH> const* nodes = this->NodeData();
+    unsigned const* prims = this->PrimData();
+    unsigned nodeCount = this->NodeCount();
+    unsigned primCount = this->PrimCount();
+    for (unsigned i = 0; i < primCount; i++)
+    {
+        if (prims[i] >= numObjects)
+            return false;
+    }
+
+    std::vector<unsigned char> depth(nodeCount, 0);
+    for (unsigned i = 0; i < nodeCount; i++)
+    {
+        WideBVHNode<WIDTH> const& node = nodes[i];
+        for (unsigned s = 0; s < WIDTH; s++)
+        {
+            unsigned child = node.child[s];
+            if (node.count[s] > 0)
+            {
+                if ((unsigned long long)child + node.count[s] > primCount)
+                    return false;
+            }
+            else if (child != 0)
+            {
+                if (child <= i || child >= nodeCount || depth[i] >= BVH::MaxDepth)
+                    return false;
+                depth[child] = depth[i] + 1;
+            }
+            else if (node.minX[s] != INFINITY || node.maxX[s] != INFINITY || node.minY[s] != INFINITY ||
+                     node.maxY[s] != INFINITY || node.minZ[s] != INFINITY || node.maxZ[s] != INFINITY)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template class WideBVH<4>;
+template class WideBVH<8>;
@@ -0,0 +1,188 @@
+#pragma once
+#include <vector>
+#include <type_traits>
+#include "bvh.h"
+#include "simd.h"
+
+//------------------------------------------------------------------------------
+/**
+    Node of a WIDTH-ary BVH. Child bounds are stored as structure of arrays
+    so that all children are slab tested at once.
+    Unused slots have all bounds set to +inf, which no ray can hit.
+*/
+template<unsigned WIDTH>
+struct alignas(64) WideBVHNode
+{
+    static constexpr unsigned OrderBits = WIDTH == 4 ? 2 : 3;
+    using OrderType = typename std::conditional<WIDTH == 4, unsigned char, unsigned>::type;
+
+    float minX[WIDTH];
+    float maxX[WIDTH];
+    float minY[WIDTH];
+    float maxY[WIDTH];
+    float minZ[WIDTH];
+    float maxZ[WIDTH];
+    // interior children: node index, leaf children: first primitive
+    unsigned child[WIDTH];
+    // number of primitives for leaf children, 0 for interior children and unused slots
+    unsigned char count[WIDTH];
+    // front to back visiting order of the children for each ray direction octant,
+    // OrderBits per slot with the nearest child in the lowest bits
+    OrderType order[8];
+
+    SIMD_INLINE unsigned ChildInOrder(unsigned octant, unsigned i) const
+    {
+        return (this->order[octant] >> (i * OrderBits)) & (WIDTH - 1);
+    }
+};
+
+//------------------------------------------------------------------------------
+/**
+    Multi branching BVH, built by collapsing a binary BVH
+*/
+template<unsigned WIDTH>
+class WideBVH
+{
+public:
+    // collapse a binary tree, primitive indices are shared with it
+    void Build(BVH const& bvh);
+
+    // move nodes into the given layout
+    void Reorder(BVHLayout layout);
+
+    // same as BVH::Refit, child bounds are updated bottom up and the topology,
+    // layout and visiting orders are kept. An attached tree is copied into the vectors first
+    void Refit(std::vector<BBox> const& primBounds);
+
+    // same as BVH::Validate
+    bool Validate(unsigned numObjects) const;
+
+    // same contract as BVH::Intersect
+    template<class INTERSECT, class VISIT = NoVisit>
+    void Intersect(Ray const& ray, float& tMax, INTERSECT&& intersect, VISIT&& visit = VISIT()) const;
+
+    // same contract as BVH::IntersectLeaves
+    template<class LEAF, class VISIT = NoVisit>
+    void IntersectLeaves(Ray const& ray, float& tMax, LEAF&& leaf, VISIT&& visit = VISIT()) const;
+
+    // same as BVH::Attach, the next Build goes back to the vectors
+    void Attach(WideBVHNode<WIDTH> const* nodes, unsigned nodeCount, unsigned const* primIndices, unsigned primCount)
+    {
+        this->nodes.clear();
+        this->nodes.shrink_to_fit();
+        this->primIndices.clear();
+        this->primIndices.shrink_to_fit();
+        this->attachedNodes = nodes;
+        this->attachedNodeCount = nodeCount;
+        this->attachedPrims = primIndices;
+        this->attachedPrimCount = primCount;
+    }
+    SIMD_INLINE bool IsAttached() const { return this->attachedNodes != nullptr; }
+    SIMD_INLINE unsigned NodeCount() const { return this->IsAttached() ? this->attachedNodeCount : (unsigned)this->nodes.size(); }
+    SIMD_INLINE unsigned PrimCount() const { return this->IsAttached() ? this->attachedPrimCount : (unsigned)this->primIndices.size(); }
+    SIMD_INLINE WideBVHNode<WIDTH> const* NodeData() const { return this->IsAttached() ? this->attachedNodes : this->nodes.data(); }
+    SIMD_INLINE unsigned const* PrimData() const { return this->IsAttached() ? this->attachedPrims : this->primIndices.data(); }
+
+    std::vector<WideBVHNode<WIDTH>> nodes;
+    std::vector<unsigned> primIndices;
+
+private:
+    WideBVHNode<WIDTH> const* attachedNodes = nullptr;
+    unsigned const* attachedPrims = nullptr;
+    unsigned attachedNodeCount = 0;
+    unsigned attachedPrimCount = 0;
+
+    // fill the wide node at index from the binary node with the given index
+    void Collapse(BVH const& bvh, unsigned binaryIndex, unsigned index);
+};
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<unsigned WIDTH>
+template<class INTERSECT, class VISIT>
+inline void
+WideBVH<WIDTH>::Intersect(Ray const& ray, float& tMax, INTERSECT&& intersect, VISIT&& visit) const
+{
+    unsigned const* primIndices = this->PrimData();
+    this->IntersectLeaves(ray, tMax, [&](unsigned first, unsigned count)
+    {
+        visit(&primIndices[first], count * sizeof(unsigned));
+        for (unsigned i = 0; i < count; i++)
+            intersect(primIndices[first + i]);
+    }, visit);
+}
+
+//------------------------------------------------------------------------------
+/**
+*/
+template<unsigned WIDTH>
+template<class LEAF, class VISIT>
+inline void
+WideBVH<WIDTH>::IntersectLeaves(Ray const& ray, float& tMax, LEAF&& leaf, VISIT&& visit) const
+{
+    if (this->NodeCount() == 0)
+        return;
+
+    WideBVHNode<WIDTH> const* nodes = this->NodeData();
+    using vf = vfloat<WIDTH>;
+    BVHRay r(ray);
+    vf ox = vf::Broadcast(r.origin[0]);
+    vf oy = vf::Broadcast(r.origin[1]);
+    vf oz = vf::Broadcast(r.origin[2]);
+    vf idx = vf::Broadcast(r.invDir[0]);
+    vf idy = vf::Broadcast(r.invDir[1]);
+    vf idz = vf::Broadcast(r.invDir[2]);
+    vf zero = vf::Broadcast(0.0f);
+    vf widen = vf::Broadcast(1.0000004f);
+    unsigned octant = (r.invDir[0] < 0.0f ? 1 : 0) | (r.invDir[1] < 0.0f ? 2 : 0) | (r.invDir[2] < 0.0f ? 4 : 0);
+
+    struct Entry
+    {
+        unsigned index;
+        // primitive count for leaves, 0 for nodes
+        unsigned count;
+        float dist;
+    };
+    Entry stack[BVH::MaxDepth * WIDTH];
+    unsigned stackPtr = 0;
+    stack[stackPtr++] = { 0, 0, 0.0f };
+
+    while (stackPtr > 0)
+    {
+        Entry entry = stack[--stackPtr];
+        if (entry.dist >= tMax)
+            continue;
+
+        if (entry.count > 0)
+        {
+            leaf(entry.index, entry.count);
+            continue;
+        }
+
+        WideBVHNode<WIDTH> const& node = nodes[entry.index];
+        visit(&node, sizeof(WideBVHNode<WIDTH>));
+        vf tx1 = (vf::Load(node.minX) - ox) * idx;
+        vf tx2 = (vf::Load(node.maxX) - ox) * idx;
+        vf ty1 = (vf::Load(node.minY) - oy) * idy;
+        vf ty2 = (vf::Load(node.maxY) - oy) * idy;
+        vf tz1 = (vf::Load(node.minZ) - oz) * idz;
+        vf tz2 = (vf::Load(node.maxZ) - oz) * idz;
+        vf tNear = Max(Max(Min(tx1, tx2), Min(ty1, ty2)), Min(tz1, tz2));
+        vf tFar = Min(Min(Max(tx1, tx2), Max(ty1, ty2)), Max(tz1, tz2)) * widen;
+        unsigned hits = Mask((tFar >= tNear) & (tNear < vf::Broadcast(tMax)) & (tFar > zero));
+        if (hits == 0)
+            continue;
+
+        alignas(32) float dist[WIDTH];
+        tNear.Store(dist);
+
+        // push back to front, so the child nearest along the ray direction is popped first
+        for (unsigned i = WIDTH; i-- > 0;)
+        {
+            unsigned c = node.ChildInOrder(octant, i);
+            if (hits & (1u << c))
+                stack[stackPtr++] = { node.child[c], node.count[c], dist[c] };
+        }
+    }
+}